@@ -1,8 +1,50 @@
 #include "CHIP_8.h"
+#include <chrono>
 #include <fstream>
-#include <iostream>
 #include <cstring>
-#include <SDL.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace
+{
+    inline uint8_t LowestKey(uint16_t keys)
+    {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward(&index, keys);
+        return (uint8_t)index;
+#else
+        return (uint8_t)__builtin_ctz(keys);
+#endif
+    }
+
+    // Moves the rows of a plane column count rows down (count > 0) or up,
+    // clearing the rows left behind
+    inline void ScrollColumn(uint64_t* column, unsigned int rows, int count)
+    {
+        if (count > 0)
+        {
+            memmove(column + count, column, (rows - count) * sizeof(uint64_t));
+            memset(column, 0, count * sizeof(uint64_t));
+        }
+        else
+        {
+            memmove(column, column - count, (rows + count) * sizeof(uint64_t));
+            memset(column + rows + count, 0, -count * sizeof(uint64_t));
+        }
+    }
+
+    inline uint16_t Fetch(uint8_t const* memory, unsigned int address)
+    {
+        return (uint16_t)((memory[address & 0x0FFF] << 8u) | memory[(address + 1) & 0x0FFF]);
+    }
+
+    inline uint64_t RotateRight(uint64_t bits, unsigned int count)
+    {
+        return (bits >> count) | (bits << ((64 - count) & 63));
+    }
+}
 
 const uint8_t FONTSET_SIZE = 80;
 uint8_t fontset[FONTSET_SIZE] =
@@ -25,110 +67,116 @@ uint8_t fontset[FONTSET_SIZE] =
     0xF0, 0x80, 0xF0, 0x80, 0x80  // F
 };
 
+// SUPER-CHIP 8 x 10 digits, with XO-CHIP's A-F
+const uint8_t BIG_FONTSET_SIZE = 160;
+uint8_t bigFontset[BIG_FONTSET_SIZE] =
+{
+    0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+    0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+    0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+    0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+    0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+    0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+    0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+    0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+};
 
-const uint8_t FONTSET_START_ADDRESS = 0x50;
 CHIP_8::CHIP_8()
-    : randGen(std::chrono::system_clock::now().time_since_epoch().count())
+    : audio(nullptr), video(nullptr), input(nullptr), idleSkip(true), verifyRecompiler(false),
+      quirks(DEFAULT_QUIRKS), dispatch(dispatchTables[DEFAULT_QUIRKS].data())
 {
-    //Initialize The Stack Pointer
-    SP = 0x00;
+    PowerOnState(*this, nullptr, 0);
 
-    PC = 0x200;
+    Inst_Reg = 0;
+    exitFlags = 0;
+    cyclesPerFrame = DEFAULT_CYCLES_PER_FRAME;
+    frameCountdown = cyclesPerFrame;
 
-    Sound_Timer = 0;
+    // Initialize RNG, SetSeed() makes runs repeatable
+    SetSeed((uint32_t)std::chrono::system_clock::now().time_since_epoch().count());
 
-    // Load fonts into memory
-    for (uint8_t i = 0; i < FONTSET_SIZE; ++i)
-    {
-        Memory[FONTSET_START_ADDRESS + i] = fontset[i];
-    }
+    dirtyTop = 0;
+    dirtyBottom = DISPLAY_HEIGHT;
 
-    // Initialize RNG
-    randByte = std::uniform_int_distribution<short>(0, 255U);
+    InvalidateCode(0, sizeof(Memory));
+}
 
-    memset(Display, 0, sizeof(Display));
+// Cleared machine with the font loaded, PC at 0x200 and the ROM (if any) above it
+bool CHIP_8::PowerOnState(MachineState& state, uint8_t const* rom, size_t size)
+{
+    memset(&state, 0, sizeof(MachineState));
+    state.PC = START_ADDRESS;
+    state.randState = 0x9E3779B9u;
+    state.planes = 0x1;
+
+    // Load fonts into memory
+    memcpy(&state.Memory[FONTSET_START_ADDRESS], fontset, FONTSET_SIZE);
+    memcpy(&state.Memory[BIG_FONTSET_START_ADDRESS], bigFontset, BIG_FONTSET_SIZE);
 
-    // Set up function pointer table
-    table[0x0] = &CHIP_8::Table0;
-    table[0x1] = &CHIP_8::MC_1NNN;
-    table[0x2] = &CHIP_8::MC_2NNN;
-    table[0x3] = &CHIP_8::MC_3XNN;
-    table[0x4] = &CHIP_8::MC_4XNN;
-    table[0x5] = &CHIP_8::MC_5XY0;
-    table[0x6] = &CHIP_8::MC_6XNN;
-    table[0x7] = &CHIP_8::MC_7XNN;
-    table[0x8] = &CHIP_8::Table8;
-    table[0x9] = &CHIP_8::MC_9XY0;
-    table[0xA] = &CHIP_8::MC_ANNN;
-    table[0xB] = &CHIP_8::MC_BNNN;
-    table[0xC] = &CHIP_8::MC_CXNN;
-    table[0xD] = &CHIP_8::MC_DXYN;
-    table[0xE] = &CHIP_8::TableE;
-    table[0xF] = &CHIP_8::TableF;
-
-    for (size_t i = 0; i <= 0xE; i++)
+    if (size > sizeof(state.Memory) - START_ADDRESS)
     {
-        table0[i] = &CHIP_8::OP_NULL;
-        table8[i] = &CHIP_8::OP_NULL;
-        tableE[i] = &CHIP_8::OP_NULL;
+        return false;
     }
-
-    table0[0x0] = &CHIP_8::MC_00E0;
-    table0[0xE] = &CHIP_8::MC_00EE;
-
-    table8[0x0] = &CHIP_8::MC_8XY0;
-    table8[0x1] = &CHIP_8::MC_8XY1;
-    table8[0x2] = &CHIP_8::MC_8XY2;
-    table8[0x3] = &CHIP_8::MC_8XY3;
-    table8[0x4] = &CHIP_8::MC_8XY4;
-    table8[0x5] = &CHIP_8::MC_8XY5;
-    table8[0x6] = &CHIP_8::MC_8XY6;
-    table8[0x7] = &CHIP_8::MC_8XY7;
-    table8[0xE] = &CHIP_8::MC_8XYE;
-
-    tableE[0x1] = &CHIP_8::MC_EXA1;
-    tableE[0xE] = &CHIP_8::MC_EX9E;
-
-    for (size_t i = 0; i <= 0x65; i++)
+    if (size)
     {
-        tableF[i] = &CHIP_8::OP_NULL;
+        memcpy(&state.Memory[START_ADDRESS], rom, size);
     }
+    return true;
+}
 
-    tableF[0x07] = &CHIP_8::MC_FX07;
-    tableF[0x0A] = &CHIP_8::MC_FX0A;
-    tableF[0x15] = &CHIP_8::MC_FX15;
-    tableF[0x18] = &CHIP_8::MC_FX18;
-    tableF[0x1E] = &CHIP_8::MC_FX1E;
-    tableF[0x29] = &CHIP_8::MC_FX29;
-    tableF[0x33] = &CHIP_8::MC_FX33;
-    tableF[0x55] = &CHIP_8::MC_FX55;
-    tableF[0x65] = &CHIP_8::MC_FX65;
+CHIP_8::~CHIP_8()
+{
+    //dtor
+}
 
-    if (SDL_Init(SDL_INIT_AUDIO) < 0) {
-        std::cerr << "Failed to initialize SDL audio: " << SDL_GetError() << std::endl;
-    }
+void CHIP_8::Attach(AudioSink* audioSink, VideoSink* videoSink, InputSource* inputSource)
+{
+    audio = audioSink;
+    video = videoSink;
+    input = inputSource;
+}
 
-    SDL_AudioSpec wavSpec;
-    if (SDL_LoadWAV("beep.wav", &wavSpec, &wavBuffer, &wavLength) == NULL) {
-        std::cerr << "Failed to load WAV: " << SDL_GetError() << std::endl;
-    }
+bool CHIP_8::PollInput()
+{
+    return input ? input->ProcessInput(keypad) : false;
+}
 
-    deviceId = SDL_OpenAudioDevice(NULL, 0, &wavSpec, NULL, 0);
-    if (deviceId == 0) {
-        std::cerr << "Failed to open audio device: " << SDL_GetError() << std::endl;
+bool CHIP_8::Present()
+{
+    if (!DisplayDirty()) {
+        return false;
+    }
+    if (video) {
+        video->Update(Display, hires != 0, dirtyTop, dirtyBottom);
     }
+    dirtyTop = HIRES_HEIGHT;
+    dirtyBottom = 0;
+    return true;
 }
 
-CHIP_8::~CHIP_8()
+// Merges rows [top, bottom) into the range the next Present() hands out
+void CHIP_8::DisplayChanged(unsigned int top, unsigned int bottom)
 {
-    //dtor
-    SDL_CloseAudioDevice(deviceId);
-    SDL_FreeWAV(wavBuffer);
-    SDL_Quit();
+    if (top < dirtyTop) dirtyTop = (uint8_t)top;
+    if (bottom > dirtyBottom) dirtyBottom = (uint8_t)bottom;
+    exitFlags |= EXIT_DRAW;
 }
 
-const unsigned int START_ADDRESS = 0x200;
-void CHIP_8::LoadROM(char const* filename)
+void CHIP_8::SetSeed(uint32_t seed)
+{
+    // xorshift must never be zero
+    randState = seed ? seed : 0x9E3779B9u;
+}
+
+bool CHIP_8::LoadROM(char const* filename)
 {
     // Open the file as a stream of binary and move the file pointer to the end
     std::ifstream file(filename, std::ios::binary | std::ios::ate);
@@ -144,118 +192,300 @@ void CHIP_8::LoadROM(char const* filename)
         file.read(buffer, size);
         file.close();
 
-        // Load the ROM contents into the Chip8's memory, starting at 0x200
-        for (long i = 0; i < size; ++i)
-        {
-            //std::cout<<buffer[i]<<"\n";
-            Memory[START_ADDRESS + i] = buffer[i];
-        }
+        bool loaded = LoadROM((uint8_t const*)buffer, (size_t)size);
 
         // Free the buffer
         delete[] buffer;
+        return loaded;
+    }
+    return false;
+}
+
+bool CHIP_8::LoadROM(uint8_t const* data, size_t size)
+{
+    if (size > sizeof(Memory) - START_ADDRESS)
+    {
+        return false;
+    }
+
+    // Load the ROM contents into the Chip8's memory, starting at 0x200
+    memcpy(&Memory[START_ADDRESS], data, size);
+    InvalidateCode(START_ADDRESS, (uint16_t)size);
+    return true;
+}
+
+
+///////////////////////////////// Save States ///////////////////////////////////////
+void CHIP_8::SaveState(Snapshot& snapshot) const
+{
+    snapshot.magic = SNAPSHOT_MAGIC;
+    snapshot.version = SNAPSHOT_VERSION;
+    snapshot.size = sizeof(MachineState);
+    snapshot.reserved = 0;
+    memcpy(&snapshot.state, static_cast<const MachineState*>(this), sizeof(MachineState));
+}
+
+bool CHIP_8::LoadState(Snapshot const& snapshot)
+{
+    if (snapshot.magic != SNAPSHOT_MAGIC || snapshot.version != SNAPSHOT_VERSION || snapshot.size != sizeof(MachineState))
+    {
+        return false;
+    }
+    Reset(snapshot.state);
+    return true;
+}
+
+void CHIP_8::Reset(MachineState const& state)
+{
+    // Only code the new state actually changes has to be decoded again
+    const uint16_t CHUNK = 64;
+    for (uint16_t address = 0; address < sizeof(Memory); address += CHUNK)
+    {
+        if (memcmp(&Memory[address], &state.Memory[address], CHUNK) != 0)
+        {
+            InvalidateCode(address, CHUNK);
+        }
+    }
+
+    memcpy(static_cast<MachineState*>(this), &state, sizeof(MachineState));
+    if (frameCountdown == 0 || frameCountdown > cyclesPerFrame)
+    {
+        frameCountdown = cyclesPerFrame;
     }
+    dirtyTop = 0;
+    dirtyBottom = hires ? HIRES_HEIGHT : DISPLAY_HEIGHT;
+}
+
+// The file form is the Snapshot itself, in host byte order
+bool CHIP_8::SaveState(char const* filename) const
+{
+    std::unique_ptr<Snapshot> snapshot(new Snapshot);
+    SaveState(*snapshot);
+
+    std::ofstream file(filename, std::ios::binary);
+    file.write((char const*)snapshot.get(), sizeof(Snapshot));
+    return file.good();
 }
 
+bool CHIP_8::LoadState(char const* filename)
+{
+    std::unique_ptr<Snapshot> snapshot(new Snapshot);
+
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.read((char*)snapshot.get(), sizeof(Snapshot)))
+    {
+        return false;
+    }
+    return LoadState(*snapshot);
+}
 
 ///////////////////////////////// Instruction Set Functions ///////////////////////////////////////
+void CHIP_8::MC_00CN() {
+    unsigned int rows = hires ? HIRES_HEIGHT : DISPLAY_HEIGHT;
+    unsigned int columns = hires ? DISPLAY_COLUMNS : 1;
+    unsigned int count = Inst_Reg & 0x000F;
+    for (unsigned int plane = 0; plane < DISPLAY_PLANES; ++plane) {
+        if (planes & (1 << plane)) {
+            for (unsigned int column = 0; column < columns; ++column) {
+                ScrollColumn(Display[plane][column], rows, (int)count);
+            }
+        }
+    }
+    DisplayChanged(0, rows);
+}
+
+void CHIP_8::MC_00DN() {
+    unsigned int rows = hires ? HIRES_HEIGHT : DISPLAY_HEIGHT;
+    unsigned int columns = hires ? DISPLAY_COLUMNS : 1;
+    unsigned int count = Inst_Reg & 0x000F;
+    for (unsigned int plane = 0; plane < DISPLAY_PLANES; ++plane) {
+        if (planes & (1 << plane)) {
+            for (unsigned int column = 0; column < columns; ++column) {
+                ScrollColumn(Display[plane][column], rows, -(int)count);
+            }
+        }
+    }
+    DisplayChanged(0, rows);
+}
+
+// Only the selected planes are cleared, and in low resolution only the words it uses
 void CHIP_8::MC_00E0() {
-    memset(Display, 0, sizeof(Display));
+    for (unsigned int plane = 0; plane < DISPLAY_PLANES; ++plane) {
+        if (planes & (1 << plane)) {
+            if (hires) {
+                memset(Display[plane], 0, sizeof(Display[plane]));
+            }
+            else {
+                memset(Display[plane][0], 0, DISPLAY_HEIGHT * sizeof(uint64_t));
+            }
+        }
+    }
+    DisplayChanged(0, hires ? HIRES_HEIGHT : DISPLAY_HEIGHT);
 }
 
 void CHIP_8::MC_00EE() {
     --SP;
-    PC = Stack[SP];
+    PC = Stack[SP & 0x0F];
+}
+
+// Horizontal scrolls shift whole rows, carrying bits between the two words of a high resolution row
+void CHIP_8::MC_00FB() {
+    for (unsigned int plane = 0; plane < DISPLAY_PLANES; ++plane) {
+        if (!(planes & (1 << plane))) {
+            continue;
+        }
+        uint64_t* left = Display[plane][0];
+        uint64_t* right = Display[plane][1];
+        if (hires) {
+            for (unsigned int y = 0; y < HIRES_HEIGHT; ++y) {
+                right[y] = (right[y] >> 4) | (left[y] << 60);
+                left[y] >>= 4;
+            }
+        }
+        else {
+            for (unsigned int y = 0; y < DISPLAY_HEIGHT; ++y) {
+                left[y] >>= 4;
+            }
+        }
+    }
+    DisplayChanged(0, hires ? HIRES_HEIGHT : DISPLAY_HEIGHT);
+}
+
+void CHIP_8::MC_00FC() {
+    for (unsigned int plane = 0; plane < DISPLAY_PLANES; ++plane) {
+        if (!(planes & (1 << plane))) {
+            continue;
+        }
+        uint64_t* left = Display[plane][0];
+        uint64_t* right = Display[plane][1];
+        if (hires) {
+            for (unsigned int y = 0; y < HIRES_HEIGHT; ++y) {
+                left[y] = (left[y] << 4) | (right[y] >> 60);
+                right[y] <<= 4;
+            }
+        }
+        else {
+            for (unsigned int y = 0; y < DISPLAY_HEIGHT; ++y) {
+                left[y] <<= 4;
+            }
+        }
+    }
+    DisplayChanged(0, hires ? HIRES_HEIGHT : DISPLAY_HEIGHT);
+}
+
+// The machine halts by running 00FD forever
+void CHIP_8::MC_00FD() {
+    PC -= 2;
+}
+
+// Switching resolution clears every plane, as XO-CHIP does
+void CHIP_8::MC_00FE() {
+    hires = 0;
+    memset(Display, 0, sizeof(Display));
+    DisplayChanged(0, DISPLAY_HEIGHT);
+}
+
+void CHIP_8::MC_00FF() {
+    hires = 1;
+    memset(Display, 0, sizeof(Display));
+    DisplayChanged(0, HIRES_HEIGHT);
 }
 
 void CHIP_8::MC_1NNN() {
     //we will and the content of Instruction register with 0FFF to extract
     //the address where the PC will jump to
-    PC = Inst_Reg & 0x0FFF;
+    uint16_t target = Inst_Reg & 0x0FFF;
+    if (ClosesLoop(PC - 2, target)) {
+        exitFlags |= EXIT_IDLE;
+    }
+    PC = target;
 }
 
 void CHIP_8::MC_2NNN() {
-    Stack[SP] = PC;
+    Stack[SP & 0x0F] = PC;
     ++SP;
 
     PC = Inst_Reg & 0x0FFF;
 }
 
 //Skip next instruction if Vx != NN
+template <uint8_t X>
 void CHIP_8::MC_3XNN() {
     uint8_t NN = (uint8_t)(Inst_Reg & 0x00FF);
-    uint8_t Vx = (uint8_t)((Inst_Reg >> 8) & 0x0F);
 
-    if (V0VF_Registers[Vx] == NN) {
+    if (V0VF_Registers[X] == NN) {
         PC += 2;
     }
 }
 
 //Skip next instruction if Vx == NN
+template <uint8_t X>
 void CHIP_8::MC_4XNN() {
     uint8_t NN = (uint8_t)(Inst_Reg & 0x00FF);
-    uint8_t Vx = (uint8_t)((Inst_Reg >> 8) & 0x0F);
 
-    if (V0VF_Registers[Vx] != NN) {
+    if (V0VF_Registers[X] != NN) {
         PC += 2;
     }
 }
 
 //Skip next instruction if Vx == Vy
+template <uint8_t X, uint8_t Y>
 void CHIP_8::MC_5XY0() {
-    uint8_t Vy = (uint8_t)((Inst_Reg >> 4) & 0x0F);
-    uint8_t Vx = (uint8_t)((Inst_Reg >> 8) & 0x0F);
-
-    if (V0VF_Registers[Vy] == V0VF_Registers[Vx]) {
+    if (V0VF_Registers[Y] == V0VF_Registers[X]) {
         PC += 2;
     }
 }
 
+template <uint8_t X>
 void CHIP_8::MC_6XNN() {
-    uint8_t Vx = (Inst_Reg >> 8) & 0x0F;
-    V0VF_Registers[Vx] = (uint8_t)(Inst_Reg & 0x00FF);
+    V0VF_Registers[X] = (uint8_t)(Inst_Reg & 0x00FF);
 }
 
+template <uint8_t X>
 void CHIP_8::MC_7XNN() {
-    uint8_t Vx = (uint8_t)((Inst_Reg >> 8) & 0x0F);
-    V0VF_Registers[Vx] += (uint8_t)(Inst_Reg & 0x00FF);
+    V0VF_Registers[X] += (uint8_t)(Inst_Reg & 0x00FF);
 }
 
+template <uint8_t X, uint8_t Y>
 void CHIP_8::MC_8XY0() {
-    uint8_t Vx = (uint8_t)((Inst_Reg >> 8) & 0x0F);
-    uint8_t Vy = (uint8_t)((Inst_Reg >> 4) & 0x0F);
-    V0VF_Registers[Vx] = V0VF_Registers[Vy];
+    V0VF_Registers[X] = V0VF_Registers[Y];
 }
 
+template <QuirkProfile Q, uint8_t X, uint8_t Y>
 void CHIP_8::MC_8XY1() {
-    uint8_t Vx = (uint8_t)((Inst_Reg >> 8) & 0x0F);
-    uint8_t Vy = (uint8_t)((Inst_Reg >> 4) & 0x0F);
-    V0VF_Registers[Vx] |= V0VF_Registers[Vy];
+    V0VF_Registers[X] |= V0VF_Registers[Y];
+    if constexpr (QUIRK_SETS[Q].logicResetsVF) {
+        V0VF_Registers[0xF] = 0;
+    }
 }
 
+template <QuirkProfile Q, uint8_t X, uint8_t Y>
 void CHIP_8::MC_8XY2() {
-    uint8_t Vx = (uint8_t)((Inst_Reg >> 8) & 0x0F);
-    uint8_t Vy = (uint8_t)((Inst_Reg >> 4) & 0x0F);
-    V0VF_Registers[Vx] &= V0VF_Registers[Vy];
+    V0VF_Registers[X] &= V0VF_Registers[Y];
+    if constexpr (QUIRK_SETS[Q].logicResetsVF) {
+        V0VF_Registers[0xF] = 0;
+    }
 }
 
+template <QuirkProfile Q, uint8_t X, uint8_t Y>
 void CHIP_8::MC_8XY3() {
-    uint8_t Vx = (uint8_t)((Inst_Reg >> 8) & 0x0F);
-    uint8_t Vy = (uint8_t)((Inst_Reg >> 4) & 0x0F);
-    V0VF_Registers[Vx] ^= V0VF_Registers[Vy];
+    V0VF_Registers[X] ^= V0VF_Registers[Y];
+    if constexpr (QUIRK_SETS[Q].logicResetsVF) {
+        V0VF_Registers[0xF] = 0;
+    }
 }
 
+template <uint8_t X, uint8_t Y>
 void CHIP_8::MC_8XY4() {
-    uint8_t Vx = (uint8_t)((Inst_Reg >> 8) & 0x0F);
-    uint8_t Vy = (uint8_t)((Inst_Reg >> 4) & 0x0F);
-    uint16_t sum = V0VF_Registers[Vx] + V0VF_Registers[Vy];
+    uint16_t sum = V0VF_Registers[X] + V0VF_Registers[Y];
 
     if (sum > 255)
         V0VF_Registers[0xF] = 1;
     else
         V0VF_Registers[0xF] = 0;
 
-    //V0VF_Registers[Vx] += V0VF_Registers[Vy];
-    V0VF_Registers[Vx] = uint8_t(sum & 0x00ff);
+    //V0VF_Registers[X] += V0VF_Registers[Y];
+    V0VF_Registers[X] = uint8_t(sum & 0x00ff);
 }
 
 /*
@@ -264,24 +494,23 @@ void CHIP_8::MC_8XY4() {
     VF will be set to 01, as the borrow is 0.
     If VX is inferior to VY, VF is set to 00, as the borrow is 1.
 */
+template <uint8_t X, uint8_t Y>
 void CHIP_8::MC_8XY5() {
-    uint8_t Vx = (uint8_t)((Inst_Reg >> 8) & 0x0F);
-    uint8_t Vy = (uint8_t)((Inst_Reg >> 4) & 0x0F);
-
-    if (V0VF_Registers[Vx] < V0VF_Registers[Vy])
+    if (V0VF_Registers[X] < V0VF_Registers[Y])
         V0VF_Registers[0xF] = 0x00;
     else
         V0VF_Registers[0xF] = 0x01;
 
-    V0VF_Registers[Vx] -= V0VF_Registers[Vy];
+    V0VF_Registers[X] -= V0VF_Registers[Y];
 }
 
+template <QuirkProfile Q, uint8_t X, uint8_t Y>
 void CHIP_8::MC_8XY6() {
-    uint8_t Vx = (uint8_t)((Inst_Reg >> 8) & 0x0F);
+    uint8_t value = V0VF_Registers[QUIRK_SETS[Q].shiftReadsVy ? Y : X];
     //Save The LSB
-    V0VF_Registers[0xF] = (V0VF_Registers[Vx] & 0x01);
-    //Vx = Vx / 2
-    V0VF_Registers[Vx] >>= 1;
+    V0VF_Registers[0xF] = (value & 0x01);
+    //Vx = value / 2
+    V0VF_Registers[X] = value >> 1;
 }
 
 /*
@@ -290,31 +519,30 @@ void CHIP_8::MC_8XY6() {
     VF will be set to 01, as the borrow is 0.
     If VY is inferior to VX, VF is set to 00, as the borrow is 1.
 */
+template <uint8_t X, uint8_t Y>
 void CHIP_8::MC_8XY7() {
-    uint8_t Vx = (uint8_t)((Inst_Reg >> 8) & 0x0F);
-    uint8_t Vy = (uint8_t)((Inst_Reg >> 4) & 0x0F);
-
-    if (V0VF_Registers[Vy] < V0VF_Registers[Vx])
+    uint8_t difference = V0VF_Registers[Y] - V0VF_Registers[X];
+    if (V0VF_Registers[Y] < V0VF_Registers[X])
         V0VF_Registers[0xF] = 0x00;
     else
         V0VF_Registers[0xF] = 0x01;
 
-    V0VF_Registers[Vy] -= V0VF_Registers[Vx];
+    V0VF_Registers[X] = difference;
 }
 
 
+template <QuirkProfile Q, uint8_t X, uint8_t Y>
 void CHIP_8::MC_8XYE() {
-    uint8_t Vx = (uint8_t)((Inst_Reg >> 8) & 0x0F);
-    V0VF_Registers[0xF] = (V0VF_Registers[Vx] & 0x80);
-    //Vx = Vx * 2
-    V0VF_Registers[Vx] <<= 1;
+    uint8_t value = V0VF_Registers[QUIRK_SETS[Q].shiftReadsVy ? Y : X];
+    //Save The MSB
+    V0VF_Registers[0xF] = value >> 7;
+    //Vx = value * 2
+    V0VF_Registers[X] = (uint8_t)(value << 1);
 }
 
+template <uint8_t X, uint8_t Y>
 void CHIP_8::MC_9XY0() {
-    uint8_t Vx = (uint8_t)((Inst_Reg >> 8) & 0x0F);
-    uint8_t Vy = (uint8_t)((Inst_Reg >> 4) & 0x0F);
-
-    if (V0VF_Registers[Vy] != V0VF_Registers[Vx]) {
+    if (V0VF_Registers[Y] != V0VF_Registers[X]) {
         PC += 2;
     }
 }
@@ -323,13 +551,15 @@ void CHIP_8::MC_ANNN() {
     Index_REG = Inst_Reg & 0x0FFF;
 }
 
+// BXNN on CHIP-48 and SUPER-CHIP: XNN is the same 12 bits, offset by VX
+template <QuirkProfile Q, uint8_t X>
 void CHIP_8::MC_BNNN() {
-    PC = (uint16_t)V0VF_Registers[0x00] + (Inst_Reg & 0x0FFF);
+    PC = (uint16_t)V0VF_Registers[QUIRK_SETS[Q].jumpUsesVx ? X : 0x00] + (Inst_Reg & 0x0FFF);
 }
 
+template <uint8_t X>
 void CHIP_8::MC_CXNN() {
-    uint8_t Vx = (uint8_t)((Inst_Reg >> 8) & 0x0F);
-    V0VF_Registers[Vx] = randByte(randGen) & (uint8_t)(Inst_Reg & 0x00FF);
+    V0VF_Registers[X] = RandomByte() & (uint8_t)(Inst_Reg & 0x00FF);
 }
 
 /*
@@ -339,225 +569,789 @@ void CHIP_8::MC_CXNN() {
 
             //Graphics are drawn as 8 x 1...15 sprites (they are byte coded)
 
+            The start position always wraps. The sprite itself is clipped
+            at the right and bottom edges, or wraps around them with the
+            wrapSprites quirk.
+
+            Plain CHIP-8 draws take the short path below; everything else
+            goes through DrawSprite().
 */
+template <QuirkProfile Q, uint8_t X, uint8_t Y>
 void CHIP_8::MC_DXYN() {
-    uint8_t Vx = (uint8_t)((Inst_Reg >> 8) & 0x0F);
-    uint8_t Vy = (uint8_t)((Inst_Reg >> 4) & 0x0F);
-    uint8_t Xpos = V0VF_Registers[Vx] % 64;
-    uint8_t Ypos = V0VF_Registers[Vy] % 32;
+    constexpr bool Wrap = QUIRK_SETS[Q].wrapSprites;
     uint8_t sprite_height = (uint8_t)(Inst_Reg & 0x0F);
+    if (hires || planes != 0x1 || sprite_height == 0) {
+        DrawSprite<Wrap>(V0VF_Registers[X], V0VF_Registers[Y], sprite_height);
+        return;
+    }
+
+    uint8_t Xpos = V0VF_Registers[X] % DISPLAY_WIDTH;
+    uint8_t Ypos = V0VF_Registers[Y] % DISPLAY_HEIGHT;
     V0VF_Registers[0xF] = 0;
+    exitFlags |= EXIT_DRAW;
 
+    if (!Wrap && sprite_height > DISPLAY_HEIGHT - Ypos) {
+        sprite_height = (uint8_t)(DISPLAY_HEIGHT - Ypos);
+    }
+
+    uint64_t* rows = Display[0][0];
+    uint64_t collision = 0;
+    uint64_t changed = 0;
     for (uint8_t row_index = 0; row_index < sprite_height; row_index++) {
-        uint8_t sprite_byte = Memory[Index_REG + row_index];
-        for (int sprite_index = 0; sprite_index < 8; sprite_index++) {
-            uint8_t sprite_pixel = (sprite_byte >> (7 - sprite_index)) & 0x01;
-            uint32_t displayPixel = Display[Ypos + row_index][Xpos + sprite_index];
-            if (sprite_pixel) {
-                if (displayPixel == 0xFFFFFFFF) {
-                    V0VF_Registers[0xF] = 0x1;
-                }
-                Display[Ypos + row_index][Xpos + sprite_index] ^= 0xFFFFFFFF;
+        uint64_t sprite_row = (uint64_t)Memory[(Index_REG + row_index) & 0x0FFF] << 56;
+        sprite_row = Wrap ? RotateRight(sprite_row, Xpos) : sprite_row >> Xpos;
+        uint8_t y = Wrap ? (Ypos + row_index) % DISPLAY_HEIGHT : Ypos + row_index;
+        collision |= rows[y] & sprite_row;
+        changed |= sprite_row;
+        rows[y] ^= sprite_row;
+    }
+
+    if (collision) {
+        V0VF_Registers[0xF] = 0x1;
+    }
+    if (changed) {
+        if (Wrap && Ypos + sprite_height > DISPLAY_HEIGHT) {
+            DisplayChanged(0, DISPLAY_HEIGHT);
+            return;
+        }
+        if (Ypos < dirtyTop) dirtyTop = Ypos;
+        if (Ypos + sprite_height > dirtyBottom) dirtyBottom = Ypos + sprite_height;
+    }
+}
+
+// DXYN in high resolution, on XO-CHIP planes, or 16 x 16 (height 0). With
+// both planes selected, the sprite for plane 1 follows the one for plane 0
+template <bool Wrap>
+void CHIP_8::DrawSprite(uint8_t x, uint8_t y, uint8_t height) {
+    unsigned int width = hires ? HIRES_WIDTH : DISPLAY_WIDTH;
+    unsigned int lines = hires ? HIRES_HEIGHT : DISPLAY_HEIGHT;
+    unsigned int Xpos = x & (width - 1);
+    unsigned int Ypos = y & (lines - 1);
+    unsigned int sprite_height = height;
+    unsigned int sprite_bytes = 1;
+    if (sprite_height == 0) {
+        sprite_height = 16;
+        sprite_bytes = 2;
+    }
+    V0VF_Registers[0xF] = 0;
+    exitFlags |= EXIT_DRAW;
+
+    unsigned int rows = sprite_height;
+    if (!Wrap && rows > lines - Ypos) {
+        rows = lines - Ypos;
+    }
+
+    // A sprite row lands in one word, or straddles the two words of a high
+    // resolution row. When sprites wrap, the bits past the right edge go to
+    // the first word of the row, which in low resolution is the same word.
+    unsigned int shift = Xpos & 63;
+    unsigned int column = Xpos >> 6;
+    unsigned int next = hires ? column ^ 1 : column;
+    bool straddles = shift != 0 && (Wrap || (hires && column == 0));
+
+    uint64_t collision = 0;
+    uint64_t changed = 0;
+    uint16_t address = Index_REG;
+    for (unsigned int plane = 0; plane < DISPLAY_PLANES; ++plane) {
+        if (!(planes & (1 << plane))) {
+            continue;
+        }
+
+        // Gather the visible rows left-aligned in a word, so the loops below have no branches
+        uint64_t sprite[16];
+        for (unsigned int row_index = 0; row_index < rows; row_index++) {
+            uint16_t at = (uint16_t)(address + row_index * sprite_bytes);
+            sprite[row_index] = (uint64_t)Memory[at & 0x0FFF] << 56;
+            if (sprite_bytes == 2) {
+                sprite[row_index] |= (uint64_t)Memory[(at + 1) & 0x0FFF] << 48;
             }
         }
+        address = (uint16_t)(address + sprite_height * sprite_bytes);
+
+        uint64_t* first = Display[plane][column];
+        for (unsigned int row_index = 0; row_index < rows; row_index++) {
+            unsigned int line = (Ypos + row_index) & (lines - 1);
+            uint64_t bits = sprite[row_index] >> shift;
+            collision |= first[line] & bits;
+            changed |= bits;
+            first[line] ^= bits;
+        }
+        if (straddles) {
+            uint64_t* second = Display[plane][next];
+            for (unsigned int row_index = 0; row_index < rows; row_index++) {
+                unsigned int line = (Ypos + row_index) & (lines - 1);
+                uint64_t bits = sprite[row_index] << (64 - shift);
+                collision |= second[line] & bits;
+                changed |= bits;
+                second[line] ^= bits;
+            }
+        }
+    }
+
+    if (collision) {
+        V0VF_Registers[0xF] = 0x1;
+    }
+    if (Wrap && changed && Ypos + rows > lines) {
+        DisplayChanged(0, lines);
+    }
+    else if (changed) {
+        if (Ypos < dirtyTop) dirtyTop = (uint8_t)Ypos;
+        if (Ypos + rows > dirtyBottom) dirtyBottom = (uint8_t)(Ypos + rows);
     }
 }
 
 
+template <uint8_t X>
 void CHIP_8::MC_EX9E() {
-    uint8_t Vx = (uint8_t)((Inst_Reg >> 8) & 0x0F);
-    uint8_t key = V0VF_Registers[Vx];
+    uint8_t key = V0VF_Registers[X];
 
-    if (keypad[key]) {
+    if (key < 16 && ((keypad >> key) & 1)) {
         PC += 2;
     }
 }
 
+template <uint8_t X>
 void CHIP_8::MC_EXA1() {
-    uint8_t Vx = (uint8_t)((Inst_Reg >> 8) & 0x0F);
-    if (!keypad[V0VF_Registers[Vx]]) {
+    uint8_t key = V0VF_Registers[X];
+
+    if (key >= 16 || !((keypad >> key) & 1)) {
         PC += 2;
     }
 }
 
+template <uint8_t X>
+void CHIP_8::MC_FN01() {
+    planes = X & 0x03;
+}
+
+template <uint8_t X>
 void CHIP_8::MC_FX07() {
-    uint8_t Vx = (uint8_t)((Inst_Reg >> 8) & 0x0F);
-    V0VF_Registers[Vx] = Delay_Timer;
+    V0VF_Registers[X] = Delay_Timer;
 }
 
 
+// The lowest numbered held key wins
+template <uint8_t X>
 void CHIP_8::MC_FX0A() {
-    uint8_t Vx = (uint8_t)((Inst_Reg >> 8) & 0x0F);
-    if (keypad[0])
-    {
-        V0VF_Registers[Vx] = 0;
-    }
-    else if (keypad[1])
-    {
-        V0VF_Registers[Vx] = 1;
-    }
-    else if (keypad[2])
-    {
-        V0VF_Registers[Vx] = 2;
-    }
-    else if (keypad[3])
-    {
-        V0VF_Registers[Vx] = 3;
-    }
-    else if (keypad[4])
-    {
-        V0VF_Registers[Vx] = 4;
-    }
-    else if (keypad[5])
-    {
-        V0VF_Registers[Vx] = 5;
-    }
-    else if (keypad[6])
-    {
-        V0VF_Registers[Vx] = 6;
-    }
-    else if (keypad[7])
-    {
-        V0VF_Registers[Vx] = 7;
-    }
-    else if (keypad[8])
-    {
-        V0VF_Registers[Vx] = 8;
-    }
-    else if (keypad[9])
-    {
-        V0VF_Registers[Vx] = 9;
+    if (keypad) {
+        V0VF_Registers[X] = LowestKey(keypad);
     }
-    else if (keypad[10])
-    {
-        V0VF_Registers[Vx] = 10;
-    }
-    else if (keypad[11])
-    {
-        V0VF_Registers[Vx] = 11;
-    }
-    else if (keypad[12])
-    {
-        V0VF_Registers[Vx] = 12;
-    }
-    else if (keypad[13])
-    {
-        V0VF_Registers[Vx] = 13;
-    }
-    else if (keypad[14])
-    {
-        V0VF_Registers[Vx] = 14;
-    }
-    else if (keypad[15])
-    {
-        V0VF_Registers[Vx] = 15;
-    }
-    else
-    {
+    else {
         PC -= 2;
+        exitFlags |= EXIT_KEY_WAIT | EXIT_IDLE;
     }
-
 }
 
+template <uint8_t X>
 void CHIP_8::MC_FX15() {
-    uint8_t Vx = (uint8_t)((Inst_Reg >> 8) & 0x0F);
-    Delay_Timer = V0VF_Registers[Vx];
+    Delay_Timer = V0VF_Registers[X];
 }
 
+template <uint8_t X>
 void CHIP_8::MC_FX18() {
-    uint8_t Vx = (uint8_t)((Inst_Reg >> 8) & 0x0F);
-    Sound_Timer = V0VF_Registers[Vx];
+    if (Sound_Timer == 0 && V0VF_Registers[X] != 0) {
+        exitFlags |= EXIT_SOUND;
+    }
+    Sound_Timer = V0VF_Registers[X];
 }
 
+template <uint8_t X>
 void CHIP_8::MC_FX1E() {
-    uint8_t Vx = (uint8_t)((Inst_Reg >> 8) & 0x0F);
-    Index_REG += V0VF_Registers[Vx];
+    Index_REG += V0VF_Registers[X];
 }
 
+template <uint8_t X>
 void CHIP_8::MC_FX29() {
     //Vx stores the digit that we want so we can take it as an offset
-    uint8_t Vx = (uint8_t)((Inst_Reg >> 8) & 0x0F);
-    Index_REG = FONTSET_START_ADDRESS + (V0VF_Registers[Vx] * 5);
+    Index_REG = FONTSET_START_ADDRESS + (V0VF_Registers[X] * 5);
+}
+
+template <uint8_t X>
+void CHIP_8::MC_FX30() {
+    Index_REG = BIG_FONTSET_START_ADDRESS + (V0VF_Registers[X] & 0x0F) * 10;
 }
 
+template <uint8_t X>
 void CHIP_8::MC_FX33() {
-    uint8_t Vx = (uint8_t)((Inst_Reg >> 8) & 0x0F);
-    uint8_t temp = V0VF_Registers[Vx];
+    uint8_t temp = V0VF_Registers[X];
     /*
         The interpreter takes the decimal value of Vx,
         and places the hundreds digit in memory at location in I,
         the tens digit at location I+1, and the ones digit at location I+2.
+        Like every I relative access, addresses past 0xFFF wrap around.
     */
-    Memory[Index_REG + 2] = temp % 10;
+    Memory[(Index_REG + 2) & 0x0FFF] = temp % 10;
     temp /= 10;
-    Memory[Index_REG + 1] = temp % 10;
+    Memory[(Index_REG + 1) & 0x0FFF] = temp % 10;
     temp /= 10;
-    Memory[Index_REG + 2] = temp;
+    Memory[Index_REG & 0x0FFF] = temp;
+    InvalidateCode(Index_REG, 3);
 }
 
+template <QuirkProfile Q, uint8_t X>
 void CHIP_8::MC_FX55() {
-    uint8_t Vx = (uint8_t)((Inst_Reg >> 8) & 0x0F);
-    for (uint8_t i = 0; i <= Vx; i++) {
-        Memory[Index_REG + i] = V0VF_Registers[i];
+    for (uint8_t i = 0; i <= X; i++) {
+        Memory[(Index_REG + i) & 0x0FFF] = V0VF_Registers[i];
+    }
+    InvalidateCode(Index_REG, X + 1);
+    if constexpr (QUIRK_SETS[Q].loadStoreIndex != INDEX_KEPT) {
+        Index_REG += X + (QUIRK_SETS[Q].loadStoreIndex == INDEX_PLUS_X_1);
     }
 }
 
+template <QuirkProfile Q, uint8_t X>
 void CHIP_8::MC_FX65() {
-    uint8_t Vx = (uint8_t)((Inst_Reg >> 8) & 0x0F);
-    for (uint8_t i = 0; i <= Vx; i++) {
-        V0VF_Registers[i] = Memory[Index_REG + i];
+    for (uint8_t i = 0; i <= X; i++) {
+        V0VF_Registers[i] = Memory[(Index_REG + i) & 0x0FFF];
+    }
+    if constexpr (QUIRK_SETS[Q].loadStoreIndex != INDEX_KEPT) {
+        Index_REG += X + (QUIRK_SETS[Q].loadStoreIndex == INDEX_PLUS_X_1);
     }
 }
 
+template <uint8_t X>
+void CHIP_8::MC_FX75() {
+    memcpy(flags, V0VF_Registers, X + 1);
+}
+
+template <uint8_t X>
+void CHIP_8::MC_FX85() {
+    memcpy(V0VF_Registers, flags, X + 1);
+}
+
 //////////////////////// Decoder functions ///////////////////////////////////////
-void CHIP_8::Table0()
+template <void (CHIP_8::* F)()>
+void CHIP_8::Invoke(CHIP_8& chip8)
 {
-    ((*this).*(table0[Inst_Reg & 0x000Fu]))();
+    (chip8.*F)();
 }
 
-void CHIP_8::Table8()
+// Handler for an opcode whose X and Y nibbles are already known, under quirk profile Q
+template <QuirkProfile Q, uint8_t X, uint8_t Y>
+constexpr CHIP_8::Handler CHIP_8::Decode(uint16_t opcode)
 {
-    ((*this).*(table8[Inst_Reg & 0x000Fu]))();
+    switch (opcode >> 12u)
+    {
+    case 0x0:
+        if ((opcode & 0xFFF0u) == 0x00C0) return &Invoke<&CHIP_8::MC_00CN>;
+        if ((opcode & 0xFFF0u) == 0x00D0) return &Invoke<&CHIP_8::MC_00DN>;
+        if (opcode == 0x00E0) return &Invoke<&CHIP_8::MC_00E0>;
+        if (opcode == 0x00EE) return &Invoke<&CHIP_8::MC_00EE>;
+        if (opcode == 0x00FB) return &Invoke<&CHIP_8::MC_00FB>;
+        if (opcode == 0x00FC) return &Invoke<&CHIP_8::MC_00FC>;
+        if (opcode == 0x00FD) return &Invoke<&CHIP_8::MC_00FD>;
+        if (opcode == 0x00FE) return &Invoke<&CHIP_8::MC_00FE>;
+        if (opcode == 0x00FF) return &Invoke<&CHIP_8::MC_00FF>;
+        break;
+    case 0x1: return &Invoke<&CHIP_8::MC_1NNN>;
+    case 0x2: return &Invoke<&CHIP_8::MC_2NNN>;
+    case 0x3: return &Invoke<&CHIP_8::MC_3XNN<X>>;
+    case 0x4: return &Invoke<&CHIP_8::MC_4XNN<X>>;
+    case 0x5: return &Invoke<&CHIP_8::MC_5XY0<X, Y>>;
+    case 0x6: return &Invoke<&CHIP_8::MC_6XNN<X>>;
+    case 0x7: return &Invoke<&CHIP_8::MC_7XNN<X>>;
+    case 0x8:
+        switch (opcode & 0x000Fu)
+        {
+        case 0x0: return &Invoke<&CHIP_8::MC_8XY0<X, Y>>;
+        case 0x1: return &Invoke<&CHIP_8::MC_8XY1<Q, X, Y>>;
+        case 0x2: return &Invoke<&CHIP_8::MC_8XY2<Q, X, Y>>;
+        case 0x3: return &Invoke<&CHIP_8::MC_8XY3<Q, X, Y>>;
+        case 0x4: return &Invoke<&CHIP_8::MC_8XY4<X, Y>>;
+        case 0x5: return &Invoke<&CHIP_8::MC_8XY5<X, Y>>;
+        case 0x6: return &Invoke<&CHIP_8::MC_8XY6<Q, X, Y>>;
+        case 0x7: return &Invoke<&CHIP_8::MC_8XY7<X, Y>>;
+        case 0xE: return &Invoke<&CHIP_8::MC_8XYE<Q, X, Y>>;
+        }
+        break;
+    case 0x9: return &Invoke<&CHIP_8::MC_9XY0<X, Y>>;
+    case 0xA: return &Invoke<&CHIP_8::MC_ANNN>;
+    case 0xB: return &Invoke<&CHIP_8::MC_BNNN<Q, X>>;
+    case 0xC: return &Invoke<&CHIP_8::MC_CXNN<X>>;
+    case 0xD: return &Invoke<&CHIP_8::MC_DXYN<Q, X, Y>>;
+    case 0xE:
+        if ((opcode & 0x00FFu) == 0x9E) return &Invoke<&CHIP_8::MC_EX9E<X>>;
+        if ((opcode & 0x00FFu) == 0xA1) return &Invoke<&CHIP_8::MC_EXA1<X>>;
+        break;
+    case 0xF:
+        switch (opcode & 0x00FFu)
+        {
+        case 0x01: return &Invoke<&CHIP_8::MC_FN01<X>>;
+        case 0x07: return &Invoke<&CHIP_8::MC_FX07<X>>;
+        case 0x0A: return &Invoke<&CHIP_8::MC_FX0A<X>>;
+        case 0x15: return &Invoke<&CHIP_8::MC_FX15<X>>;
+        case 0x18: return &Invoke<&CHIP_8::MC_FX18<X>>;
+        case 0x1E: return &Invoke<&CHIP_8::MC_FX1E<X>>;
+        case 0x29: return &Invoke<&CHIP_8::MC_FX29<X>>;
+        case 0x30: return &Invoke<&CHIP_8::MC_FX30<X>>;
+        case 0x33: return &Invoke<&CHIP_8::MC_FX33<X>>;
+        case 0x55: return &Invoke<&CHIP_8::MC_FX55<Q, X>>;
+        case 0x65: return &Invoke<&CHIP_8::MC_FX65<Q, X>>;
+        case 0x75: return &Invoke<&CHIP_8::MC_FX75<X>>;
+        case 0x85: return &Invoke<&CHIP_8::MC_FX85<X>>;
+        }
+        break;
+    }
+    return &Invoke<&CHIP_8::OP_NULL>;
 }
 
-void CHIP_8::TableE()
+// First execution of a cached address: decode it, then run it
+void CHIP_8::Miss(CHIP_8& chip8)
 {
-    ((*this).*(tableE[Inst_Reg & 0x000Fu]))();
+    uint16_t address = (chip8.PC - 2) & 0x0FFF;
+    Decoded& entry = chip8.icache[address];
+
+    entry.opcode = (chip8.Memory[address] << 8u) | chip8.Memory[(address + 1) & 0x0FFF];
+    entry.handler = chip8.dispatch[entry.opcode];
+
+    chip8.Inst_Reg = entry.opcode;
+    entry.handler(chip8);
 }
 
-void CHIP_8::TableF()
+// An instruction starting one byte before a written address overlaps it too
+void CHIP_8::InvalidateCode(uint16_t address, uint16_t length)
 {
-    ((*this).*(tableF[Inst_Reg & 0x00FFu]))();
+    for (uint32_t i = 0; i <= length; ++i)
+    {
+        icache[(address - 1 + i) & 0x0FFF].handler = &CHIP_8::Miss;
+    }
+
+    if (recompiler)
+    {
+        recompiler->Invalidate(address, length);
+    }
+}
+
+template <QuirkProfile Q, size_t... XY>
+constexpr std::array<CHIP_8::Handler (*)(uint16_t), 256> CHIP_8::DecodersXY(std::index_sequence<XY...>)
+{
+    return { { &Decode<Q, (uint8_t)(XY >> 4), (uint8_t)(XY & 0xF)>... } };
+}
+
+template <QuirkProfile Q>
+constexpr std::array<CHIP_8::Handler, 0x10000> CHIP_8::BuildDispatchTable()
+{
+    // One decoder per X/Y pair, indexed by the middle byte of the opcode
+    constexpr std::array<Handler (*)(uint16_t), 256> decoders = DecodersXY<Q>(std::make_index_sequence<256>());
+
+    std::array<Handler, 0x10000> table{};
+    for (uint32_t opcode = 0; opcode < 0x10000; ++opcode)
+    {
+        table[opcode] = decoders[(opcode >> 4) & 0xFF]((uint16_t)opcode);
+    }
+    return table;
+}
+
+// In QuirkProfile order
+constexpr std::array<std::array<CHIP_8::Handler, 0x10000>, QUIRK_PROFILES> CHIP_8::dispatchTables =
+{ {
+    CHIP_8::BuildDispatchTable<QUIRKS_VIP>(),
+    CHIP_8::BuildDispatchTable<QUIRKS_CHIP48>(),
+    CHIP_8::BuildDispatchTable<QUIRKS_SCHIP>(),
+    CHIP_8::BuildDispatchTable<QUIRKS_MODERN>(),
+    CHIP_8::BuildDispatchTable<QUIRKS_CLASSIC>(),
+} };
+
+// Cached and recompiled code was decoded for the old profile, so it all goes
+void CHIP_8::SetQuirks(QuirkProfile profile)
+{
+    if (profile >= QUIRK_PROFILES || profile == quirks)
+    {
+        return;
+    }
+    quirks = profile;
+    dispatch = dispatchTables[profile].data();
+    InvalidateCode(0, sizeof(Memory));
 }
 
 void CHIP_8::OP_NULL()
 {}
 
+// xorshift32, all of its state lives in the MachineState
+uint8_t CHIP_8::RandomByte()
+{
+    randState ^= randState << 13;
+    randState ^= randState >> 17;
+    randState ^= randState << 5;
+    return (uint8_t)randState;
+}
+
 
 ////////////////////////// CPU Cycle Function /////////////////////////////////
-void CHIP_8::Cycle()
+inline void CHIP_8::Execute()
 {
-    // Fetch
-    Inst_Reg = (Memory[PC] << 8u) | Memory[PC + 1];
+    // Fetch the pre-decoded instruction
+    const Decoded& entry = icache[PC & 0x0FFF];
+    Inst_Reg = entry.opcode;
 
     // Increment the PC before we execute anything
     PC += 2;
 
-    // Decode and Execute
-    ((*this).*(table[(Inst_Reg & 0xF000u) >> 12u]))();
+    // Execute
+    entry.handler(*this);
+}
 
+// Execute() with the instruction counted, and DXYN timed
+void CHIP_8::ExecuteProfiled()
+{
+    uint16_t pc = PC & 0x0FFF;
+    uint16_t opcode = (Memory[pc] << 8u) | Memory[(pc + 1) & 0x0FFF];
+    if (profiler->Count(pc, opcode) == Profiler::CLASS_DXYN)
+    {
+        uint64_t start = Profiler::Ticks();
+        Execute();
+        profiler->AddDrawTicks(Profiler::Ticks() - start);
+    }
+    else
+    {
+        Execute();
+    }
+}
+
+void CHIP_8::TickTimers()
+{
     // Decrement the delay timer if it's been set
     if (Delay_Timer > 0)
     {
         --Delay_Timer;
     }
 
+    // The buzzer sounds for as long as the sound timer is non-zero
+    if (audio) {
+        audio->Tick(Sound_Timer > 0);
+    }
+
     // Decrement the sound timer if it's been set
     if (Sound_Timer > 0) {
-        if (Sound_Timer == 1) {
-            SDL_QueueAudio(deviceId, wavBuffer, wavLength);
-            SDL_PauseAudioDevice(deviceId, 0);
-        }
         --Sound_Timer;
     }
-}
\ No newline at end of file
+}
+
+void CHIP_8::Cycle()
+{
+    Run(1, EXIT_BUDGET);
+}
+
+RunResult CHIP_8::Run(uint32_t budget, uint8_t stopOn)
+{
+    stopOn &= EXIT_ALL;
+    bool debug = debugger && debugger->Armed();
+    if (profiler)
+    {
+        uint64_t start = Profiler::Ticks();
+        RunResult result = debug ? RunInterpreted<true, true>(budget, stopOn | EXIT_BREAK) : RunInterpreted<true, false>(budget, stopOn);
+        profiler->AddRunTicks(Profiler::Ticks() - start);
+        return result;
+    }
+    if (debug)
+    {
+        return RunInterpreted<false, true>(budget, stopOn | EXIT_BREAK);
+    }
+    if (recompiler)
+    {
+        return RunRecompiled(budget, stopOn);
+    }
+    return RunInterpreted<false, false>(budget, stopOn);
+}
+
+// The profiled and debugged loops are separate instantiations, so the plain
+// one carries no counters or checks at all
+template <bool Profile, bool Debug>
+RunResult CHIP_8::RunInterpreted(uint32_t budget, uint8_t stopOn)
+{
+    RunResult result = { EXIT_BUDGET, 0 };
+    exitFlags = 0;
+
+    // The profiler counts every instruction, idle or not, and the debugger
+    // checks each one
+    uint8_t stopMask = stopOn | (!Profile && !Debug && idleSkip ? EXIT_IDLE : 0);
+
+    while (result.retired < budget)
+    {
+        if (Debug && debugger->BreakBefore(result.retired == 0))
+        {
+            result.reason = EXIT_BREAK;
+            break;
+        }
+
+        if (Profile)
+        {
+            ExecuteProfiled();
+        }
+        else
+        {
+            Execute();
+        }
+        ++result.retired;
+
+        // The timers run at 60 Hz, i.e. once every cyclesPerFrame instructions
+        if (--frameCountdown == 0)
+        {
+            frameCountdown = cyclesPerFrame;
+            TickTimers();
+            exitFlags |= EXIT_FRAME;
+            if (Profile)
+            {
+                profiler->EndFrame();
+            }
+        }
+
+        if (Debug && debugger->BreakAfter())
+        {
+            exitFlags |= EXIT_BREAK;
+        }
+
+        if (exitFlags & stopMask)
+        {
+            if (!(exitFlags & stopOn))
+            {
+                exitFlags &= ~EXIT_IDLE;
+                result.retired += SkipIdle(budget - result.retired, stopOn);
+                if (!(exitFlags & stopOn))
+                {
+                    continue;
+                }
+            }
+            result.reason = exitFlags & stopOn;
+            break;
+        }
+    }
+
+    return result;
+}
+
+// Same contract as Run(), but whole blocks execute natively when they fit
+// in both the remaining budget and the current frame
+RunResult CHIP_8::RunRecompiled(uint32_t budget, uint8_t stopOn)
+{
+    RunResult result = { EXIT_BUDGET, 0 };
+    exitFlags = 0;
+    uint8_t stopMask = stopOn | (idleSkip ? EXIT_IDLE : 0);
+
+    while (result.retired < budget)
+    {
+        uint32_t room = budget - result.retired;
+        if (room > frameCountdown)
+        {
+            room = frameCountdown;
+        }
+
+        RecompiledBlock* block = recompiler->Lookup(PC);
+        if (block && block->count <= room)
+        {
+            if (block->unverified)
+            {
+                VerifyBlock(block);
+            }
+            else
+            {
+                block->code(this);
+            }
+            result.retired += block->count;
+            frameCountdown -= block->count;
+        }
+        else
+        {
+            Execute();
+            ++result.retired;
+            --frameCountdown;
+        }
+
+        if (frameCountdown == 0)
+        {
+            frameCountdown = cyclesPerFrame;
+            TickTimers();
+            exitFlags |= EXIT_FRAME;
+        }
+
+        if (exitFlags & stopMask)
+        {
+            if (!(exitFlags & stopOn))
+            {
+                exitFlags &= ~EXIT_IDLE;
+                result.retired += SkipIdle(budget - result.retired, stopOn);
+                if (!(exitFlags & stopOn))
+                {
+                    continue;
+                }
+            }
+            result.reason = exitFlags & stopOn;
+            break;
+        }
+    }
+
+    return result;
+}
+
+// Instructions per iteration of the idle loop at PC, or 0 if PC is not at
+// the head of one whose next iteration would leave the machine unchanged.
+// timed is set when the next timer tick can end it.
+uint32_t CHIP_8::IdleLoopLength(bool& timed) const
+{
+    uint16_t head = PC & 0x0FFF;
+    uint16_t first = Fetch(Memory, head);
+    uint16_t jumpBack = 0x1000 | head;
+    uint8_t x = (first >> 8) & 0x0F;
+    timed = false;
+
+    // 1NNN to itself
+    if (first == jumpBack) {
+        return 1;
+    }
+    // FX0A with no key held
+    if ((first & 0xF0FF) == 0xF00A) {
+        return keypad ? 0 : 1;
+    }
+
+    // EX9E/EXA1 that does not skip, then 1NNN back to it. Keys only change between runs
+    uint16_t second = Fetch(Memory, head + 2);
+    if ((first & 0xF000) == 0xE000 && second == jumpBack) {
+        uint8_t key = V0VF_Registers[x];
+        bool held = key < 16 && ((keypad >> key) & 1);
+        if ((first & 0x00FF) == 0x9E) return held ? 0 : 2;
+        if ((first & 0x00FF) == 0xA1) return held ? 2 : 0;
+        return 0;
+    }
+
+    // FX07, then 3XNN/4XNN on the same VX that does not skip, then 1NNN back:
+    // VX already holds the delay timer, which only changes on a tick
+    uint16_t third = Fetch(Memory, head + 4);
+    bool skipEqual = (second & 0xF000) == 0x3000;
+    if ((first & 0xF0FF) == 0xF007 && (skipEqual || (second & 0xF000) == 0x4000) &&
+        ((second >> 8) & 0x0F) == x && third == jumpBack) {
+        uint8_t NN = (uint8_t)(second & 0x00FF);
+        if (V0VF_Registers[x] != Delay_Timer || (Delay_Timer == NN) == skipEqual) {
+            return 0;
+        }
+        timed = Delay_Timer != 0;
+        return 3;
+    }
+    return 0;
+}
+
+// Retires whole iterations of the idle loop at PC, at most room instructions,
+// ticking the timers after the same instructions running them would. Stops
+// at a tick that can end the loop, or at any tick when stopOn has EXIT_FRAME.
+uint32_t CHIP_8::SkipIdle(uint32_t room, uint8_t stopOn)
+{
+    bool timed;
+    uint32_t length = IdleLoopLength(timed);
+    uint32_t skipped = 0;
+    if (length == 0) {
+        return 0;
+    }
+    // Every FX0A that runs reports the wait, so one that should stop runs normally
+    if ((stopOn & EXIT_KEY_WAIT) && (Fetch(Memory, PC) & 0xF0FF) == 0xF00A) {
+        return 0;
+    }
+
+    for (;;)
+    {
+        uint32_t left = room - skipped;
+        uint32_t count = (left < frameCountdown ? left : frameCountdown) / length * length;
+        skipped += count;
+        frameCountdown -= count;
+
+        // Out of budget, or the tick falls inside an iteration, which then runs normally
+        if (frameCountdown != 0)
+        {
+            break;
+        }
+        frameCountdown = cyclesPerFrame;
+        TickTimers();
+        exitFlags |= EXIT_FRAME;
+        if (timed || (stopOn & EXIT_FRAME))
+        {
+            break;
+        }
+    }
+    return skipped;
+}
+
+// Runs a new block natively and through the interpreter from the same
+// state. The interpreter's result is kept; a block that disagrees is rejected.
+void CHIP_8::VerifyBlock(RecompiledBlock* block)
+{
+    block->unverified = false;
+    if (!verifyRecompiler)
+    {
+        block->code(this);
+        return;
+    }
+
+    uint8_t registers[16];
+    uint16_t stack[16];
+    uint16_t index = Index_REG, pc = PC;
+    uint8_t sp = SP, delay = Delay_Timer;
+    memcpy(registers, V0VF_Registers, sizeof(registers));
+    memcpy(stack, Stack, sizeof(stack));
+
+    block->code(this);
+
+    uint8_t nativeRegisters[16];
+    uint16_t nativeStack[16];
+    uint16_t nativeIndex = Index_REG, nativePC = PC;
+    uint8_t nativeSP = SP, nativeDelay = Delay_Timer;
+    memcpy(nativeRegisters, V0VF_Registers, sizeof(nativeRegisters));
+    memcpy(nativeStack, Stack, sizeof(nativeStack));
+
+    memcpy(V0VF_Registers, registers, sizeof(registers));
+    memcpy(Stack, stack, sizeof(stack));
+    Index_REG = index;
+    PC = pc;
+    SP = sp;
+    Delay_Timer = delay;
+
+    for (uint32_t i = 0; i < block->count; ++i)
+    {
+        Execute();
+    }
+
+    if (memcmp(nativeRegisters, V0VF_Registers, sizeof(nativeRegisters)) != 0 ||
+        memcmp(nativeStack, Stack, sizeof(nativeStack)) != 0 ||
+        nativeIndex != Index_REG || nativePC != PC || nativeSP != SP || nativeDelay != Delay_Timer)
+    {
+        recompiler->Reject(block);
+    }
+}
+
+bool CHIP_8::EnableRecompiler(bool enable, bool verify)
+{
+    recompiler.reset();
+    verifyRecompiler = verify;
+    if (enable)
+    {
+        recompiler.reset(new Recompiler(*this));
+        if (!recompiler->Ready())
+        {
+            recompiler.reset();
+        }
+    }
+    return recompiler != nullptr;
+}
+
+Profiler* CHIP_8::EnableProfiler(bool enable)
+{
+    profiler.reset(enable ? new Profiler() : nullptr);
+    return profiler.get();
+}
+
+Debugger* CHIP_8::EnableDebugger(bool enable)
+{
+    debugger.reset(enable ? new Debugger(*this) : nullptr);
+    return debugger.get();
+}
+
+void CHIP_8::SetCyclesPerFrame(uint32_t cycles)
+{
+    cycles = cycles ? cycles : 1;
+    if (cycles == cyclesPerFrame)
+    {
+        return;
+    }
+
+    // Keep the part of the current frame already run, at the new rate
+    uint64_t left = ((uint64_t)frameCountdown * cycles + cyclesPerFrame / 2) / cyclesPerFrame;
+    frameCountdown = left < 1 ? 1 : left > cycles ? cycles : (uint32_t)left;
+    cyclesPerFrame = cycles;
+}
@@ -1,102 +1,331 @@
 #ifndef CHIP_8_H
 #define CHIP_8_H
 
-#include <chrono>
-#include <random>
-#include <iostream>
-#include <SDL.h>
-
-typedef signed char int8_t;
-typedef unsigned char uint8_t;
-typedef signed short int16_t;
-typedef unsigned short uint16_t;
-typedef signed int int32_t;
-typedef unsigned int uint32_t;
-typedef signed long long int64_t;
-typedef unsigned long long uint64_t;
-
-class CHIP_8
+#include "Debugger.h"
+#include "Profiler.h"
+#include "Quirks.h"
+#include "Recompiler.h"
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+const unsigned int DISPLAY_HEIGHT = 32;
+const unsigned int DISPLAY_WIDTH = 64;
+const unsigned int HIRES_HEIGHT = 64;          // SUPER-CHIP high resolution, 00FF
+const unsigned int HIRES_WIDTH = 128;
+const unsigned int DISPLAY_PLANES = 2;         // XO-CHIP bitplanes, selected with FN01
+const unsigned int DISPLAY_COLUMNS = 2;        // 64-bit words per high resolution row
+
+/*
+    The Display: one bit per pixel, the MSB of a word is its leftmost pixel.
+    A plane is stored column by column (all left words, then all right
+    words), so scrolling and shifting whole rows are word operations, and a
+    64 x 32 low resolution plane is just the first DISPLAY_HEIGHT words.
+*/
+typedef uint64_t DisplayPlanes[DISPLAY_PLANES][DISPLAY_COLUMNS][HIRES_HEIGHT];
+
+/*
+    Host-side attachment points. The core itself never talks to SDL (or any
+    other host library), so it can be built and run headless. A frontend
+    implements whichever of these it needs and attaches them to a machine.
+*/
+class AudioSink
+{
+public:
+    virtual ~AudioSink() {}
+    virtual void Tick(bool soundOn) = 0;                        // every 60 Hz timer tick, whether the buzzer sounds during it
+};
+
+class VideoSink
+{
+public:
+    virtual ~VideoSink() {}
+    virtual void Update(DisplayPlanes const& planes, bool hires, unsigned int top, unsigned int bottom) = 0;   // rows [top, bottom) of the current resolution changed
+};
+
+class InputSource
+{
+public:
+    virtual ~InputSource() {}
+    virtual bool ProcessInput(uint16_t& keys) = 0;              // updates the key mask (bit k = key k), returns true on quit
+};
+
+// Reasons for Run() to return early, reported as a bit mask
+enum RunExit : uint8_t
+{
+    EXIT_BUDGET   = 0x00,    // the instruction budget was used up
+    EXIT_FRAME    = 0x01,    // a 60 Hz frame boundary was crossed and the timers ticked
+    EXIT_DRAW     = 0x02,    // 00E0, DXYN, a scroll or a resolution switch changed the Display
+    EXIT_KEY_WAIT = 0x04,    // FX0A is blocked waiting for a key
+    EXIT_SOUND    = 0x08,    // FX18 started the sound timer
+    EXIT_ALL      = 0x0F,    // every event stopOn can select
+    EXIT_BREAK    = 0x10     // the Debugger stopped, always reported while it is armed
+};
+
+struct RunResult
+{
+    uint8_t reason;          // RunExit bits that stopped the run, EXIT_BUDGET if none
+    uint32_t retired;        // instructions executed
+};
+
+const uint32_t DEFAULT_CYCLES_PER_FRAME = 10;
+
+// Where PowerOnState() puts the fonts and the ROM
+const uint16_t FONTSET_START_ADDRESS = 0x50;
+const uint16_t BIG_FONTSET_START_ADDRESS = 0xA0;
+const uint16_t START_ADDRESS = 0x200;
+
+/*
+    Everything that defines a running machine, kept in one trivially copyable
+    block so that saving or restoring it is a single memcpy. Members are
+    ordered by size so the block has no padding.
+*/
+struct MachineState
+{
+    DisplayPlanes Display;
+    uint8_t Memory[4096];
+    uint16_t Stack[16];
+    uint16_t Index_REG;
+    uint16_t PC;
+    uint32_t frameCountdown;            // instructions left until the next 60 Hz tick
+    uint32_t randState;                 // CXNN generator
+    uint16_t keypad;                    // bit k set while key k is held
+    uint8_t V0VF_Registers[16];
+    uint8_t flags[16];                  // SUPER-CHIP user flags, FX75/FX85
+    uint8_t SP;
+    uint8_t Delay_Timer;
+    uint8_t Sound_Timer;
+    uint8_t hires;                      // 128 x 64 mode, 00FF/00FE
+    uint8_t planes;                     // bitplanes DXYN, 00E0 and scrolls act on, bit p = plane p
+    uint8_t reserved[5];                // pads the block to a multiple of 8
+};
+static_assert(std::is_trivially_copyable<MachineState>::value, "MachineState must stay a plain memcpy-able block");
+
+const uint32_t SNAPSHOT_MAGIC = 0x53533843;     // "C8SS"
+const uint32_t SNAPSHOT_VERSION = 3;      // 2: keypad is a 16-bit mask, 3: SUPER-CHIP/XO-CHIP display
+
+// Versioned save state, in memory or (byte for byte) on disk
+struct Snapshot
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;                      // sizeof(MachineState) when written
+    uint32_t reserved;
+    MachineState state;
+};
+
+class CHIP_8 : private MachineState
 {
 public:
     CHIP_8();
     virtual ~CHIP_8();
 
-    void LoadROM(char const* filename);
+    bool LoadROM(char const* filename);     // false if the file could not be read or is too large
+    bool LoadROM(uint8_t const* data, size_t size);
+
+    // Fills state with a freshly powered on machine holding rom, as the
+    // constructor and LoadROM() would. False if rom does not fit.
+    static bool PowerOnState(MachineState& state, uint8_t const* rom, size_t size);
+
+    // Replaces the whole machine state with a single copy, e.g. a pristine
+    // PowerOnState() image. Host attachments and settings are kept.
+    void Reset(MachineState const& state);
+
+    // Optional host sinks, all may be left null
+    void Attach(AudioSink* audioSink, VideoSink* videoSink, InputSource* inputSource);
+    bool PollInput();
+    bool Present();                 // hands changed rows to the VideoSink, false if nothing changed
+
+    // Rows of the Display changed since the last Present(), [dirtyTop, dirtyBottom)
+    bool DisplayDirty() const { return dirtyTop < dirtyBottom; }
 
     /*The CHIP 8 ISA*/
+    /*X and Y are template parameters, so each handler is specialized for its registers*/
+    /*Q is the quirk profile, for the handlers whose behavior differs between platforms*/
+    void MC_00CN();    //SCD N        --> Scroll the Display down N rows          (SUPER-CHIP)
+    void MC_00DN();    //SCU N        --> Scroll the Display up N rows            (XO-CHIP)
     void MC_00E0();    //clear        --> Clear The Display
     void MC_00EE();    //return       --> Exit a subroutine
+    void MC_00FB();    //SCR          --> Scroll the Display right 4 pixels      (SUPER-CHIP)
+    void MC_00FC();    //SCL          --> Scroll the Display left 4 pixels       (SUPER-CHIP)
+    void MC_00FD();    //EXIT         --> Stop the interpreter                   (SUPER-CHIP)
+    void MC_00FE();    //LOW          --> 64 x 32 mode                           (SUPER-CHIP)
+    void MC_00FF();    //HIGH         --> 128 x 64 mode                          (SUPER-CHIP)
     void MC_1NNN();    //jump NNN     --> jump to this memory address
     void MC_2NNN();    //NNN          --> Call a subroutine
-    void MC_3XNN();    //SNE Vx, NN   --> if Vx != NN then
-    void MC_4XNN();    //SE Vx, NN    --> if Vx == NN then
-    void MC_5XY0();    //SNE Vx, Vy   --> if Vx != Vy then
-    void MC_6XNN();    //LD Vx, NN    --> Vx = NN
-    void MC_7XNN();    //ADD Vx, NN   --> Vx += NN
-    void MC_8XY0();    //LD Vx, Vy    --> Vx = Vy
-    void MC_8XY1();    //Bitwise OR   --> Vx |= Vy
-    void MC_8XY2();    //Bitwise AND  --> Vx &= Vy
-    void MC_8XY3();    //Bitwise XOR  --> Vx ^= Vy
-    void MC_8XY4();    //SUM Vx, Vy   --> Vx += Vy      (Vf = 1 on carry)
-    void MC_8XY5();    //SUB Vx, Vy   --> Vx -= Vy      (Vf = 0 on borrow)
-    void MC_8XY6();    //SHR Vx, 1    --> Vx = Vx >> 1. (Vf = 1 on carry)
-    void MC_8XY7();    //SUB Vy, Vx   --> Vx = Vy - Vx  (Vf = 0 on borrow)
-    void MC_8XYE();    //SHL Vx, 1    --> VX = VX << 1  (VF = 1 on carry)
-    void MC_9XY0();    //SNE Vx, Vy   --> if Vx != Vy then
+    template <uint8_t X> void MC_3XNN();                //SNE Vx, NN   --> if Vx != NN then
+    template <uint8_t X> void MC_4XNN();                //SE Vx, NN    --> if Vx == NN then
+    template <uint8_t X, uint8_t Y> void MC_5XY0();     //SNE Vx, Vy   --> if Vx != Vy then
+    template <uint8_t X> void MC_6XNN();                //LD Vx, NN    --> Vx = NN
+    template <uint8_t X> void MC_7XNN();                //ADD Vx, NN   --> Vx += NN
+    template <uint8_t X, uint8_t Y> void MC_8XY0();     //LD Vx, Vy    --> Vx = Vy
+    template <QuirkProfile Q, uint8_t X, uint8_t Y> void MC_8XY1();     //Bitwise OR   --> Vx |= Vy
+    template <QuirkProfile Q, uint8_t X, uint8_t Y> void MC_8XY2();     //Bitwise AND  --> Vx &= Vy
+    template <QuirkProfile Q, uint8_t X, uint8_t Y> void MC_8XY3();     //Bitwise XOR  --> Vx ^= Vy
+    template <uint8_t X, uint8_t Y> void MC_8XY4();     //SUM Vx, Vy   --> Vx += Vy      (Vf = 1 on carry)
+    template <uint8_t X, uint8_t Y> void MC_8XY5();     //SUB Vx, Vy   --> Vx -= Vy      (Vf = 0 on borrow)
+    template <QuirkProfile Q, uint8_t X, uint8_t Y> void MC_8XY6();     //SHR Vx, 1    --> Vx = Vx >> 1. (Vf = 1 on carry)
+    template <uint8_t X, uint8_t Y> void MC_8XY7();     //SUB Vy, Vx   --> Vx = Vy - Vx  (Vf = 0 on borrow)
+    template <QuirkProfile Q, uint8_t X, uint8_t Y> void MC_8XYE();     //SHL Vx, 1    --> VX = VX << 1  (VF = 1 on carry)
+    template <uint8_t X, uint8_t Y> void MC_9XY0();     //SNE Vx, Vy   --> if Vx != Vy then
     void MC_ANNN();    //LD IR, NNN   --> IR = NNN
-    void MC_BNNN();    //BNNN	      --> Jump to NNN + V0
-    void MC_CXNN();    //CXNN         --> Vx = Random number & NN
-    void MC_DXYN();    //DRW Vx,Vy, N --> sprite Vx Vy N  (VF = 1 on collision)
-    void MC_EX9E();	   //SKP Vx       --> Skip next instruction if key VX pressed
-    void MC_EXA1();	   //SKNP Vx	  --> Skip next instruction if key VX not pressed
-    void MC_FX07();	   //LD Vx, DT	  --> VX = Delay timer
-    void MC_FX0A();	   //LD Vx, K     --> Waits a keypress and stores it in VX
-    void MC_FX15();    //LD DT, Vx    --> Delay timer = VX
-    void MC_FX18();    //LD ST, Vx    --> Sound timer = VX
-    void MC_FX1E();    //ADD I, Vx    --> I = I + VX
-    void MC_FX29();    //LD F, Vx     --> I points to the 4 x 5 font sprite of hex char in VX
-    void MC_FX33();    //LD B, Vx     --> Store BCD representation of VX in M(I)...M(I+2)
-    void MC_FX55();    //LD [I], Vx   --> Save V0...VX in memory starting at M(I)
-    void MC_FX65();    //LD Vx, [I]   --> Load V0...VX from memory starting at M(I)
-
-    // Decode Tables
-    void Table0();
-    void Table8();
-    void TableE();
-    void TableF();
+    template <QuirkProfile Q, uint8_t X> void MC_BNNN();    //BNNN  --> Jump to NNN + V0      (BXNN: XNN + VX)
+    template <uint8_t X> void MC_CXNN();                //CXNN         --> Vx = Random number & NN
+    template <QuirkProfile Q, uint8_t X, uint8_t Y> void MC_DXYN();     //DRW Vx,Vy, N --> sprite Vx Vy N  (VF = 1 on collision, N = 0 draws 16 x 16)
+    template <uint8_t X> void MC_EX9E();                //SKP Vx       --> Skip next instruction if key VX pressed
+    template <uint8_t X> void MC_EXA1();                //SKNP Vx	  --> Skip next instruction if key VX not pressed
+    template <uint8_t X> void MC_FN01();                //PLANE N      --> Select the bitplanes to draw on      (XO-CHIP)
+    template <uint8_t X> void MC_FX07();                //LD Vx, DT	  --> VX = Delay timer
+    template <uint8_t X> void MC_FX0A();                //LD Vx, K     --> Waits a keypress and stores it in VX
+    template <uint8_t X> void MC_FX15();                //LD DT, Vx    --> Delay timer = VX
+    template <uint8_t X> void MC_FX18();                //LD ST, Vx    --> Sound timer = VX
+    template <uint8_t X> void MC_FX1E();                //ADD I, Vx    --> I = I + VX
+    template <uint8_t X> void MC_FX29();                //LD F, Vx     --> I points to the 4 x 5 font sprite of hex char in VX
+    template <uint8_t X> void MC_FX30();                //LD HF, Vx    --> I points to the 8 x 10 font sprite of hex char in VX (SUPER-CHIP)
+    template <uint8_t X> void MC_FX33();                //LD B, Vx     --> Store BCD representation of VX in M(I)...M(I+2)
+    template <QuirkProfile Q, uint8_t X> void MC_FX55();                //LD [I], Vx   --> Save V0...VX in memory starting at M(I)
+    template <QuirkProfile Q, uint8_t X> void MC_FX65();                //LD Vx, [I]   --> Load V0...VX from memory starting at M(I)
+    template <uint8_t X> void MC_FX75();                //LD R, Vx     --> Save V0...VX in the user flags         (SUPER-CHIP)
+    template <uint8_t X> void MC_FX85();                //LD Vx, R     --> Load V0...VX from the user flags       (SUPER-CHIP)
     void OP_NULL();
 
     // Emulation Cycle
     void Cycle();
 
-   
-    uint32_t Display[32][64];
-    uint8_t keypad[16]{};
-    uint8_t Sound_Timer;
+    // Batched execution: runs up to budget instructions, stopping after the
+    // first instruction that raises one of the events in stopOn
+    RunResult Run(uint32_t budget, uint8_t stopOn = EXIT_ALL);
+
+    // Idle loops (a jump to itself, FX0A with no key held, a key poll, or a
+    // delay timer poll) are retired without running them, up to the next
+    // timer tick that can change their outcome. The machine state, the
+    // instruction count and every RunResult are the same as without it.
+    // On by default; the profiler always runs every instruction.
+    void EnableIdleSkip(bool enable) { idleSkip = enable; }
+
+    // Instructions executed per 60 Hz timer tick. The rest of the current
+    // frame is rescaled to the new rate
+    void SetCyclesPerFrame(uint32_t cycles);
+    uint32_t GetCyclesPerFrame() const { return cyclesPerFrame; }
+
+    // Translate hot blocks to native code (x86-64 only). With verify set,
+    // every new block is run against the interpreter once and dropped if the
+    // results differ. Returns whether the recompiler is active.
+    bool EnableRecompiler(bool enable, bool verify = false);
+    Recompiler* GetRecompiler() { return recompiler.get(); }
+
+    // Count instructions per class and per address, draws per frame and
+    // time spent in DXYN. While enabled Run() always interprets; while
+    // disabled the counters cost nothing. Returns the (reset) profiler.
+    Profiler* EnableProfiler(bool enable);
+    Profiler* GetProfiler() { return profiler.get(); }
+
+    // Breakpoints, watchpoints and stepping. While none is armed Run() is
+    // unchanged; while any is, it interprets every instruction under the
+    // Debugger (and the profiler, if enabled). Returns the (cleared) debugger.
+    Debugger* EnableDebugger(bool enable);
+    Debugger* GetDebugger() { return debugger.get(); }
+
+    // Save states. LoadState() rejects snapshots of another version or size
+    void SaveState(Snapshot& snapshot) const;
+    bool LoadState(Snapshot const& snapshot);
+    bool SaveState(char const* filename) const;
+    bool LoadState(char const* filename);
+
+    // Platform behavior, DEFAULT_QUIRKS until set. Kept across Reset() and
+    // LoadState(); changing it drops every decoded instruction and block
+    void SetQuirks(QuirkProfile profile);
+    QuirkProfile GetQuirks() const { return quirks; }
+
+    // Seeds the CXNN generator, identical seeds give identical runs
+    void SetSeed(uint32_t seed);
+
+    // Keypad as a mask, bit k set while key k is held
+    uint16_t GetKeys() const { return keypad; }
+    void SetKeys(uint16_t keys) { keypad = keys; }
+
+    // Read-only view of the CPU, for headless runners and tools
+    uint16_t GetPC() const { return PC; }
+    uint16_t GetIndex() const { return Index_REG; }
+    uint8_t GetRegister(unsigned int x) const { return V0VF_Registers[x & 0x0F]; }
+    uint8_t GetSP() const { return SP; }
+    uint8_t GetDelayTimer() const { return Delay_Timer; }
+    uint8_t GetMemory(uint16_t address) const { return Memory[address & 0x0FFF]; }
+    bool HighResolution() const { return hires != 0; }
+
+    using MachineState::Display;
+    using MachineState::Sound_Timer;
+    uint8_t dirtyTop;
+    uint8_t dirtyBottom;
 
 protected:
 
 private:
-    uint8_t V0VF_Registers[16];
-    uint8_t Memory[4096];
-    uint8_t SP;
-    uint8_t Delay_Timer;
-    
-    uint16_t Index_REG;
-    uint16_t PC;
-    uint16_t Stack[16];
+    friend class Debugger;
+    friend class Recompiler;
 
-    SDL_AudioDeviceID deviceId; 
-    Uint8* wavBuffer;           
-    Uint32 wavLength;
+    AudioSink* audio;
+    VideoSink* video;
+    InputSource* input;
     
     uint16_t Inst_Reg;
-    typedef void (CHIP_8::* Chip8Func)();
-    Chip8Func table[0xF + 1];
-    Chip8Func table0[0xE + 1];
-    Chip8Func table8[0xE + 1];
-    Chip8Func tableE[0xE + 1];
-    Chip8Func tableF[0x65 + 1];
+    uint8_t exitFlags;
+    uint32_t cyclesPerFrame;
+
+    // exitFlags bit, never reported: PC is back at the head of a loop that
+    // may be idle. Raised by FX0A and by jumps back at most MAX_IDLE_LOOP
+    // instructions, which the recompiler leaves to the interpreter.
+    static const uint8_t EXIT_IDLE = 0x80;
+    static const unsigned int MAX_IDLE_LOOP = 3;
+    static bool ClosesLoop(uint16_t jump, uint16_t target) { return (uint16_t)(jump - target) < 2 * MAX_IDLE_LOOP; }
+
+    bool idleSkip;
+    uint32_t IdleLoopLength(bool& timed) const;
+    uint32_t SkipIdle(uint32_t room, uint8_t stopOn);
+
+    void Execute();
+    void ExecuteProfiled();
+    void TickTimers();
+    void DisplayChanged(unsigned int top, unsigned int bottom);
+    template <bool Wrap> void DrawSprite(uint8_t x, uint8_t y, uint8_t height);
+
+    template <bool Profile, bool Debug> RunResult RunInterpreted(uint32_t budget, uint8_t stopOn);
+    std::unique_ptr<Profiler> profiler;
+    std::unique_ptr<Debugger> debugger;
+
+    std::unique_ptr<Recompiler> recompiler;
+    bool verifyRecompiler;
+
+    RunResult RunRecompiled(uint32_t budget, uint8_t stopOn);
+    void VerifyBlock(RecompiledBlock* block);
+
+    // Decode Tables: one entry per 16-bit opcode, one table per quirk
+    // profile, built at compile time and shared by every machine, so dispatch
+    // is a single indirect call
+    typedef void (*Handler)(CHIP_8&);
+    static const std::array<std::array<Handler, 0x10000>, QUIRK_PROFILES> dispatchTables;
+
+    QuirkProfile quirks;
+    Handler const* dispatch;        // dispatchTables[quirks]
+
+    template <void (CHIP_8::* F)()> static void Invoke(CHIP_8& chip8);
+    static void Miss(CHIP_8& chip8);
+    template <QuirkProfile Q, uint8_t X, uint8_t Y> static constexpr Handler Decode(uint16_t opcode);
+    template <QuirkProfile Q, size_t... XY> static constexpr std::array<Handler (*)(uint16_t), 256> DecodersXY(std::index_sequence<XY...>);
+    template <QuirkProfile Q> static constexpr std::array<Handler, 0x10000> BuildDispatchTable();
+
+    // Pre-decoded instruction cache, one entry per Memory address. Entries
+    // start out (and are reset to) Miss, which decodes on first execution.
+    struct Decoded
+    {
+        Handler handler;
+        uint16_t opcode;
+    };
+    Decoded icache[4096];
+
+    void InvalidateCode(uint16_t address, uint16_t length);
 
     //pointer to void function
     //void (* func_x_ptr)(void); ------>  void func_x(void);
@@ -105,9 +334,7 @@ private:
     //opcode_MC_FX1E = &MC_FX0A;
     void (CHIP_8::* opcode_MC_FX1E)(void);
 
-
-    std::default_random_engine randGen;
-    std::uniform_int_distribution<short> randByte;
+    uint8_t RandomByte();
 };
 
 #endif // CHIP_8_H
@@ -0,0 +1,325 @@
+#include "Debugger.h"
+#include "CHIP_8.h"
+#include <cstdio>
+
+namespace
+{
+    const uint16_t NO_ADDRESS = 0xFFFF;
+
+    inline uint16_t Fetch(uint8_t const* memory, unsigned int address)
+    {
+        return (uint16_t)((memory[address & 0x0FFF] << 8u) | memory[(address + 1) & 0x0FFF]);
+    }
+
+    unsigned int PlaneCount(uint8_t planes)
+    {
+        return (planes & 1) + ((planes >> 1) & 1);
+    }
+}
+
+Debugger::Debugger(CHIP_8& chip8)
+    : chip8(chip8)
+{
+    ClearAll();
+}
+
+void Debugger::SetBreakpoint(uint16_t address, Condition condition)
+{
+    breakpoints[address & 0x0FFF] = true;
+    breakConditions[address & 0x0FFF] = condition;
+    UpdateArmed();
+}
+
+void Debugger::ClearBreakpoint(uint16_t address)
+{
+    breakpoints[address & 0x0FFF] = false;
+    UpdateArmed();
+}
+
+void Debugger::SetWatchpoint(uint16_t address, uint16_t length, WatchKind kind)
+{
+    for (uint32_t i = 0; i < length && i < 4096; ++i)
+    {
+        readWatch[(address + i) & 0x0FFF] = readWatch[(address + i) & 0x0FFF] || (kind & WATCH_READ);
+        writeWatch[(address + i) & 0x0FFF] = writeWatch[(address + i) & 0x0FFF] || (kind & WATCH_WRITE);
+    }
+    UpdateArmed();
+}
+
+void Debugger::ClearWatchpoint(uint16_t address, uint16_t length)
+{
+    for (uint32_t i = 0; i < length && i < 4096; ++i)
+    {
+        readWatch[(address + i) & 0x0FFF] = false;
+        writeWatch[(address + i) & 0x0FFF] = false;
+    }
+    UpdateArmed();
+}
+
+unsigned int Debugger::AddCondition(Condition condition)
+{
+    // Only a change to true stops, so one that already holds waits for the next
+    conditions.push_back(condition);
+    conditionHeld.push_back(Holds(condition, chip8.V0VF_Registers));
+    UpdateArmed();
+    return (unsigned int)(conditions.size() - 1);
+}
+
+void Debugger::ClearAll()
+{
+    breakpoints.reset();
+    readWatch.reset();
+    writeWatch.reset();
+    conditions.clear();
+    conditionHeld.clear();
+    runningTo = false;
+    runToAddress = NO_ADDRESS;
+    lastStop = Stop{ STOP_NONE, 0, 0, WATCH_READ, 0 };
+    pending = lastStop;
+    resumeAddress = NO_ADDRESS;
+    UpdateArmed();
+}
+
+void Debugger::UpdateArmed()
+{
+    armed = runningTo || breakpoints.any() || readWatch.any() || writeWatch.any() || !conditions.empty();
+}
+
+void Debugger::Report(Stop const& stop)
+{
+    lastStop = stop;
+}
+
+////////////////////////////////// Running //////////////////////////////////////
+
+RunResult Debugger::Step(uint32_t count)
+{
+    return chip8.Run(count, EXIT_BUDGET);
+}
+
+RunResult Debugger::RunTo(uint16_t address, uint32_t budget)
+{
+    // Already there: run to the next time PC gets back
+    if ((chip8.PC & 0x0FFF) == (address & 0x0FFF))
+    {
+        resumeAddress = address & 0x0FFF;
+    }
+    runningTo = true;
+    runToAddress = address & 0x0FFF;
+    UpdateArmed();
+    RunResult result = chip8.Run(budget, EXIT_BUDGET);
+    runningTo = false;
+    UpdateArmed();
+    return result;
+}
+
+bool Debugger::Holds(Condition const& condition, uint8_t const* registers)
+{
+    uint8_t value = registers[condition.x & 0x0F];
+    switch (condition.compare)
+    {
+    case EQUAL: return value == condition.value;
+    case NOT_EQUAL: return value != condition.value;
+    case LESS: return value < condition.value;
+    case LESS_EQUAL: return value <= condition.value;
+    case GREATER: return value > condition.value;
+    case GREATER_EQUAL: return value >= condition.value;
+    default: return true;
+    }
+}
+
+// Breakpoints stop here, before the instruction; a watched access is only
+// noted, and reported by BreakAfter() once the instruction has run
+bool Debugger::BreakBefore(bool resuming)
+{
+    uint16_t pc = chip8.PC & 0x0FFF;
+    bool resumed = resuming && pc == resumeAddress;
+    resumeAddress = NO_ADDRESS;
+    pending.reason = STOP_NONE;
+
+    if (!resumed)
+    {
+        if (runningTo && pc == runToAddress)
+        {
+            resumeAddress = pc;
+            Report(Stop{ STOP_RUN_TO, pc, 0, WATCH_READ, 0 });
+            return true;
+        }
+        if (breakpoints[pc] && Holds(breakConditions[pc], chip8.V0VF_Registers))
+        {
+            resumeAddress = pc;
+            Report(Stop{ STOP_BREAKPOINT, pc, 0, WATCH_READ, 0 });
+            return true;
+        }
+    }
+
+    // The only instructions that touch Memory through I
+    uint16_t opcode = Fetch(chip8.Memory, pc);
+    uint8_t x = (opcode >> 8) & 0x0F;
+    unsigned int length = 0;
+    WatchKind access = WATCH_READ;
+    switch (Profiler::Classify(opcode))
+    {
+    case Profiler::CLASS_FX33: length = 3; access = WATCH_WRITE; break;
+    case Profiler::CLASS_FX55: length = x + 1u; access = WATCH_WRITE; break;
+    case Profiler::CLASS_FX65: length = x + 1u; break;
+    case Profiler::CLASS_DXYN: length = ((opcode & 0x0F) ? (opcode & 0x0F) : 32) * PlaneCount(chip8.planes); break;
+    default: return false;
+    }
+    std::bitset<4096> const& watched = access == WATCH_WRITE ? writeWatch : readWatch;
+    for (unsigned int i = 0; i < length; ++i)
+    {
+        uint16_t address = (chip8.Index_REG + i) & 0x0FFF;
+        if (watched[address])
+        {
+            pending = Stop{ STOP_WATCHPOINT, pc, address, access, 0 };
+            break;
+        }
+    }
+    return false;
+}
+
+bool Debugger::BreakAfter()
+{
+    bool stop = false;
+    if (pending.reason != STOP_NONE)
+    {
+        Report(pending);
+        pending.reason = STOP_NONE;
+        stop = true;
+    }
+    for (size_t c = 0; c < conditions.size(); ++c)
+    {
+        bool held = Holds(conditions[c], chip8.V0VF_Registers);
+        if (held && !conditionHeld[c] && !stop)
+        {
+            Report(Stop{ STOP_CONDITION, (uint16_t)((chip8.PC - 2) & 0x0FFF), 0, WATCH_READ, (unsigned int)c });
+            stop = true;
+        }
+        conditionHeld[c] = held;
+    }
+    return stop;
+}
+
+////////////////////////////////// Editing //////////////////////////////////////
+
+void Debugger::SetPC(uint16_t pc)
+{
+    chip8.PC = pc & 0x0FFF;
+}
+
+void Debugger::SetIndex(uint16_t index)
+{
+    chip8.Index_REG = index;
+}
+
+void Debugger::SetRegister(unsigned int x, uint8_t value)
+{
+    chip8.V0VF_Registers[x & 0x0F] = value;
+}
+
+void Debugger::SetDelayTimer(uint8_t value)
+{
+    chip8.Delay_Timer = value;
+}
+
+void Debugger::SetSoundTimer(uint8_t value)
+{
+    chip8.Sound_Timer = value;
+}
+
+void Debugger::SetMemory(uint16_t address, uint8_t value)
+{
+    chip8.Memory[address & 0x0FFF] = value;
+    chip8.InvalidateCode(address & 0x0FFF, 1);
+}
+
+uint16_t Debugger::GetStack(unsigned int level) const
+{
+    return chip8.Stack[level & 0x0F];
+}
+
+uint8_t Debugger::GetSoundTimer() const
+{
+    return chip8.Sound_Timer;
+}
+
+//////////////////////////////// Disassembly ////////////////////////////////////
+
+std::string Debugger::Disassemble(uint16_t opcode, QuirkProfile quirks)
+{
+    QuirkSet const& quirkSet = QUIRK_SETS[quirks < QUIRK_PROFILES ? quirks : DEFAULT_QUIRKS];
+    unsigned int x = (opcode >> 8) & 0x0F;
+    unsigned int y = (opcode >> 4) & 0x0F;
+    unsigned int n = opcode & 0x0F;
+    unsigned int nn = opcode & 0xFF;
+    unsigned int nnn = opcode & 0x0FFF;
+    char text[32];
+    switch (Profiler::Classify(opcode))
+    {
+    case Profiler::CLASS_00E0: return "CLS";
+    case Profiler::CLASS_00EE: return "RET";
+    case Profiler::CLASS_00FB: return "SCR";
+    case Profiler::CLASS_00FC: return "SCL";
+    case Profiler::CLASS_00FD: return "EXIT";
+    case Profiler::CLASS_00FE: return "LOW";
+    case Profiler::CLASS_00FF: return "HIGH";
+    case Profiler::CLASS_00CN: snprintf(text, sizeof(text), "SCD %u", n); break;
+    case Profiler::CLASS_00DN: snprintf(text, sizeof(text), "SCU %u", n); break;
+    case Profiler::CLASS_1NNN: snprintf(text, sizeof(text), "JP 0x%03X", nnn); break;
+    case Profiler::CLASS_2NNN: snprintf(text, sizeof(text), "CALL 0x%03X", nnn); break;
+    case Profiler::CLASS_3XNN: snprintf(text, sizeof(text), "SE V%X, 0x%02X", x, nn); break;
+    case Profiler::CLASS_4XNN: snprintf(text, sizeof(text), "SNE V%X, 0x%02X", x, nn); break;
+    case Profiler::CLASS_5XY0: snprintf(text, sizeof(text), "SE V%X, V%X", x, y); break;
+    case Profiler::CLASS_6XNN: snprintf(text, sizeof(text), "LD V%X, 0x%02X", x, nn); break;
+    case Profiler::CLASS_7XNN: snprintf(text, sizeof(text), "ADD V%X, 0x%02X", x, nn); break;
+    case Profiler::CLASS_8XY0: snprintf(text, sizeof(text), "LD V%X, V%X", x, y); break;
+    case Profiler::CLASS_8XY1: snprintf(text, sizeof(text), "OR V%X, V%X", x, y); break;
+    case Profiler::CLASS_8XY2: snprintf(text, sizeof(text), "AND V%X, V%X", x, y); break;
+    case Profiler::CLASS_8XY3: snprintf(text, sizeof(text), "XOR V%X, V%X", x, y); break;
+    case Profiler::CLASS_8XY4: snprintf(text, sizeof(text), "ADD V%X, V%X", x, y); break;
+    case Profiler::CLASS_8XY5: snprintf(text, sizeof(text), "SUB V%X, V%X", x, y); break;
+    case Profiler::CLASS_8XY6:
+        if (quirkSet.shiftReadsVy) snprintf(text, sizeof(text), "SHR V%X, V%X", x, y);
+        else snprintf(text, sizeof(text), "SHR V%X", x);
+        break;
+    case Profiler::CLASS_8XY7: snprintf(text, sizeof(text), "SUBN V%X, V%X", x, y); break;
+    case Profiler::CLASS_8XYE:
+        if (quirkSet.shiftReadsVy) snprintf(text, sizeof(text), "SHL V%X, V%X", x, y);
+        else snprintf(text, sizeof(text), "SHL V%X", x);
+        break;
+    case Profiler::CLASS_9XY0: snprintf(text, sizeof(text), "SNE V%X, V%X", x, y); break;
+    case Profiler::CLASS_ANNN: snprintf(text, sizeof(text), "LD I, 0x%03X", nnn); break;
+    case Profiler::CLASS_BNNN:
+        if (quirkSet.jumpUsesVx) snprintf(text, sizeof(text), "JP V%X, 0x%03X", x, nnn);
+        else snprintf(text, sizeof(text), "JP V0, 0x%03X", nnn);
+        break;
+    case Profiler::CLASS_CXNN: snprintf(text, sizeof(text), "RND V%X, 0x%02X", x, nn); break;
+    case Profiler::CLASS_DXYN: snprintf(text, sizeof(text), "DRW V%X, V%X, %u", x, y, n); break;
+    case Profiler::CLASS_EX9E: snprintf(text, sizeof(text), "SKP V%X", x); break;
+    case Profiler::CLASS_EXA1: snprintf(text, sizeof(text), "SKNP V%X", x); break;
+    case Profiler::CLASS_FN01: snprintf(text, sizeof(text), "PLANE %u", x); break;
+    case Profiler::CLASS_FX07: snprintf(text, sizeof(text), "LD V%X, DT", x); break;
+    case Profiler::CLASS_FX0A: snprintf(text, sizeof(text), "LD V%X, K", x); break;
+    case Profiler::CLASS_FX15: snprintf(text, sizeof(text), "LD DT, V%X", x); break;
+    case Profiler::CLASS_FX18: snprintf(text, sizeof(text), "LD ST, V%X", x); break;
+    case Profiler::CLASS_FX1E: snprintf(text, sizeof(text), "ADD I, V%X", x); break;
+    case Profiler::CLASS_FX29: snprintf(text, sizeof(text), "LD F, V%X", x); break;
+    case Profiler::CLASS_FX30: snprintf(text, sizeof(text), "LD HF, V%X", x); break;
+    case Profiler::CLASS_FX33: snprintf(text, sizeof(text), "LD B, V%X", x); break;
+    case Profiler::CLASS_FX55: snprintf(text, sizeof(text), "LD [I], V%X", x); break;
+    case Profiler::CLASS_FX65: snprintf(text, sizeof(text), "LD V%X, [I]", x); break;
+    case Profiler::CLASS_FX75: snprintf(text, sizeof(text), "LD R, V%X", x); break;
+    case Profiler::CLASS_FX85: snprintf(text, sizeof(text), "LD V%X, R", x); break;
+    default: snprintf(text, sizeof(text), "DW 0x%04X", opcode); break;
+    }
+    return text;
+}
+
+std::string Debugger::DisassembleAt(uint16_t address) const
+{
+    uint16_t opcode = Fetch(chip8.Memory, address);
+    char prefix[16];
+    snprintf(prefix, sizeof(prefix), "0x%03X  %04X  ", address & 0x0FFF, opcode);
+    return prefix + Disassemble(opcode, chip8.GetQuirks());
+}
@@ -0,0 +1,147 @@
+#ifndef DEBUGGER_H
+#define DEBUGGER_H
+
+#include "Quirks.h"
+#include <bitset>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class CHIP_8;
+struct RunResult;
+
+/*
+    Breakpoints, memory watchpoints and register conditions for one machine,
+    plus stepping, state editing and a disassembler.
+
+    While nothing is armed Run() takes its normal paths (recompiler, idle
+    skipping and all) and the debugger costs nothing. Once a breakpoint,
+    watchpoint or condition is set, Run() interprets through a separate
+    instrumented loop that checks them around every instruction and returns
+    EXIT_BREAK, whatever stopOn asked for, when one hits.
+
+    Breakpoints stop before the instruction at their address runs; resuming
+    from one runs that instruction. Watchpoints and conditions stop after the
+    instruction that triggered them.
+*/
+class Debugger
+{
+public:
+    Debugger(CHIP_8& chip8);
+
+    enum Compare : uint8_t
+    {
+        ALWAYS,
+        EQUAL,
+        NOT_EQUAL,
+        LESS,
+        LESS_EQUAL,
+        GREATER,
+        GREATER_EQUAL
+    };
+
+    // VX compared against value; ALWAYS holds for any register
+    struct Condition
+    {
+        uint8_t x;
+        Compare compare;
+        uint8_t value;
+    };
+
+    enum WatchKind : uint8_t
+    {
+        WATCH_READ   = 0x1,     // FX65 and DXYN
+        WATCH_WRITE  = 0x2,     // FX33 and FX55
+        WATCH_ACCESS = 0x3
+    };
+
+    enum StopReason : uint8_t
+    {
+        STOP_NONE,
+        STOP_BREAKPOINT,
+        STOP_WATCHPOINT,
+        STOP_CONDITION,
+        STOP_RUN_TO
+    };
+
+    // Why the last EXIT_BREAK happened
+    struct Stop
+    {
+        StopReason reason;
+        uint16_t pc;            // of the instruction that stopped (or will run next, for breakpoints)
+        uint16_t address;       // watchpoint: first watched byte accessed
+        WatchKind access;       // watchpoint: how it was accessed
+        unsigned int condition; // condition: its index
+    };
+
+    // A breakpoint only stops while its condition holds
+    void SetBreakpoint(uint16_t address, Condition condition = Condition{ 0, ALWAYS, 0 });
+    void ClearBreakpoint(uint16_t address);
+    bool HasBreakpoint(uint16_t address) const { return breakpoints[address & 0x0FFF]; }
+
+    // Memory in [address, address + length), wrapping at 0xFFF
+    void SetWatchpoint(uint16_t address, uint16_t length, WatchKind kind);
+    void ClearWatchpoint(uint16_t address, uint16_t length);
+
+    // Stops when the condition turns from false to true. Returns its index
+    unsigned int AddCondition(Condition condition);
+    std::vector<Condition> const& Conditions() const { return conditions; }
+
+    void ClearAll();
+    bool Armed() const { return armed; }
+    Stop const& LastStop() const { return lastStop; }
+
+    // Runs count instructions, stopping early at anything armed
+    RunResult Step(uint32_t count = 1);
+
+    // Runs until PC reaches address (or anything armed hits) within budget
+    // instructions
+    RunResult RunTo(uint16_t address, uint32_t budget);
+
+    // Editing, for what the CHIP_8 getters can read. Memory writes drop
+    // any decoded or translated code they overwrite
+    void SetPC(uint16_t pc);
+    void SetIndex(uint16_t index);
+    void SetRegister(unsigned int x, uint8_t value);
+    void SetDelayTimer(uint8_t value);
+    void SetSoundTimer(uint8_t value);
+    void SetMemory(uint16_t address, uint8_t value);
+    uint16_t GetStack(unsigned int level) const;
+    uint8_t GetSoundTimer() const;
+
+    // "LD V3, 0x12" style mnemonics, as in the CHIP_8 handler comments.
+    // BNNN and the shifts are written the way quirks runs them
+    static std::string Disassemble(uint16_t opcode, QuirkProfile quirks = DEFAULT_QUIRKS);
+
+    // "0x200  6312  LD V3, 0x12" for the instruction at address, under the
+    // machine's quirk profile
+    std::string DisassembleAt(uint16_t address) const;
+
+    static bool Holds(Condition const& condition, uint8_t const* registers);
+
+    // Called by the instrumented loop in CHIP_8::Run(); true to stop
+    bool BreakBefore(bool resuming);
+    bool BreakAfter();
+
+private:
+    CHIP_8& chip8;
+
+    std::bitset<4096> breakpoints;
+    Condition breakConditions[4096];
+    std::bitset<4096> readWatch;
+    std::bitset<4096> writeWatch;
+    std::vector<Condition> conditions;
+    std::vector<bool> conditionHeld;
+
+    bool armed;
+    bool runningTo;
+    uint16_t runToAddress;
+    Stop lastStop;
+    Stop pending;               // watchpoint seen before the instruction, reported after it
+    uint16_t resumeAddress;     // breakpoint the machine is stopped at, 0xFFFF if none
+
+    void UpdateArmed();
+    void Report(Stop const& stop);
+};
+
+#endif // DEBUGGER_H
@@ -0,0 +1,824 @@
+#include "Lockstep.h"
+#include "CHIP_8.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define LOCKSTEP_SSE2 1
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace
+{
+    /*
+        One vector of lanes, one byte per lane. Masks are 0xFF for lanes that
+        take part and 0x00 for the rest. Without SSE2 a "vector" is one lane.
+    */
+#if defined(__AVX2__)
+    typedef __m256i Vec;
+    const unsigned int VEC = 32;
+
+    inline Vec Load(const uint8_t* p) { return _mm256_loadu_si256((const __m256i*)p); }
+    inline void Store(uint8_t* p, Vec v) { _mm256_storeu_si256((__m256i*)p, v); }
+    inline Vec Set1(uint8_t b) { return _mm256_set1_epi8((char)b); }
+    inline Vec And(Vec a, Vec b) { return _mm256_and_si256(a, b); }
+    inline Vec AndNot(Vec a, Vec b) { return _mm256_andnot_si256(a, b); }   // ~a & b
+    inline Vec Or(Vec a, Vec b) { return _mm256_or_si256(a, b); }
+    inline Vec Xor(Vec a, Vec b) { return _mm256_xor_si256(a, b); }
+    inline Vec Add(Vec a, Vec b) { return _mm256_add_epi8(a, b); }
+    inline Vec Sub(Vec a, Vec b) { return _mm256_sub_epi8(a, b); }
+    inline Vec AddSat(Vec a, Vec b) { return _mm256_adds_epu8(a, b); }
+    inline Vec SubSat(Vec a, Vec b) { return _mm256_subs_epu8(a, b); }
+    inline Vec Eq(Vec a, Vec b) { return _mm256_cmpeq_epi8(a, b); }
+    inline Vec Shr(Vec a, int n) { return _mm256_and_si256(_mm256_srli_epi16(a, n), Set1((uint8_t)(0xFF >> n))); }
+    inline Vec Blend(Vec a, Vec b, Vec m) { return _mm256_blendv_epi8(a, b, m); }         // m ? b : a
+    inline uint32_t Bits(Vec m) { return (uint32_t)_mm256_movemask_epi8(m); }
+#elif defined(LOCKSTEP_SSE2)
+    typedef __m128i Vec;
+    const unsigned int VEC = 16;
+
+    inline Vec Load(const uint8_t* p) { return _mm_loadu_si128((const __m128i*)p); }
+    inline void Store(uint8_t* p, Vec v) { _mm_storeu_si128((__m128i*)p, v); }
+    inline Vec Set1(uint8_t b) { return _mm_set1_epi8((char)b); }
+    inline Vec And(Vec a, Vec b) { return _mm_and_si128(a, b); }
+    inline Vec AndNot(Vec a, Vec b) { return _mm_andnot_si128(a, b); }
+    inline Vec Or(Vec a, Vec b) { return _mm_or_si128(a, b); }
+    inline Vec Xor(Vec a, Vec b) { return _mm_xor_si128(a, b); }
+    inline Vec Add(Vec a, Vec b) { return _mm_add_epi8(a, b); }
+    inline Vec Sub(Vec a, Vec b) { return _mm_sub_epi8(a, b); }
+    inline Vec AddSat(Vec a, Vec b) { return _mm_adds_epu8(a, b); }
+    inline Vec SubSat(Vec a, Vec b) { return _mm_subs_epu8(a, b); }
+    inline Vec Eq(Vec a, Vec b) { return _mm_cmpeq_epi8(a, b); }
+    inline Vec Shr(Vec a, int n) { return _mm_and_si128(_mm_srli_epi16(a, n), Set1((uint8_t)(0xFF >> n))); }
+    inline Vec Blend(Vec a, Vec b, Vec m) { return _mm_or_si128(_mm_and_si128(m, b), _mm_andnot_si128(m, a)); }
+    inline uint32_t Bits(Vec m) { return (uint32_t)_mm_movemask_epi8(m); }
+#else
+    typedef uint8_t Vec;
+    const unsigned int VEC = 1;
+
+    inline Vec Load(const uint8_t* p) { return *p; }
+    inline void Store(uint8_t* p, Vec v) { *p = v; }
+    inline Vec Set1(uint8_t b) { return b; }
+    inline Vec And(Vec a, Vec b) { return a & b; }
+    inline Vec AndNot(Vec a, Vec b) { return (uint8_t)~a & b; }
+    inline Vec Or(Vec a, Vec b) { return a | b; }
+    inline Vec Xor(Vec a, Vec b) { return a ^ b; }
+    inline Vec Add(Vec a, Vec b) { return (uint8_t)(a + b); }
+    inline Vec Sub(Vec a, Vec b) { return (uint8_t)(a - b); }
+    inline Vec AddSat(Vec a, Vec b) { return a + b > 0xFF ? 0xFF : (uint8_t)(a + b); }
+    inline Vec SubSat(Vec a, Vec b) { return a > b ? (uint8_t)(a - b) : 0; }
+    inline Vec Eq(Vec a, Vec b) { return a == b ? 0xFF : 0x00; }
+    inline Vec Shr(Vec a, int n) { return a >> n; }
+    inline Vec Blend(Vec a, Vec b, Vec m) { return (m & b) | ((uint8_t)~m & a); }
+    inline uint32_t Bits(Vec m) { return m & 1; }
+#endif
+
+    inline Vec Not(Vec a) { return Xor(a, Set1(0xFF)); }
+    inline Vec Shl1(Vec a) { return Add(a, a); }
+    inline bool Any(Vec m) { return Bits(m) != 0; }
+
+    inline unsigned int LowestBit(uint32_t bits)
+    {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward(&index, bits);
+        return index;
+#else
+        return (unsigned int)__builtin_ctz(bits);
+#endif
+    }
+
+    // f(i, m) for every vector of the range with at least one lane in mask
+    template <typename F>
+    inline void ForEachVector(const uint8_t* mask, unsigned int begin, unsigned int end, F f)
+    {
+        for (unsigned int i = begin; i < end; i += VEC)
+        {
+            Vec m = Load(mask + i);
+            if (Any(m))
+            {
+                f(i, m);
+            }
+        }
+    }
+
+    // f(lane) for every lane in mask
+    template <typename F>
+    inline void ForEachLane(const uint8_t* mask, unsigned int begin, unsigned int end, F f)
+    {
+        for (unsigned int i = begin; i < end; i += VEC)
+        {
+            for (uint32_t bits = Bits(Load(mask + i)); bits; bits &= bits - 1)
+            {
+                f(i + LowestBit(bits));
+            }
+        }
+    }
+
+    // Pages holding the two bytes of the opcode at pc
+    inline uint16_t CodePages(uint16_t pc)
+    {
+        return (uint16_t)(1u << ((pc & 0x0FFF) >> 8) | 1u << (((pc + 1) & 0x0FFF) >> 8));
+    }
+
+    // Whether lanes running opcode from one PC can end up at different PCs
+    inline bool MayDiverge(uint16_t opcode)
+    {
+        switch (opcode >> 12)
+        {
+        case 0x0:
+            return opcode == 0x00EE;
+        case 0x3: case 0x4: case 0x5: case 0x9: case 0xB: case 0xE:
+            return true;
+        case 0xF:
+            return (opcode & 0x00FF) == 0x0A;
+        }
+        return false;
+    }
+
+    inline uint32_t XorShift(uint32_t& state)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+}
+
+LockstepEngine::LockstepEngine(unsigned int laneCount)
+    : lanes(laneCount ? laneCount : 1),
+      stride((lanes + LANE_BLOCK - 1) / LANE_BLOCK * LANE_BLOCK),
+      regs(16 * stride), pcLow(stride), pcHigh(stride), indexLow(stride), indexHigh(stride),
+      delayTimer(stride), soundTimer(stride), sp(stride), stack(16 * stride), keys(stride),
+      keyDown(16 * stride),
+      seeds(stride), rng(stride), display(DISPLAY_ROWS * stride),
+      pending(stride), group(stride), groupBegin(0), groupEnd(0), converged(false),
+      image(4096), pageTable(PAGES * stride), privateMask(stride), ownedPages(0),
+      cyclesPerFrame(DEFAULT_CYCLES_PER_FRAME), frameCountdown(DEFAULT_CYCLES_PER_FRAME), stats()
+{
+    LoadROM(nullptr, 0);
+    for (unsigned int lane = 0; lane < stride; ++lane)
+    {
+        seeds[lane] = 0x9E3779B9u * (lane + 1);
+    }
+    Reset();
+}
+
+bool LockstepEngine::LoadROM(char const* filename)
+{
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open())
+    {
+        return false;
+    }
+    std::vector<char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    return LoadROM((uint8_t const*)data.data(), data.size());
+}
+
+// The image is CHIP_8's own power on Memory, fonts and all
+bool LockstepEngine::LoadROM(uint8_t const* data, size_t size)
+{
+    std::unique_ptr<MachineState> state(new MachineState);
+    if (!CHIP_8::PowerOnState(*state, data, size))
+    {
+        return false;
+    }
+    image.assign(state->Memory, state->Memory + sizeof(state->Memory));
+    Reset();
+    return true;
+}
+
+void LockstepEngine::Reset()
+{
+    std::fill(regs.begin(), regs.end(), 0);
+    std::fill(pcLow.begin(), pcLow.end(), START_ADDRESS & 0xFF);
+    std::fill(pcHigh.begin(), pcHigh.end(), START_ADDRESS >> 8);
+    std::fill(indexLow.begin(), indexLow.end(), 0);
+    std::fill(indexHigh.begin(), indexHigh.end(), 0);
+    std::fill(delayTimer.begin(), delayTimer.end(), 0);
+    std::fill(soundTimer.begin(), soundTimer.end(), 0);
+    std::fill(sp.begin(), sp.end(), 0);
+    std::fill(stack.begin(), stack.end(), 0);
+    std::fill(display.begin(), display.end(), 0);
+    rng = seeds;
+
+    for (unsigned int lane = 0; lane < stride; ++lane)
+    {
+        for (unsigned int page = 0; page < PAGES; ++page)
+        {
+            pageTable[lane * PAGES + page] = &image[page * 256];
+        }
+    }
+    std::fill(privateMask.begin(), privateMask.end(), 0);
+    privatePages.clear();
+    ownedPages = 0;
+    converged = false;
+
+    frameCountdown = cyclesPerFrame;
+    stats = LockstepStats();
+}
+
+void LockstepEngine::SetCyclesPerFrame(uint32_t cycles)
+{
+    cycles = cycles ? cycles : 1;
+    if (cycles == cyclesPerFrame)
+    {
+        return;
+    }
+
+    // Same rescaling as CHIP_8::SetCyclesPerFrame()
+    uint64_t left = ((uint64_t)frameCountdown * cycles + cyclesPerFrame / 2) / cyclesPerFrame;
+    frameCountdown = left < 1 ? 1 : left > cycles ? cycles : (uint32_t)left;
+    cyclesPerFrame = cycles;
+}
+
+void LockstepEngine::SetSeed(unsigned int lane, uint32_t seed)
+{
+    // xorshift never leaves zero
+    seeds[lane] = seed ? seed : 0x9E3779B9u;
+    rng[lane] = seeds[lane];
+}
+
+void LockstepEngine::SetKeys(unsigned int lane, uint16_t mask)
+{
+    keys[lane] = mask;
+    for (unsigned int key = 0; key < 16; ++key)
+    {
+        keyDown[key * stride + lane] = ((mask >> key) & 1) ? 0xFF : 0x00;
+    }
+}
+
+uint8_t LockstepEngine::ReadMemory(unsigned int lane, uint16_t address) const
+{
+    address &= 0x0FFF;
+    return pageTable[lane * PAGES + (address >> 8)][address & 0xFF];
+}
+
+uint16_t LockstepEngine::Fetch(unsigned int lane, uint16_t pc) const
+{
+    return (uint16_t)(ReadMemory(lane, pc) << 8 | ReadMemory(lane, pc + 1));
+}
+
+// First write to a shared page gives the lane its own copy
+uint8_t* LockstepEngine::Writable(unsigned int lane, uint16_t address)
+{
+    address &= 0x0FFF;
+    unsigned int page = address >> 8;
+    if (!(privateMask[lane] & (1u << page)))
+    {
+        privatePages.emplace_back();
+        memcpy(privatePages.back().data(), pageTable[lane * PAGES + page], 256);
+        pageTable[lane * PAGES + page] = privatePages.back().data();
+        privateMask[lane] |= (uint16_t)(1u << page);
+        ownedPages |= (uint16_t)(1u << page);
+        ++stats.privatePages;
+    }
+    return &pageTable[lane * PAGES + page][address & 0xFF];
+}
+
+void LockstepEngine::Run(uint32_t steps)
+{
+    for (uint32_t s = 0; s < steps; ++s)
+    {
+        Step();
+        ++stats.steps;
+
+        if (--frameCountdown == 0)
+        {
+            frameCountdown = cyclesPerFrame;
+            TickTimers();
+        }
+    }
+}
+
+void LockstepEngine::TickTimers()
+{
+    const Vec one = Set1(1);
+    for (unsigned int i = 0; i < stride; i += VEC)
+    {
+        Store(&delayTimer[i], SubSat(Load(&delayTimer[i]), one));
+        Store(&soundTimer[i], SubSat(Load(&soundTimer[i]), one));
+    }
+}
+
+// Every lane executes one instruction, one (PC, opcode) group at a time
+void LockstepEngine::Step()
+{
+    // While every lane shares a PC, the last step's group already holds them
+    // all, unless some lane has its own copy of the code there
+    uint16_t pc = GetPC(0);
+    if (converged && !(ownedPages & CodePages(pc)))
+    {
+        uint16_t opcode = Fetch(0, pc);
+        Execute(pc, opcode);
+        ++stats.groups;
+        converged = !MayDiverge(opcode);
+        return;
+    }
+
+    memset(pending.data(), 0xFF, lanes);
+    memset(pending.data() + lanes, 0x00, stride - lanes);
+
+    unsigned int first = 0;
+    for (bool single = true; ; single = false)
+    {
+        // The leader is the lowest lane still pending, every lane before its
+        // vector has already stepped
+        uint32_t bits = 0;
+        while ((bits = Bits(Load(&pending[first]))) == 0)
+        {
+            first += VEC;
+        }
+        unsigned int leader = first + LowestBit(bits);
+        pc = GetPC(leader);
+        uint16_t opcode = Fetch(leader, pc);
+
+        bool left = BuildGroup(leader);
+
+        // A lane with its own copy of the code under PC may hold a different
+        // opcode there, leave it for a later group
+        if (ownedPages & CodePages(pc))
+        {
+            ForEachLane(group.data(), groupBegin, groupEnd, [&](unsigned int lane) {
+                if ((privateMask[lane] & CodePages(pc)) && Fetch(lane, pc) != opcode)
+                {
+                    group[lane] = 0x00;
+                    pending[lane] = 0xFF;
+                    left = true;
+                }
+            });
+        }
+
+        Execute(pc, opcode);
+        ++stats.groups;
+
+        if (!left)
+        {
+            converged = single && !MayDiverge(opcode);
+            return;
+        }
+    }
+}
+
+// Moves the pending lanes at the leader's PC into the group, true if any
+// lane is still pending after that
+bool LockstepEngine::BuildGroup(unsigned int leader)
+{
+    const Vec low = Set1(pcLow[leader]);
+    const Vec high = Set1(pcHigh[leader]);
+    bool left = false;
+
+    groupBegin = leader / VEC * VEC;
+    groupEnd = groupBegin;
+    for (unsigned int i = groupBegin; i < stride; i += VEC)
+    {
+        Vec p = Load(&pending[i]);
+        Vec m = And(p, And(Eq(Load(&pcLow[i]), low), Eq(Load(&pcHigh[i]), high)));
+        Vec rest = AndNot(m, p);
+        Store(&group[i], m);
+        Store(&pending[i], rest);
+        if (Any(m))
+        {
+            groupEnd = i + VEC;
+        }
+        left = left || Any(rest);
+    }
+    return left;
+}
+
+void LockstepEngine::Execute(uint16_t pc, uint16_t opcode)
+{
+    uint8_t* vx = &regs[((opcode >> 8) & 0x0F) * stride];
+    uint8_t* vy = &regs[((opcode >> 4) & 0x0F) * stride];
+    uint8_t* vf = &regs[0x0F * stride];
+    const uint8_t* mask = group.data();
+    const Vec nn = Set1((uint8_t)(opcode & 0x00FF));
+
+    // PC for lanes that fall through, and for lanes that skip
+    uint16_t next = (uint16_t)(pc + 2);
+    uint16_t skip = (uint16_t)(pc + 4);
+    const Vec nextLow = Set1((uint8_t)next), nextHigh = Set1((uint8_t)(next >> 8));
+    const Vec skipLow = Set1((uint8_t)skip), skipHigh = Set1((uint8_t)(skip >> 8));
+
+    auto advance = [&](unsigned int i, Vec m) {
+        Store(&pcLow[i], Blend(Load(&pcLow[i]), nextLow, m));
+        Store(&pcHigh[i], Blend(Load(&pcHigh[i]), nextHigh, m));
+    };
+    auto skipIf = [&](unsigned int i, Vec m, Vec taken) {
+        Store(&pcLow[i], Blend(Load(&pcLow[i]), Blend(nextLow, skipLow, taken), m));
+        Store(&pcHigh[i], Blend(Load(&pcHigh[i]), Blend(nextHigh, skipHigh, taken), m));
+    };
+    auto jump = [&](unsigned int i, Vec m, uint16_t target) {
+        Store(&pcLow[i], Blend(Load(&pcLow[i]), Set1((uint8_t)target), m));
+        Store(&pcHigh[i], Blend(Load(&pcHigh[i]), Set1((uint8_t)(target >> 8)), m));
+    };
+
+    switch (opcode >> 12)
+    {
+    case 0x1:
+        ForEachVector(mask, groupBegin, groupEnd, [&](unsigned int i, Vec m) {
+            jump(i, m, opcode & 0x0FFF);
+        });
+        return;
+    case 0x3:
+        ForEachVector(mask, groupBegin, groupEnd, [&](unsigned int i, Vec m) {
+            skipIf(i, m, Eq(Load(vx + i), nn));
+        });
+        return;
+    case 0x4:
+        ForEachVector(mask, groupBegin, groupEnd, [&](unsigned int i, Vec m) {
+            skipIf(i, m, Not(Eq(Load(vx + i), nn)));
+        });
+        return;
+    case 0x5:
+        ForEachVector(mask, groupBegin, groupEnd, [&](unsigned int i, Vec m) {
+            skipIf(i, m, Eq(Load(vx + i), Load(vy + i)));
+        });
+        return;
+    case 0x9:
+        ForEachVector(mask, groupBegin, groupEnd, [&](unsigned int i, Vec m) {
+            skipIf(i, m, Not(Eq(Load(vx + i), Load(vy + i))));
+        });
+        return;
+    case 0x6:
+        ForEachVector(mask, groupBegin, groupEnd, [&](unsigned int i, Vec m) {
+            Store(vx + i, Blend(Load(vx + i), nn, m));
+            advance(i, m);
+        });
+        return;
+    case 0x7:
+        ForEachVector(mask, groupBegin, groupEnd, [&](unsigned int i, Vec m) {
+            Store(vx + i, Add(Load(vx + i), And(nn, m)));
+            advance(i, m);
+        });
+        return;
+    case 0x8:
+        // VF is written before Vx, so Vx wins when X is F. Like the
+        // interpreter, 8XY5 subtracts the registers as they are after the VF
+        // write; the others compute Vx from the values before it
+        switch (opcode & 0x000F)
+        {
+        case 0x0:
+            ForEachVector(mask, groupBegin, groupEnd, [&](unsigned int i, Vec m) {
+                Store(vx + i, Blend(Load(vx + i), Load(vy + i), m));
+                advance(i, m);
+            });
+            return;
+        case 0x1:
+            ForEachVector(mask, groupBegin, groupEnd, [&](unsigned int i, Vec m) {
+                Store(vx + i, Or(Load(vx + i), And(Load(vy + i), m)));
+                advance(i, m);
+            });
+            return;
+        case 0x2:
+            ForEachVector(mask, groupBegin, groupEnd, [&](unsigned int i, Vec m) {
+                Store(vx + i, And(Load(vx + i), Or(Load(vy + i), Not(m))));
+                advance(i, m);
+            });
+            return;
+        case 0x3:
+            ForEachVector(mask, groupBegin, groupEnd, [&](unsigned int i, Vec m) {
+                Store(vx + i, Xor(Load(vx + i), And(Load(vy + i), m)));
+                advance(i, m);
+            });
+            return;
+        case 0x4:
+            ForEachVector(mask, groupBegin, groupEnd, [&](unsigned int i, Vec m) {
+                Vec x = Load(vx + i), y = Load(vy + i);
+                Vec sum = Add(x, y);
+                Vec noCarry = Eq(AddSat(x, y), sum);
+                Store(vf + i, Blend(Load(vf + i), AndNot(noCarry, Set1(1)), m));
+                Store(vx + i, Blend(Load(vx + i), sum, m));
+                advance(i, m);
+            });
+            return;
+        case 0x5:
+            ForEachVector(mask, groupBegin, groupEnd, [&](unsigned int i, Vec m) {
+                Vec noBorrow = Eq(SubSat(Load(vy + i), Load(vx + i)), Set1(0));
+                Store(vf + i, Blend(Load(vf + i), And(noBorrow, Set1(1)), m));
+                Vec x = Load(vx + i);
+                Store(vx + i, Blend(x, Sub(x, Load(vy + i)), m));
+                advance(i, m);
+            });
+            return;
+        case 0x6:
+            ForEachVector(mask, groupBegin, groupEnd, [&](unsigned int i, Vec m) {
+                Vec x = Load(vx + i);
+                Store(vf + i, Blend(Load(vf + i), And(x, Set1(1)), m));
+                Store(vx + i, Blend(Load(vx + i), Shr(x, 1), m));
+                advance(i, m);
+            });
+            return;
+        case 0x7:
+            ForEachVector(mask, groupBegin, groupEnd, [&](unsigned int i, Vec m) {
+                Vec x = Load(vx + i), y = Load(vy + i);
+                Vec noBorrow = Eq(SubSat(x, y), Set1(0));
+                Store(vf + i, Blend(Load(vf + i), And(noBorrow, Set1(1)), m));
+                Store(vx + i, Blend(Load(vx + i), Sub(y, x), m));
+                advance(i, m);
+            });
+            return;
+        case 0xE:
+            ForEachVector(mask, groupBegin, groupEnd, [&](unsigned int i, Vec m) {
+                Vec x = Load(vx + i);
+                Vec msb = Eq(And(x, Set1(0x80)), Set1(0x80));
+                Store(vf + i, Blend(Load(vf + i), And(msb, Set1(1)), m));
+                Store(vx + i, Blend(Load(vx + i), Shl1(x), m));
+                advance(i, m);
+            });
+            return;
+        }
+        break;
+    case 0xE:
+        // Vx names a held key when it equals some k whose keyDown plane is set
+        if ((opcode & 0x00FF) == 0x9E || (opcode & 0x00FF) == 0xA1)
+        {
+            const Vec held = Set1((opcode & 0x00FF) == 0x9E ? 0xFF : 0x00);
+            ForEachVector(mask, groupBegin, groupEnd, [&](unsigned int i, Vec m) {
+                Vec key = Load(vx + i);
+                Vec pressed = Set1(0);
+                for (unsigned int k = 0; k < 16; ++k)
+                {
+                    pressed = Or(pressed, And(Eq(key, Set1((uint8_t)k)), Load(&keyDown[k * stride + i])));
+                }
+                skipIf(i, m, Eq(pressed, held));
+            });
+            return;
+        }
+        break;
+    case 0xA:
+        ForEachVector(mask, groupBegin, groupEnd, [&](unsigned int i, Vec m) {
+            Store(&indexLow[i], Blend(Load(&indexLow[i]), Set1((uint8_t)opcode), m));
+            Store(&indexHigh[i], Blend(Load(&indexHigh[i]), Set1((uint8_t)((opcode >> 8) & 0x0F)), m));
+            advance(i, m);
+        });
+        return;
+    case 0xF:
+        switch (opcode & 0x00FF)
+        {
+        case 0x07:
+            ForEachVector(mask, groupBegin, groupEnd, [&](unsigned int i, Vec m) {
+                Store(vx + i, Blend(Load(vx + i), Load(&delayTimer[i]), m));
+                advance(i, m);
+            });
+            return;
+        case 0x15:
+            ForEachVector(mask, groupBegin, groupEnd, [&](unsigned int i, Vec m) {
+                Store(&delayTimer[i], Blend(Load(&delayTimer[i]), Load(vx + i), m));
+                advance(i, m);
+            });
+            return;
+        case 0x18:
+            ForEachVector(mask, groupBegin, groupEnd, [&](unsigned int i, Vec m) {
+                Store(&soundTimer[i], Blend(Load(&soundTimer[i]), Load(vx + i), m));
+                advance(i, m);
+            });
+            return;
+        case 0x1E:
+            // 16-bit I += Vx, the carry out of the low byte is a 0xFF mask
+            ForEachVector(mask, groupBegin, groupEnd, [&](unsigned int i, Vec m) {
+                Vec x = Load(vx + i);
+                Vec low = Add(Load(&indexLow[i]), x);
+                Vec carry = Not(Eq(SubSat(x, low), Set1(0)));
+                Store(&indexLow[i], Blend(Load(&indexLow[i]), low, m));
+                Store(&indexHigh[i], Sub(Load(&indexHigh[i]), And(carry, m)));
+                advance(i, m);
+            });
+            return;
+        case 0x29:
+            // I = FONTSET_START_ADDRESS + Vx * 5, 16-bit: Vx * 4 is split into
+            // a low byte and Vx >> 6, then the carries of the two adds count
+            // into the high byte as 0xFF masks
+            ForEachVector(mask, groupBegin, groupEnd, [&](unsigned int i, Vec m) {
+                Vec x = Load(vx + i);
+                Vec times5 = Add(Shl1(Shl1(x)), x);
+                Vec carry5 = Not(Eq(SubSat(x, times5), Set1(0)));
+                Vec low = Add(times5, Set1((uint8_t)FONTSET_START_ADDRESS));
+                Vec carryFont = Not(Eq(SubSat(Set1((uint8_t)FONTSET_START_ADDRESS), low), Set1(0)));
+                Vec high = Sub(Sub(Add(Shr(x, 6), Set1(FONTSET_START_ADDRESS >> 8)), carry5), carryFont);
+                Store(&indexLow[i], Blend(Load(&indexLow[i]), low, m));
+                Store(&indexHigh[i], Blend(Load(&indexHigh[i]), high, m));
+                advance(i, m);
+            });
+            return;
+        }
+        break;
+    }
+
+    ExecuteScalar(pc, opcode);
+}
+
+// Instructions that touch memory, the stack or the display, run lane by
+// lane. The lane loops work through local pointers, as a byte store through
+// a member vector makes the compiler reload every member's data pointer,
+// and look a lane's page up once when the bytes touched sit in one page
+void LockstepEngine::ExecuteScalar(uint16_t pc, uint16_t opcode)
+{
+    const uint8_t x = (opcode >> 8) & 0x0F;
+    const uint8_t y = (opcode >> 4) & 0x0F;
+    const uint8_t nn = opcode & 0x00FF;
+    const uint16_t nnn = opcode & 0x0FFF;
+    const uint16_t next = (uint16_t)(pc + 2);
+    const uint8_t* mask = group.data();
+
+    uint8_t* const v = regs.data();                     // Vr of a lane is v[r * stride + lane]
+    uint8_t* const pcl = pcLow.data();
+    uint8_t* const pch = pcHigh.data();
+    uint8_t const* const il = indexLow.data();
+    uint8_t const* const ih = indexHigh.data();
+    uint8_t* const* const pages = pageTable.data();
+    const unsigned int n = stride;
+
+    auto index = [&](unsigned int lane) { return (uint16_t)(ih[lane] << 8 | il[lane]); };
+    auto setPC = [&](unsigned int lane, uint16_t target) {
+        pcl[lane] = (uint8_t)target;
+        pch[lane] = (uint8_t)(target >> 8);
+    };
+    auto inOnePage = [](uint16_t address, unsigned int count) { return (address & 0xFF) + count <= 256; };
+    auto at = [&](unsigned int lane, uint16_t address) -> uint8_t const* {
+        return &pages[lane * PAGES + ((address & 0x0FFF) >> 8)][address & 0xFF];
+    };
+
+    // Cases that return set the PC themselves, the rest fall through to next
+    switch (opcode >> 12)
+    {
+    case 0x0:
+        if (opcode == 0x00E0)
+        {
+            // Vector stores, a memset call per lane costs more than the clear
+            uint8_t* const screen = (uint8_t*)display.data();
+            ForEachLane(mask, groupBegin, groupEnd, [&](unsigned int lane) {
+                uint8_t* rows = screen + lane * DISPLAY_ROWS * sizeof(uint64_t);
+                for (unsigned int i = 0; i < DISPLAY_ROWS * sizeof(uint64_t); i += VEC)
+                {
+                    Store(rows + i, Set1(0));
+                }
+            });
+            break;
+        }
+        if (opcode == 0x00EE)
+        {
+            uint8_t* const stackPointer = sp.data();
+            uint16_t const* const frames = stack.data();
+            ForEachLane(mask, groupBegin, groupEnd, [&](unsigned int lane) {
+                --stackPointer[lane];
+                setPC(lane, frames[lane * 16 + (stackPointer[lane] & 0x0F)]);
+            });
+            return;
+        }
+        break;
+    case 0x2:
+    {
+        uint8_t* const stackPointer = sp.data();
+        uint16_t* const frames = stack.data();
+        ForEachLane(mask, groupBegin, groupEnd, [&](unsigned int lane) {
+            frames[lane * 16 + (stackPointer[lane] & 0x0F)] = next;
+            ++stackPointer[lane];
+        });
+        ForEachVector(mask, groupBegin, groupEnd, [&](unsigned int i, Vec m) {
+            Store(pcl + i, Blend(Load(pcl + i), Set1((uint8_t)nnn), m));
+            Store(pch + i, Blend(Load(pch + i), Set1((uint8_t)(nnn >> 8)), m));
+        });
+        return;
+    }
+    case 0xB:
+        ForEachLane(mask, groupBegin, groupEnd, [&](unsigned int lane) {
+            setPC(lane, (uint16_t)(v[lane] + nnn));
+        });
+        return;
+    case 0xC:
+    {
+        uint32_t* const state = rng.data();
+        ForEachLane(mask, groupBegin, groupEnd, [&](unsigned int lane) {
+            v[x * n + lane] = (uint8_t)XorShift(state[lane]) & nn;
+        });
+        break;
+    }
+    case 0xD:
+    {
+        uint64_t* const screen = display.data();
+        const uint8_t rowsInSprite = opcode & 0x0F;
+        ForEachLane(mask, groupBegin, groupEnd, [&](unsigned int lane) {
+            uint16_t address = index(lane);
+            uint8_t xpos = v[x * n + lane] % 64;
+            uint8_t ypos = v[y * n + lane] % DISPLAY_ROWS;
+            uint8_t height = rowsInSprite;
+            if (height > DISPLAY_ROWS - ypos)
+            {
+                height = (uint8_t)(DISPLAY_ROWS - ypos);
+            }
+
+            uint8_t copy[15];
+            uint8_t const* sprite = copy;
+            if (inOnePage(address, height))
+            {
+                sprite = at(lane, address);
+            }
+            else
+            {
+                for (uint8_t row = 0; row < height; ++row)
+                {
+                    copy[row] = *at(lane, (uint16_t)(address + row));
+                }
+            }
+
+            uint64_t* rows = &screen[lane * DISPLAY_ROWS + ypos];
+            uint64_t collision = 0;
+            for (uint8_t row = 0; row < height; ++row)
+            {
+                uint64_t bits = ((uint64_t)sprite[row] << 56) >> xpos;
+                collision |= rows[row] & bits;
+                rows[row] ^= bits;
+            }
+            v[0xF * n + lane] = collision ? 1 : 0;
+        });
+        break;
+    }
+    case 0xF:
+        switch (nn)
+        {
+        case 0x0A:
+        {
+            uint16_t const* const held = keys.data();
+            ForEachLane(mask, groupBegin, groupEnd, [&](unsigned int lane) {
+                if (held[lane])
+                {
+                    v[x * n + lane] = (uint8_t)LowestBit(held[lane]);
+                    setPC(lane, next);
+                }
+                else
+                {
+                    setPC(lane, pc);        // keep waiting
+                }
+            });
+            return;
+        }
+        case 0x33:
+            ForEachLane(mask, groupBegin, groupEnd, [&](unsigned int lane) {
+                uint16_t address = index(lane);
+                uint8_t value = v[x * n + lane];
+                if (inOnePage(address, 3))
+                {
+                    uint8_t* digits = Writable(lane, address);
+                    digits[0] = value / 100;
+                    digits[1] = (value / 10) % 10;
+                    digits[2] = value % 10;
+                }
+                else
+                {
+                    *Writable(lane, (uint16_t)(address + 2)) = value % 10;
+                    *Writable(lane, (uint16_t)(address + 1)) = (value / 10) % 10;
+                    *Writable(lane, address) = value / 100;
+                }
+            });
+            break;
+        case 0x55:
+            ForEachLane(mask, groupBegin, groupEnd, [&](unsigned int lane) {
+                uint16_t address = index(lane);
+                if (inOnePage(address, x + 1u))
+                {
+                    uint8_t* to = Writable(lane, address);
+                    for (uint8_t i = 0; i <= x; ++i)
+                    {
+                        to[i] = v[i * n + lane];
+                    }
+                }
+                else
+                {
+                    for (uint8_t i = 0; i <= x; ++i)
+                    {
+                        *Writable(lane, (uint16_t)(address + i)) = v[i * n + lane];
+                    }
+                }
+            });
+            break;
+        case 0x65:
+            ForEachLane(mask, groupBegin, groupEnd, [&](unsigned int lane) {
+                uint16_t address = index(lane);
+                bool onePage = inOnePage(address, x + 1u);
+                uint8_t const* from = at(lane, address);
+                for (uint8_t i = 0; i <= x; ++i)
+                {
+                    v[i * n + lane] = onePage ? from[i] : *at(lane, (uint16_t)(address + i));
+                }
+            });
+            break;
+        }
+        break;
+    }
+
+    // Anything else is a no-op, like OP_NULL
+    ForEachVector(mask, groupBegin, groupEnd, [&](unsigned int i, Vec m) {
+        Store(pcl + i, Blend(Load(pcl + i), Set1((uint8_t)next), m));
+        Store(pch + i, Blend(Load(pch + i), Set1((uint8_t)(next >> 8)), m));
+    });
+}
@@ -0,0 +1,114 @@
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+struct LockstepStats
+{
+    uint64_t steps;             // instructions retired by every lane
+    uint64_t groups;            // (PC, opcode) groups executed, steps when no lane diverges
+    uint64_t privatePages;      // 256-byte pages copied on write
+};
+
+/*
+    Runs many copies of one ROM in lockstep.
+
+    Machine state is stored as structure-of-arrays, one byte array per field
+    with one entry per lane (PC and I are split into low and high bytes), so
+    that every kernel works on whole SIMD vectors of lanes. Each step, the
+    lanes are split into groups that share a PC and an opcode. The opcode is
+    decoded once per group and run under a lane mask: ALU, timer, key and
+    register file instructions use SSE2/AVX2 kernels, while memory, stack and
+    display instructions loop over the lanes in the group. While every lane
+    shares one PC, steps reuse the last group instead of splitting again.
+
+    All lanes read the ROM image, CHIP_8::PowerOnState()'s Memory with both
+    fonts, through a per-lane page table. A lane that writes Memory gets its
+    own copy of just the 256-byte page it touched.
+
+    Only the original CHIP-8 instruction set is run, with the quirks of
+    DEFAULT_QUIRKS (the classic profile). SUPER-CHIP and XO-CHIP instructions
+    are no-ops here, so ROMs using them or another quirk profile must run on
+    CHIP_8.
+*/
+class LockstepEngine
+{
+public:
+    LockstepEngine(unsigned int lanes);
+
+    bool LoadROM(char const* filename);                 // false if unreadable or too large
+    bool LoadROM(uint8_t const* data, size_t size);
+    void Reset();                                       // every lane back to the loaded image
+
+    unsigned int Lanes() const { return lanes; }
+
+    void SetCyclesPerFrame(uint32_t cycles);
+    void SetSeed(unsigned int lane, uint32_t seed);
+    void SetKeys(unsigned int lane, uint16_t keys);     // bit k set while key k is held
+
+    // Every lane executes steps instructions, timers tick every cyclesPerFrame
+    void Run(uint32_t steps);
+
+    uint16_t GetPC(unsigned int lane) const { return (uint16_t)(pcHigh[lane] << 8 | pcLow[lane]); }
+    uint16_t GetIndex(unsigned int lane) const { return (uint16_t)(indexHigh[lane] << 8 | indexLow[lane]); }
+    uint8_t GetRegister(unsigned int lane, unsigned int x) const { return regs[(x & 0x0F) * stride + lane]; }
+    uint8_t GetSP(unsigned int lane) const { return sp[lane]; }
+    uint8_t GetDelayTimer(unsigned int lane) const { return delayTimer[lane]; }
+    uint8_t GetSoundTimer(unsigned int lane) const { return soundTimer[lane]; }
+    uint8_t ReadMemory(unsigned int lane, uint16_t address) const;
+    uint64_t const* Display(unsigned int lane) const { return &display[lane * DISPLAY_ROWS]; }
+
+    const LockstepStats& Stats() const { return stats; }
+
+private:
+    static const unsigned int LANE_BLOCK = 32;          // lanes are padded to the widest vector
+    static const unsigned int PAGES = 16;
+    static const unsigned int DISPLAY_ROWS = 32;
+
+    void Step();
+    bool BuildGroup(unsigned int leader);
+    void Execute(uint16_t pc, uint16_t opcode);
+    void ExecuteScalar(uint16_t pc, uint16_t opcode);
+    void TickTimers();
+
+    uint16_t Fetch(unsigned int lane, uint16_t pc) const;
+    uint8_t* Writable(unsigned int lane, uint16_t address);
+
+    unsigned int lanes;
+    unsigned int stride;                                // lanes rounded up to LANE_BLOCK
+
+    // One entry per lane
+    std::vector<uint8_t> regs;                          // V0..VF, stride bytes each
+    std::vector<uint8_t> pcLow, pcHigh;
+    std::vector<uint8_t> indexLow, indexHigh;
+    std::vector<uint8_t> delayTimer, soundTimer, sp;
+    std::vector<uint16_t> stack;                        // 16 per lane
+    std::vector<uint16_t> keys;
+    std::vector<uint8_t> keyDown;                       // 16 planes of stride bytes, 0xFF while key k is held
+    std::vector<uint32_t> seeds, rng;
+    std::vector<uint64_t> display;                      // DISPLAY_ROWS per lane
+
+    // Lane masks, 0xFF or 0x00 per lane
+    std::vector<uint8_t> pending;                       // not yet stepped this step
+    std::vector<uint8_t> group;                         // lanes in the current group
+    unsigned int groupBegin, groupEnd;                  // vector aligned range holding the group
+    bool converged;                                     // every lane at one PC, all of them in group
+
+    // Copy-on-write memory
+    std::vector<uint8_t> image;                         // pristine 4 KB, shared by every lane
+    std::vector<uint8_t*> pageTable;                    // PAGES per lane
+    std::vector<uint16_t> privateMask;                  // bit p set once a lane owns page p
+    std::deque<std::array<uint8_t, 256>> privatePages;
+    uint16_t ownedPages;                                // bit p set once any lane owns page p
+
+    uint32_t cyclesPerFrame;
+    uint32_t frameCountdown;
+
+    LockstepStats stats;
+};
+
+#endif // LOCKSTEP_H
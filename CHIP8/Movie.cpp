@@ -0,0 +1,130 @@
+#include "Movie.h"
+#include <fstream>
+
+namespace
+{
+    const uint32_t MOVIE_MAGIC = 0x564D3843;        // "C8MV"
+    const uint32_t MOVIE_VERSION = 2;
+
+    void PutU32(std::ostream& out, uint32_t value)
+    {
+        char bytes[4] = { (char)value, (char)(value >> 8), (char)(value >> 16), (char)(value >> 24) };
+        out.write(bytes, 4);
+    }
+
+    bool GetU32(std::istream& in, uint32_t& value)
+    {
+        unsigned char bytes[4];
+        if (!in.read((char*)bytes, 4))
+        {
+            return false;
+        }
+        value = bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+        return true;
+    }
+}
+
+Movie::Movie()
+    : seed(1), cyclesPerFrame(DEFAULT_CYCLES_PER_FRAME), quirks(DEFAULT_QUIRKS), frames(0), frame(0), next(0), lastKeys(0)
+{
+}
+
+void Movie::StartRecording(CHIP_8& chip8, uint32_t movieSeed)
+{
+    seed = movieSeed;
+    cyclesPerFrame = chip8.GetCyclesPerFrame();
+    quirks = chip8.GetQuirks();
+    frames = 0;
+    events.clear();
+    lastKeys = 0;
+    chip8.SetSeed(seed);
+}
+
+void Movie::StartReplay(CHIP_8& chip8)
+{
+    frame = 0;
+    next = 0;
+    chip8.SetSeed(seed);
+    chip8.SetCyclesPerFrame(cyclesPerFrame);
+    chip8.SetQuirks(quirks);
+    chip8.SetKeys(0);
+}
+
+void Movie::RecordFrame(CHIP_8 const& chip8)
+{
+    uint16_t keys = chip8.GetKeys();
+    if (keys != lastKeys)
+    {
+        KeyEvent event = { frames, keys };
+        events.push_back(event);
+        lastKeys = keys;
+    }
+    ++frames;
+}
+
+bool Movie::ReplayFrame(CHIP_8& chip8)
+{
+    if (frame >= frames)
+    {
+        return false;
+    }
+    while (next < events.size() && events[next].frame <= frame)
+    {
+        chip8.SetKeys(events[next++].keys);
+    }
+    ++frame;
+    return true;
+}
+
+bool Movie::Save(char const* filename) const
+{
+    std::ofstream file(filename, std::ios::binary);
+    PutU32(file, MOVIE_MAGIC);
+    PutU32(file, MOVIE_VERSION);
+    PutU32(file, seed);
+    PutU32(file, cyclesPerFrame);
+    PutU32(file, quirks);
+    PutU32(file, frames);
+    PutU32(file, (uint32_t)events.size());
+    for (KeyEvent const& event : events)
+    {
+        char keys[2] = { (char)event.keys, (char)(event.keys >> 8) };
+        PutU32(file, event.frame);
+        file.write(keys, 2);
+    }
+    return file.good();
+}
+
+bool Movie::Load(char const* filename)
+{
+    std::ifstream file(filename, std::ios::binary);
+    uint32_t magic, version, profile = DEFAULT_QUIRKS, count;
+    if (!GetU32(file, magic) || magic != MOVIE_MAGIC || !GetU32(file, version) || version < 1 || version > MOVIE_VERSION)
+    {
+        return false;
+    }
+    if (!GetU32(file, seed) || !GetU32(file, cyclesPerFrame) || (version >= 2 && !GetU32(file, profile)) || profile >= QUIRK_PROFILES)
+    {
+        return false;
+    }
+    if (!GetU32(file, frames) || !GetU32(file, count))
+    {
+        return false;
+    }
+    quirks = (QuirkProfile)profile;
+    events.clear();
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        KeyEvent event;
+        unsigned char keys[2];
+        if (!GetU32(file, event.frame) || !file.read((char*)keys, 2))
+        {
+            return false;
+        }
+        event.keys = (uint16_t)(keys[0] | keys[1] << 8);
+        events.push_back(event);
+    }
+    frame = 0;
+    next = 0;
+    return true;
+}
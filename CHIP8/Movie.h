@@ -0,0 +1,60 @@
+#ifndef MOVIE_H
+#define MOVIE_H
+
+#include "CHIP_8.h"
+#include <cstdint>
+#include <vector>
+
+/*
+    Input movie: the CXNN seed, the frame length, the quirk profile and
+    every keypad change, keyed by the 60 Hz frame it happened before. The keypad only changes
+    between frames, so replaying a movie on a fresh machine with the same ROM
+    repeats the recorded session exactly, at whatever speed the host runs it.
+
+    File layout, little endian:
+        "C8MV", version, seed, cycles per frame, quirk profile, frames, event count
+        then per event: frame (u32), key mask (u16)
+    Version 1 movies have no quirk profile and replay with DEFAULT_QUIRKS.
+*/
+class Movie
+{
+public:
+    Movie();
+
+    // Seeds chip8 and starts an empty recording under its current quirk profile
+    void StartRecording(CHIP_8& chip8, uint32_t seed);
+
+    // Seeds chip8, sets its quirk profile and rewinds the movie to its first frame
+    void StartReplay(CHIP_8& chip8);
+
+    // Call right before each frame runs
+    void RecordFrame(CHIP_8 const& chip8);
+    bool ReplayFrame(CHIP_8& chip8);            // false once every recorded frame has played
+
+    bool Save(char const* filename) const;
+    bool Load(char const* filename);            // false if unreadable or not a movie
+
+    uint32_t Seed() const { return seed; }
+    uint32_t CyclesPerFrame() const { return cyclesPerFrame; }
+    QuirkProfile Quirks() const { return quirks; }
+    uint32_t Frames() const { return frames; }
+
+private:
+    struct KeyEvent
+    {
+        uint32_t frame;
+        uint16_t keys;
+    };
+
+    uint32_t seed;
+    uint32_t cyclesPerFrame;
+    QuirkProfile quirks;
+    uint32_t frames;            // recorded so far, or in the loaded movie
+    std::vector<KeyEvent> events;
+
+    uint32_t frame;             // replay position
+    size_t next;
+    uint16_t lastKeys;
+};
+
+#endif // MOVIE_H
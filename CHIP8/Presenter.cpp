@@ -0,0 +1,242 @@
+#include "Presenter.h"
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PRESENTER_SSE2 1
+#endif
+
+namespace
+{
+    inline uint32_t ToRGBA(uint32_t rgb)
+    {
+        return (rgb << 8) | 0xFF;
+    }
+
+    // XOR terms that build any palette color from the off color
+    struct Blend
+    {
+        uint32_t off;
+        uint32_t first;         // plane 0 lit
+        uint32_t second;        // plane 1 lit
+        uint32_t both;          // correction when both are lit
+    };
+
+    inline Blend MakeBlend(uint32_t const* colors)
+    {
+        return Blend{ colors[0], colors[0] ^ colors[1], colors[0] ^ colors[2], colors[0] ^ colors[1] ^ colors[2] ^ colors[3] };
+    }
+
+    // Pixels for the 8 bits of two plane bytes, MSB first
+    inline void Expand8(uint32_t byte0, uint32_t byte1, Blend const& blend, uint32_t* out)
+    {
+#if defined(__AVX2__)
+        const __m256i BITS = _mm256_setr_epi32(0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01);
+        __m256i set0 = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32((int)byte0), BITS), BITS);
+        __m256i set1 = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32((int)byte1), BITS), BITS);
+        __m256i pixels = _mm256_xor_si256(_mm256_set1_epi32((int)blend.off), _mm256_and_si256(set0, _mm256_set1_epi32((int)blend.first)));
+        pixels = _mm256_xor_si256(pixels, _mm256_and_si256(set1, _mm256_set1_epi32((int)blend.second)));
+        pixels = _mm256_xor_si256(pixels, _mm256_and_si256(_mm256_and_si256(set0, set1), _mm256_set1_epi32((int)blend.both)));
+        _mm256_storeu_si256((__m256i*)out, pixels);
+#elif defined(PRESENTER_SSE2)
+        const __m128i HIGH = _mm_setr_epi32(0x80, 0x40, 0x20, 0x10);
+        const __m128i LOW = _mm_setr_epi32(0x08, 0x04, 0x02, 0x01);
+        __m128i offs = _mm_set1_epi32((int)blend.off);
+        __m128i firsts = _mm_set1_epi32((int)blend.first);
+        __m128i seconds = _mm_set1_epi32((int)blend.second);
+        __m128i boths = _mm_set1_epi32((int)blend.both);
+        for (unsigned int half = 0; half < 2; ++half)
+        {
+            __m128i pattern = half ? LOW : HIGH;
+            __m128i set0 = _mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32((int)byte0), pattern), pattern);
+            __m128i set1 = _mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32((int)byte1), pattern), pattern);
+            __m128i pixels = _mm_xor_si128(offs, _mm_and_si128(set0, firsts));
+            pixels = _mm_xor_si128(pixels, _mm_and_si128(set1, seconds));
+            pixels = _mm_xor_si128(pixels, _mm_and_si128(_mm_and_si128(set0, set1), boths));
+            _mm_storeu_si128((__m128i*)(out + 4 * half), pixels);
+        }
+#else
+        for (unsigned int i = 0; i < 8; ++i)
+        {
+            uint32_t lit0 = 0 - ((byte0 >> (7 - i)) & 1);
+            uint32_t lit1 = 0 - ((byte1 >> (7 - i)) & 1);
+            out[i] = blend.off ^ (lit0 & blend.first) ^ (lit1 & blend.second) ^ (lit0 & lit1 & blend.both);
+        }
+#endif
+    }
+
+    // count copies of pixel
+    inline void Fill(uint32_t* out, uint32_t pixel, unsigned int count)
+    {
+        unsigned int i = 0;
+#if defined(__AVX2__) || defined(PRESENTER_SSE2)
+        __m128i pixels = _mm_set1_epi32((int)pixel);
+        for (; i + 4 <= count; i += 4)
+        {
+            _mm_storeu_si128((__m128i*)(out + i), pixels);
+        }
+#endif
+        for (; i < count; ++i)
+        {
+            out[i] = pixel;
+        }
+    }
+}
+
+Presenter::Presenter()
+    : fade(0), fading(false), fadedHires(false), scale(1)
+{
+    SetPalette(0x000000, 0xFFFFFF);
+    SetPersistence(0.0);
+}
+
+void Presenter::SetPalette(uint32_t offColor, uint32_t onColor)
+{
+    SetPalette(offColor, onColor, onColor, onColor);
+}
+
+void Presenter::SetPalette(uint32_t offColor, uint32_t onColor, uint32_t secondColor, uint32_t bothColor)
+{
+    colors[0] = ToRGBA(offColor);
+    colors[1] = ToRGBA(onColor);
+    colors[2] = ToRGBA(secondColor);
+    colors[3] = ToRGBA(bothColor);
+    BuildRamps();
+}
+
+void Presenter::SetPersistence(double kept)
+{
+    kept = kept < 0.0 ? 0.0 : (kept > 0.99 ? 0.99 : kept);
+    fade = (uint8_t)(kept * 256.0);
+    for (unsigned int i = 0; i < 256; ++i)
+    {
+        fadeTable[i] = (uint8_t)((i * fade) >> 8);
+    }
+    memset(intensity, 0, sizeof(intensity));
+    memset(lastColor, 0, sizeof(lastColor));
+    fading = false;
+}
+
+void Presenter::SetScale(unsigned int factor)
+{
+    scale = factor < 1 ? 1 : (factor > MAX_SCALE ? MAX_SCALE : factor);
+}
+
+unsigned int Presenter::Width() const
+{
+    return HIRES_WIDTH * scale;
+}
+
+unsigned int Presenter::Height() const
+{
+    return HIRES_HEIGHT * scale;
+}
+
+void Presenter::BuildRamps()
+{
+    for (unsigned int c = 0; c < 4; ++c)
+    {
+        for (unsigned int i = 0; i < 256; ++i)
+        {
+            uint32_t color = 0;
+            for (unsigned int shift = 0; shift < 32; shift += 8)
+            {
+                int from = (colors[0] >> shift) & 0xFF;
+                int to = (colors[c] >> shift) & 0xFF;
+                color |= (uint32_t)(from + (to - from) * (int)i / 255) << shift;
+            }
+            ramps[c][i] = color;
+        }
+    }
+}
+
+void Presenter::ExpandRow(uint64_t const* plane0, uint64_t const* plane1, unsigned int words, uint32_t* out) const
+{
+    Blend blend = MakeBlend(colors);
+    for (unsigned int w = 0; w < words; ++w)
+    {
+        for (unsigned int b = 0; b < 8; ++b, out += 8)
+        {
+            unsigned int shift = 56 - 8 * b;
+            Expand8((uint32_t)(plane0[w] >> shift) & 0xFF, (uint32_t)(plane1[w] >> shift) & 0xFF, blend, out);
+        }
+    }
+}
+
+// Lit pixels jump to full brightness, dark ones lose a share of theirs
+void Presenter::FadeRow(uint64_t const* plane0, uint64_t const* plane1, unsigned int width, unsigned int pixel, uint32_t* out)
+{
+    uint8_t* level = &intensity[pixel];
+    uint8_t* color = &lastColor[pixel];
+    for (unsigned int x = 0; x < width; ++x)
+    {
+        unsigned int shift = 63 - (x & 63);
+        unsigned int lit = (unsigned int)((plane0[x >> 6] >> shift) & 1) | (unsigned int)(((plane1[x >> 6] >> shift) & 1) << 1);
+        uint8_t value = 255;
+        if (lit)
+        {
+            color[x] = (uint8_t)lit;
+        }
+        else
+        {
+            value = fadeTable[level[x]];
+        }
+        level[x] = value;
+        fading |= value != 0 && value != 255;
+        out[x] = ramps[color[x]][value];
+    }
+}
+
+// Writes line, factor times wider, into factor rows of out
+void Presenter::ScaleRow(uint32_t const* line, unsigned int width, unsigned int factor, uint8_t* out, size_t pitch) const
+{
+    uint32_t* first = (uint32_t*)out;
+    for (unsigned int x = 0; x < width; ++x)
+    {
+        Fill(first + x * factor, line[x], factor);
+    }
+    for (unsigned int r = 1; r < factor; ++r)
+    {
+        memcpy(out + r * pitch, first, width * factor * sizeof(uint32_t));
+    }
+}
+
+void Presenter::Render(DisplayPlanes const& planes, bool hires, unsigned int top, unsigned int bottom, void* pixels, size_t pitch)
+{
+    unsigned int width = hires ? HIRES_WIDTH : DISPLAY_WIDTH;
+    unsigned int words = hires ? DISPLAY_COLUMNS : 1;
+    unsigned int factor = RowHeight(hires);
+    uint8_t* out = (uint8_t*)pixels;
+    uint32_t line[HIRES_WIDTH];
+    if (fade)
+    {
+        fading = false;
+        if (hires != fadedHires)
+        {
+            // Nothing carries over from the other resolution's pixels
+            memset(intensity, 0, sizeof(intensity));
+            fadedHires = hires;
+        }
+    }
+
+    for (unsigned int y = top; y < bottom; ++y, out += factor * pitch)
+    {
+        uint64_t plane0[DISPLAY_COLUMNS] = { planes[0][0][y], planes[0][1][y] };
+        uint64_t plane1[DISPLAY_COLUMNS] = { planes[1][0][y], planes[1][1][y] };
+        uint32_t* target = factor == 1 ? (uint32_t*)out : line;
+        if (fade)
+        {
+            FadeRow(plane0, plane1, width, y * width, target);
+        }
+        else
+        {
+            ExpandRow(plane0, plane1, words, target);
+        }
+        if (factor > 1)
+        {
+            ScaleRow(line, width, factor, out, pitch);
+        }
+    }
+}
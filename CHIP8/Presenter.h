@@ -0,0 +1,74 @@
+#ifndef PRESENTER_H
+#define PRESENTER_H
+
+#include "CHIP_8.h"
+#include <cstddef>
+#include <cstdint>
+
+/*
+    Turns the packed one-bit Display planes into RGBA8888 pixels (0xRRGGBBAA
+    per 32-bit word) for a streaming texture.
+
+    Every 8 pixels expand with one compare per plane against a bit pattern
+    and a blend between the palette colors, using AVX2 or SSE2 when the build
+    has them. Output is always the 128 x 64 high resolution screen pre-scaled
+    by an integer factor (low resolution pixels are twice as large), so the
+    texture can be drawn 1:1 with crisp pixels.
+
+    With persistence on, a pixel that goes dark fades out over a few frames
+    instead of vanishing, which hides the flicker of games that erase and
+    redraw sprites with XOR every frame. Each Render() call is then one 60 Hz
+    step of the fade, and every row is rendered on every call.
+*/
+class Presenter
+{
+public:
+    static const unsigned int MAX_SCALE = 64;
+
+    Presenter();
+
+    // Colors as 0xRRGGBB: with two colors any lit pixel is on, otherwise
+    // second is plane 1 alone and both is planes 0 and 1 together
+    void SetPalette(uint32_t off, uint32_t on);
+    void SetPalette(uint32_t off, uint32_t on, uint32_t second, uint32_t both);
+
+    // Share of its brightness a dark pixel keeps per frame, in [0, 1). 0 turns persistence off
+    void SetPersistence(double kept);
+    bool Persistent() const { return fade != 0; }
+
+    // Host pixels per high resolution pixel
+    void SetScale(unsigned int scale);
+    unsigned int Scale() const { return scale; }
+    unsigned int Width() const;
+    unsigned int Height() const;
+
+    // Output rows per display row in either resolution
+    unsigned int RowHeight(bool hires) const { return hires ? scale : 2 * scale; }
+
+    // Renders display rows [top, bottom) of the given resolution into pixels,
+    // which points at output row top * RowHeight(hires); pitch is in bytes
+    void Render(DisplayPlanes const& planes, bool hires, unsigned int top, unsigned int bottom, void* pixels, size_t pitch);
+
+    // Some pixel is still fading, so the same rows should be rendered again next frame
+    bool Fading() const { return fading; }
+
+private:
+    void ExpandRow(uint64_t const* plane0, uint64_t const* plane1, unsigned int words, uint32_t* out) const;
+    void FadeRow(uint64_t const* plane0, uint64_t const* plane1, unsigned int width, unsigned int pixel, uint32_t* out);
+    void ScaleRow(uint32_t const* line, unsigned int width, unsigned int factor, uint8_t* out, size_t pitch) const;
+    void BuildRamps();
+
+    uint32_t colors[4];         // RGBA8888, by plane bits
+    uint32_t ramps[4][256];     // off..colors[c] by intensity
+    uint8_t fade;               // intensity kept per frame, out of 256
+    uint8_t fadeTable[256];
+    bool fading;
+    bool fadedHires;            // resolution intensity and lastColor belong to
+    unsigned int scale;
+
+    // Per display pixel, row-major in the current resolution
+    uint8_t intensity[HIRES_HEIGHT * HIRES_WIDTH];
+    uint8_t lastColor[HIRES_HEIGHT * HIRES_WIDTH];      // palette index it had when last lit
+};
+
+#endif // PRESENTER_H
@@ -0,0 +1,212 @@
+#include "Profiler.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+    const char* const CLASS_NAMES[Profiler::OPCODE_CLASSES] =
+    {
+        "00E0", "00EE", "1NNN", "2NNN", "3XNN", "4XNN", "5XY0",
+        "6XNN", "7XNN", "8XY0", "8XY1", "8XY2", "8XY3", "8XY4",
+        "8XY5", "8XY6", "8XY7", "8XYE", "9XY0", "ANNN", "BNNN",
+        "CXNN", "DXYN", "EX9E", "EXA1", "FX07", "FX0A", "FX15",
+        "FX18", "FX1E", "FX29", "FX33", "FX55", "FX65", "00CN",
+        "00DN", "00FB", "00FC", "00FD", "00FE", "00FF", "FN01",
+        "FX30", "FX75", "FX85", "NULL"
+    };
+
+    int64_t SteadyNanoseconds()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    double Percent(uint64_t part, uint64_t whole)
+    {
+        return whole ? 100.0 * part / whole : 0.0;
+    }
+}
+
+Profiler::Profiler()
+{
+    Reset();
+}
+
+void Profiler::Reset()
+{
+    memset(opcodes, 0, sizeof(opcodes));
+    memset(pcHits, 0, sizeof(pcHits));
+    memset(pcOpcode, 0, sizeof(pcOpcode));
+    instructions = 0;
+
+    frames = 0;
+    draws = 0;
+    frameInstructions = 0;
+    frameDraws = 0;
+    minFrameInstructions = UINT32_MAX;
+    maxFrameInstructions = 0;
+    minFrameDraws = UINT32_MAX;
+    maxFrameDraws = 0;
+
+    runTicks = 0;
+    drawTicks = 0;
+
+    startTicks = Ticks();
+    startNanoseconds = SteadyNanoseconds();
+}
+
+// Same mapping as CHIP_8::Decode()
+Profiler::OpcodeClass Profiler::Classify(uint16_t opcode)
+{
+    switch (opcode >> 12)
+    {
+    case 0x0:
+        if ((opcode & 0xFFF0) == 0x00C0) return CLASS_00CN;
+        if ((opcode & 0xFFF0) == 0x00D0) return CLASS_00DN;
+        if (opcode == 0x00E0) return CLASS_00E0;
+        if (opcode == 0x00EE) return CLASS_00EE;
+        if (opcode == 0x00FB) return CLASS_00FB;
+        if (opcode == 0x00FC) return CLASS_00FC;
+        if (opcode == 0x00FD) return CLASS_00FD;
+        if (opcode == 0x00FE) return CLASS_00FE;
+        if (opcode == 0x00FF) return CLASS_00FF;
+        break;
+    case 0x1: return CLASS_1NNN;
+    case 0x2: return CLASS_2NNN;
+    case 0x3: return CLASS_3XNN;
+    case 0x4: return CLASS_4XNN;
+    case 0x5: return CLASS_5XY0;
+    case 0x6: return CLASS_6XNN;
+    case 0x7: return CLASS_7XNN;
+    case 0x8:
+        switch (opcode & 0x000F)
+        {
+        case 0x0: return CLASS_8XY0;
+        case 0x1: return CLASS_8XY1;
+        case 0x2: return CLASS_8XY2;
+        case 0x3: return CLASS_8XY3;
+        case 0x4: return CLASS_8XY4;
+        case 0x5: return CLASS_8XY5;
+        case 0x6: return CLASS_8XY6;
+        case 0x7: return CLASS_8XY7;
+        case 0xE: return CLASS_8XYE;
+        }
+        break;
+    case 0x9: return CLASS_9XY0;
+    case 0xA: return CLASS_ANNN;
+    case 0xB: return CLASS_BNNN;
+    case 0xC: return CLASS_CXNN;
+    case 0xD: return CLASS_DXYN;
+    case 0xE:
+        if ((opcode & 0x00FF) == 0x9E) return CLASS_EX9E;
+        if ((opcode & 0x00FF) == 0xA1) return CLASS_EXA1;
+        break;
+    case 0xF:
+        switch (opcode & 0x00FF)
+        {
+        case 0x01: return CLASS_FN01;
+        case 0x07: return CLASS_FX07;
+        case 0x0A: return CLASS_FX0A;
+        case 0x15: return CLASS_FX15;
+        case 0x18: return CLASS_FX18;
+        case 0x1E: return CLASS_FX1E;
+        case 0x29: return CLASS_FX29;
+        case 0x30: return CLASS_FX30;
+        case 0x33: return CLASS_FX33;
+        case 0x55: return CLASS_FX55;
+        case 0x65: return CLASS_FX65;
+        case 0x75: return CLASS_FX75;
+        case 0x85: return CLASS_FX85;
+        }
+        break;
+    }
+    return CLASS_NULL;
+}
+
+char const* Profiler::ClassName(unsigned int opcodeClass)
+{
+    return opcodeClass < OPCODE_CLASSES ? CLASS_NAMES[opcodeClass] : "?";
+}
+
+void Profiler::EndFrame()
+{
+    ++frames;
+    minFrameInstructions = std::min(minFrameInstructions, frameInstructions);
+    maxFrameInstructions = std::max(maxFrameInstructions, frameInstructions);
+    minFrameDraws = std::min(minFrameDraws, frameDraws);
+    maxFrameDraws = std::max(maxFrameDraws, frameDraws);
+    frameInstructions = 0;
+    frameDraws = 0;
+}
+
+double Profiler::TicksToMilliseconds(uint64_t ticks) const
+{
+    uint64_t elapsedTicks = Ticks() - startTicks;
+    int64_t elapsedNanoseconds = SteadyNanoseconds() - startNanoseconds;
+    if (elapsedTicks == 0 || elapsedNanoseconds <= 0)
+    {
+        return 0.0;
+    }
+    return ticks * ((double)elapsedNanoseconds / elapsedTicks) / 1e6;
+}
+
+void Profiler::Dump(std::ostream& out, unsigned int hotAddresses) const
+{
+    char line[160];
+    double runMs = RunMilliseconds();
+    double drawMs = DrawMilliseconds();
+
+    snprintf(line, sizeof(line), "Profile: %llu instructions, %llu frames, %.3f ms in Run()\n",
+             (unsigned long long)instructions, (unsigned long long)frames, runMs);
+    out << line;
+    if (frames)
+    {
+        snprintf(line, sizeof(line), "  per frame: %.1f instructions (%u..%u), %.2f draws (%u..%u)\n",
+                 (double)instructions / frames, MinInstructionsPerFrame(), maxFrameInstructions,
+                 (double)draws / frames, MinDrawsPerFrame(), maxFrameDraws);
+        out << line;
+    }
+    uint64_t dxyn = opcodes[CLASS_DXYN];
+    snprintf(line, sizeof(line), "  DXYN: %llu draws, %.3f ms (%.1f%% of Run), %.1f ns each\n",
+             (unsigned long long)dxyn, drawMs, runMs > 0 ? 100.0 * drawMs / runMs : 0.0, dxyn ? drawMs * 1e6 / dxyn : 0.0);
+    out << line;
+
+    // Instruction classes, most executed first
+    std::vector<unsigned int> order;
+    for (unsigned int c = 0; c < OPCODE_CLASSES; ++c)
+    {
+        if (opcodes[c])
+        {
+            order.push_back(c);
+        }
+    }
+    std::sort(order.begin(), order.end(), [this](unsigned int a, unsigned int b) { return opcodes[a] > opcodes[b]; });
+    out << "  opcodes:\n";
+    for (unsigned int c : order)
+    {
+        snprintf(line, sizeof(line), "    %s %12llu %6.2f%%\n", CLASS_NAMES[c], (unsigned long long)opcodes[c], Percent(opcodes[c], instructions));
+        out << line;
+    }
+
+    // Hottest addresses
+    std::vector<uint16_t> hot;
+    for (uint16_t address = 0; address < 4096; ++address)
+    {
+        if (pcHits[address])
+        {
+            hot.push_back(address);
+        }
+    }
+    size_t shown = std::min<size_t>(hot.size(), hotAddresses);
+    std::partial_sort(hot.begin(), hot.begin() + shown, hot.end(), [this](uint16_t a, uint16_t b) { return pcHits[a] > pcHits[b]; });
+    out << "  hot addresses:\n";
+    for (size_t i = 0; i < shown; ++i)
+    {
+        uint16_t address = hot[i];
+        snprintf(line, sizeof(line), "    0x%03X %04X %s %12llu %6.2f%%\n", address, pcOpcode[address],
+                 CLASS_NAMES[Classify(pcOpcode[address])], (unsigned long long)pcHits[address], Percent(pcHits[address], instructions));
+        out << line;
+    }
+}
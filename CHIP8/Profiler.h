@@ -0,0 +1,124 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <cstdint>
+#include <ostream>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#define CHIP8_PROFILER_TSC 1
+#else
+#include <chrono>
+#define CHIP8_PROFILER_TSC 0
+#endif
+
+/*
+    Execution profile of one machine: how often each instruction class ran,
+    how often each address was executed, instructions and draws per 60 Hz
+    frame, and host time spent inside Run() and inside DXYN.
+
+    Times are kept in host ticks (the TSC on x86, steady_clock nanoseconds
+    elsewhere) and converted to milliseconds against steady_clock when read.
+*/
+class Profiler
+{
+public:
+    // Instruction classes, one per handler family
+    enum OpcodeClass : uint8_t
+    {
+        CLASS_00E0, CLASS_00EE, CLASS_1NNN, CLASS_2NNN, CLASS_3XNN, CLASS_4XNN, CLASS_5XY0,
+        CLASS_6XNN, CLASS_7XNN, CLASS_8XY0, CLASS_8XY1, CLASS_8XY2, CLASS_8XY3, CLASS_8XY4,
+        CLASS_8XY5, CLASS_8XY6, CLASS_8XY7, CLASS_8XYE, CLASS_9XY0, CLASS_ANNN, CLASS_BNNN,
+        CLASS_CXNN, CLASS_DXYN, CLASS_EX9E, CLASS_EXA1, CLASS_FX07, CLASS_FX0A, CLASS_FX15,
+        CLASS_FX18, CLASS_FX1E, CLASS_FX29, CLASS_FX33, CLASS_FX55, CLASS_FX65, CLASS_00CN,
+        CLASS_00DN, CLASS_00FB, CLASS_00FC, CLASS_00FD, CLASS_00FE, CLASS_00FF, CLASS_FN01,
+        CLASS_FX30, CLASS_FX75, CLASS_FX85, CLASS_NULL,
+        OPCODE_CLASSES
+    };
+
+    Profiler();
+
+    void Reset();
+
+    static OpcodeClass Classify(uint16_t opcode);
+    static char const* ClassName(unsigned int opcodeClass);
+
+    // Counters, all since the last Reset()
+    uint64_t Instructions() const { return instructions; }
+    uint64_t Executed(unsigned int opcodeClass) const { return opcodes[opcodeClass % OPCODE_CLASSES]; }
+    uint64_t HitsAt(uint16_t address) const { return pcHits[address & 0x0FFF]; }
+    uint16_t OpcodeAt(uint16_t address) const { return pcOpcode[address & 0x0FFF]; }     // last one executed there
+
+    uint64_t Frames() const { return frames; }
+    uint32_t MinInstructionsPerFrame() const { return frames ? minFrameInstructions : 0; }
+    uint32_t MaxInstructionsPerFrame() const { return maxFrameInstructions; }
+    uint64_t Draws() const { return draws; }                  // 00E0 and DXYN
+    uint32_t MinDrawsPerFrame() const { return frames ? minFrameDraws : 0; }
+    uint32_t MaxDrawsPerFrame() const { return maxFrameDraws; }
+
+    double RunMilliseconds() const { return TicksToMilliseconds(runTicks); }
+    double DrawMilliseconds() const { return TicksToMilliseconds(drawTicks); }
+
+    // Human readable report; the hottest addresses are listed
+    void Dump(std::ostream& out, unsigned int hotAddresses = 16) const;
+
+    // Called by the interpreter
+    static uint64_t Ticks();
+    OpcodeClass Count(uint16_t pc, uint16_t opcode);
+    void EndFrame();
+    void AddDrawTicks(uint64_t ticks) { drawTicks += ticks; }
+    void AddRunTicks(uint64_t ticks) { runTicks += ticks; }
+
+private:
+    double TicksToMilliseconds(uint64_t ticks) const;
+
+    uint64_t opcodes[OPCODE_CLASSES];
+    uint64_t pcHits[4096];
+    uint16_t pcOpcode[4096];
+    uint64_t instructions;
+
+    uint64_t frames;
+    uint64_t draws;
+    uint32_t frameInstructions;     // in the frame now running
+    uint32_t frameDraws;
+    uint32_t minFrameInstructions, maxFrameInstructions;
+    uint32_t minFrameDraws, maxFrameDraws;
+
+    uint64_t runTicks;
+    uint64_t drawTicks;
+
+    // Tick rate calibration, taken at Reset()
+    uint64_t startTicks;
+    int64_t startNanoseconds;
+};
+
+inline uint64_t Profiler::Ticks()
+{
+#if CHIP8_PROFILER_TSC
+    return __rdtsc();
+#else
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+inline Profiler::OpcodeClass Profiler::Count(uint16_t pc, uint16_t opcode)
+{
+    OpcodeClass kind = Classify(opcode);
+    ++opcodes[kind];
+    ++pcHits[pc & 0x0FFF];
+    pcOpcode[pc & 0x0FFF] = opcode;
+    ++instructions;
+    ++frameInstructions;
+    if (kind == CLASS_DXYN || kind == CLASS_00E0)
+    {
+        ++frameDraws;
+        ++draws;
+    }
+    return kind;
+}
+
+#endif // PROFILER_H
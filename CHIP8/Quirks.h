@@ -0,0 +1,72 @@
+#ifndef QUIRKS_H
+#define QUIRKS_H
+
+#include <cstdint>
+#include <string>
+
+/*
+    Interpreter behavior that differs between CHIP-8 platforms. A profile is
+    a compile-time constant: CHIP_8 builds one dispatch table per profile,
+    with the affected handlers specialized for it, so selecting a profile
+    costs nothing per instruction.
+*/
+enum QuirkProfile : uint8_t
+{
+    QUIRKS_VIP,         // COSMAC VIP, the original interpreter
+    QUIRKS_CHIP48,      // CHIP-48 on the HP-48
+    QUIRKS_SCHIP,       // SUPER-CHIP 1.1
+    QUIRKS_MODERN,      // XO-CHIP and most current interpreters
+    QUIRKS_CLASSIC,     // Cowgod's reference, as this emulator ran before profiles
+    QUIRK_PROFILES
+};
+
+// What FX55/FX65 leave in I
+enum IndexAdvance : uint8_t
+{
+    INDEX_KEPT,         // unchanged
+    INDEX_PLUS_X,       // I + X
+    INDEX_PLUS_X_1      // I + X + 1, just past the last register
+};
+
+struct QuirkSet
+{
+    bool shiftReadsVy;          // 8XY6/8XYE shift Vy into Vx, instead of Vx in place
+    IndexAdvance loadStoreIndex;
+    bool wrapSprites;           // DXYN wraps at the right and bottom edges instead of clipping
+    bool jumpUsesVx;            // BXNN jumps to XNN + VX instead of NNN + V0
+    bool logicResetsVF;         // 8XY1/8XY2/8XY3 clear VF
+};
+
+constexpr QuirkSet QUIRK_SETS[QUIRK_PROFILES] =
+{
+    { true,  INDEX_PLUS_X_1, false, false, true  },     // QUIRKS_VIP
+    { false, INDEX_PLUS_X,   false, true,  false },     // QUIRKS_CHIP48
+    { false, INDEX_KEPT,     false, true,  false },     // QUIRKS_SCHIP
+    { true,  INDEX_PLUS_X_1, true,  false, false },     // QUIRKS_MODERN
+    { false, INDEX_KEPT,     false, false, false },     // QUIRKS_CLASSIC
+};
+
+// SUPER-CHIP behavior except for BNNN, which keeps jumping to NNN + V0
+const QuirkProfile DEFAULT_QUIRKS = QUIRKS_CLASSIC;
+
+inline char const* QuirkProfileName(QuirkProfile profile)
+{
+    static char const* const NAMES[QUIRK_PROFILES] = { "vip", "chip48", "schip", "modern", "classic" };
+    return profile < QUIRK_PROFILES ? NAMES[profile] : "?";
+}
+
+// False if name is not one of QuirkProfileName()'s
+inline bool FindQuirkProfile(std::string const& name, QuirkProfile& profile)
+{
+    for (uint8_t p = 0; p < QUIRK_PROFILES; ++p)
+    {
+        if (name == QuirkProfileName((QuirkProfile)p))
+        {
+            profile = (QuirkProfile)p;
+            return true;
+        }
+    }
+    return false;
+}
+
+#endif // QUIRKS_H
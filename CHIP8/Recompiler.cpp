@@ -0,0 +1,660 @@
+#include "Recompiler.h"
+#include "CHIP_8.h"
+#include <cstring>
+
+#if CHIP8_HAS_RECOMPILER
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#endif
+
+#if CHIP8_HAS_RECOMPILER
+namespace
+{
+    // x86-64 register numbers
+    enum HostReg : uint8_t
+    {
+        RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7,
+        R8 = 8, R9, R10, R11, R12, R13, R14, R15
+    };
+
+    // Condition codes for SETcc / CMOVcc
+    enum Cond : uint8_t
+    {
+        CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5
+    };
+
+    // Host registers handed out to V registers, callee-saved ones last
+    const uint8_t V_POOL[] = { R8, R9, R10, R11, RBX, RBP, R12, R13, R14, R15 };
+    const uint8_t V_POOL_SIZE = sizeof(V_POOL);
+
+    const size_t MAX_BLOCK_BYTES = 4096;
+
+    bool IsCalleeSaved(uint8_t reg)
+    {
+        return reg == RBX || reg == RBP || reg >= R12;
+    }
+
+    /*
+        Just enough of an assembler for the block translator. RDI always holds
+        the CHIP_8 pointer, so every state access is [rdi + disp32].
+    */
+    class Emitter
+    {
+    public:
+        Emitter(uint8_t* out) : start(out), p(out) {}
+
+        size_t Size() const { return p - start; }
+
+        void Byte(uint8_t b) { *p++ = b; }
+        void Word(uint16_t w) { memcpy(p, &w, 2); p += 2; }
+        void Dword(uint32_t d) { memcpy(p, &d, 4); p += 4; }
+
+        // REX prefix, always emitted for byte registers so 4-7 mean spl..dil
+        void Rex(uint8_t reg, uint8_t rm) { Byte(0x40 | ((reg >> 3) << 2) | (rm >> 3)); }
+
+        // op r/m8, r8 between two registers (add, or, and, xor, sub, cmp, mov)
+        void Op8(uint8_t opcode, uint8_t dst, uint8_t src)
+        {
+            Rex(src, dst);
+            Byte(opcode);
+            Byte(0xC0 | ((src & 7) << 3) | (dst & 7));
+        }
+
+        // 80 /ext r/m8, imm8 (add, and, cmp)
+        void Op8Imm(uint8_t ext, uint8_t dst, uint8_t imm)
+        {
+            Rex(0, dst);
+            Byte(0x80);
+            Byte(0xC0 | (ext << 3) | (dst & 7));
+            Byte(imm);
+        }
+
+        void MovImm8(uint8_t dst, uint8_t imm)
+        {
+            Rex(0, dst);
+            Byte(0xB0 | (dst & 7));
+            Byte(imm);
+        }
+
+        // D0 /ext r/m8, 1 (shl = 4, shr = 5)
+        void Shift8(uint8_t ext, uint8_t dst)
+        {
+            Rex(0, dst);
+            Byte(0xD0);
+            Byte(0xC0 | (ext << 3) | (dst & 7));
+        }
+
+        void SetCC(uint8_t cc, uint8_t dst)
+        {
+            Rex(0, dst);
+            Byte(0x0F);
+            Byte(0x90 | cc);
+            Byte(0xC0 | (dst & 7));
+        }
+
+        void LoadByte(uint8_t dst, int32_t disp)
+        {
+            Rex(dst, RDI);
+            Byte(0x8A);
+            Mem(dst, disp);
+        }
+
+        void StoreByte(int32_t disp, uint8_t src)
+        {
+            Rex(src, RDI);
+            Byte(0x88);
+            Mem(src, disp);
+        }
+
+        // movzx r32, r8
+        void ZeroExtend8(uint8_t dst, uint8_t src)
+        {
+            Rex(dst, src);
+            Byte(0x0F);
+            Byte(0xB6);
+            Byte(0xC0 | ((dst & 7) << 3) | (src & 7));
+        }
+
+        // movzx r32, byte/word [rdi + disp32], for the low eight registers
+        void LoadZeroExtend8(uint8_t dst, int32_t disp) { Byte(0x0F); Byte(0xB6); Mem(dst, disp); }
+        void LoadZeroExtend16(uint8_t dst, int32_t disp) { Byte(0x0F); Byte(0xB7); Mem(dst, disp); }
+
+        // mov word [rdi + disp32], r16 / imm16
+        void StoreWord(int32_t disp, uint8_t src) { Byte(0x66); Byte(0x89); Mem(src, disp); }
+        void StoreWordImm(int32_t disp, uint16_t imm) { Byte(0x66); Byte(0xC7); Mem(0, disp); Word(imm); }
+
+        // Stack access, [rdi + rax * 2 + disp32]
+        void StoreStackImm(int32_t disp, uint16_t imm)
+        {
+            Byte(0x66); Byte(0xC7); Byte(0x84); Byte(0x47); Dword(disp); Word(imm);
+        }
+        void LoadStack(uint8_t dst, int32_t disp)
+        {
+            Byte(0x0F); Byte(0xB7); Byte(0x84 | (dst << 3)); Byte(0x47); Dword(disp);
+        }
+
+        // inc / dec byte [rdi + disp32]
+        void IncByte(int32_t disp) { Byte(0xFE); Mem(0, disp); }
+        void DecByte(int32_t disp) { Byte(0xFE); Mem(1, disp); }
+
+        void MovImm32(uint8_t dst, uint32_t imm) { Byte(0xB8 | dst); Dword(imm); }
+        void AddImm32(uint8_t dst, uint32_t imm) { Byte(0x81); Byte(0xC0 | dst); Dword(imm); }
+        void AndImm8(uint8_t dst, uint8_t imm) { Byte(0x83); Byte(0xE0 | dst); Byte(imm); }
+        void Add32(uint8_t dst, uint8_t src) { Byte(0x01); Byte(0xC0 | (src << 3) | dst); }
+        void ZeroExtend16(uint8_t reg) { Byte(0x0F); Byte(0xB7); Byte(0xC0 | (reg << 3) | reg); }
+        void Cmov(uint8_t cc, uint8_t dst, uint8_t src) { Byte(0x0F); Byte(0x40 | cc); Byte(0xC0 | (dst << 3) | src); }
+
+        // lea esi, [rax + rax * 4 + disp8]
+        void LeaTimes5(uint8_t dst, uint8_t disp)
+        {
+            Byte(0x8D); Byte(0x44 | (dst << 3)); Byte(0x80); Byte(disp);
+        }
+
+        void Push(uint8_t reg) { if (reg >= 8) Byte(0x41); Byte(0x50 | (reg & 7)); }
+        void Pop(uint8_t reg) { if (reg >= 8) Byte(0x41); Byte(0x58 | (reg & 7)); }
+        void Mov64(uint8_t dst, uint8_t src) { Byte(0x48 | ((src >> 3) << 2) | (dst >> 3)); Byte(0x89); Byte(0xC0 | ((src & 7) << 3) | (dst & 7)); }
+        void Ret() { Byte(0xC3); }
+
+    private:
+        void Mem(uint8_t reg, int32_t disp)
+        {
+            Byte(0x80 | ((reg & 7) << 3) | RDI);
+            Dword((uint32_t)disp);
+        }
+
+        uint8_t* start;
+        uint8_t* p;
+    };
+
+    // What a guest instruction needs from the translator
+    enum OpKind : uint8_t
+    {
+        OP_UNSUPPORTED,
+        OP_STRAIGHT,        // falls through to the next instruction
+        OP_END              // control transfer, ends the block
+    };
+
+    uint8_t Classify(uint16_t opcode)
+    {
+        switch (opcode >> 12)
+        {
+        case 0x0: return opcode == 0x00EE ? OP_END : OP_UNSUPPORTED;
+        case 0x1: case 0x2: case 0x3: case 0x4: case 0x5: case 0x9: case 0xB:
+            return OP_END;
+        case 0x6: case 0x7: case 0xA:
+            return OP_STRAIGHT;
+        case 0x8:
+            switch (opcode & 0xF)
+            {
+            case 0x0: case 0x1: case 0x2: case 0x3: case 0x4:
+            case 0x5: case 0x6: case 0x7: case 0xE:
+                return OP_STRAIGHT;
+            }
+            return OP_UNSUPPORTED;
+        case 0xF:
+            switch (opcode & 0xFF)
+            {
+            case 0x07: case 0x15: case 0x1E: case 0x29:
+                return OP_STRAIGHT;
+            }
+            return OP_UNSUPPORTED;
+        }
+        return OP_UNSUPPORTED;
+    }
+
+    // V registers an instruction reads or writes under the given quirks, as a bit mask
+    uint16_t RegistersUsed(uint16_t opcode, QuirkSet const& quirks)
+    {
+        uint16_t x = 1u << ((opcode >> 8) & 0xF);
+        uint16_t y = 1u << ((opcode >> 4) & 0xF);
+        switch (opcode >> 12)
+        {
+        case 0x3: case 0x4: case 0x6: case 0x7: return x;
+        case 0x5: case 0x9: return x | y;
+        case 0x8:
+            if ((opcode & 0xF) == 0x0 || ((opcode & 0xF) <= 0x3 && !quirks.logicResetsVF))
+            {
+                return x | y;
+            }
+            return x | y | 0x8000;
+        case 0xB: return quirks.jumpUsesVx ? x : 0x0001;
+        case 0xF: return x;
+        }
+        return 0;
+    }
+}
+#endif
+
+Recompiler::Recompiler(CHIP_8& chip8)
+    : chip8(chip8), codeBase(nullptr), codeUsed(0)
+{
+    memset(blocks, 0, sizeof(blocks));
+    memset(heat, 0, sizeof(heat));
+    memset(covered, 0, sizeof(covered));
+    memset(&stats, 0, sizeof(stats));
+
+    untranslatable = RecompiledBlock{ nullptr, 0, 0, UINT32_MAX, false, false };
+    pool.reserve(MAX_BLOCKS);
+
+#if CHIP8_HAS_RECOMPILER
+#ifdef _WIN32
+    codeBase = (uint8_t*)VirtualAlloc(nullptr, CODE_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+    void* code = mmap(nullptr, CODE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    codeBase = code == MAP_FAILED ? nullptr : (uint8_t*)code;
+#endif
+    if (codeBase && !MakeWritable(false))
+    {
+        ReleaseCode();
+    }
+#endif
+}
+
+Recompiler::~Recompiler()
+{
+    ReleaseCode();
+}
+
+void Recompiler::ReleaseCode()
+{
+#if CHIP8_HAS_RECOMPILER
+    if (codeBase)
+    {
+#ifdef _WIN32
+        VirtualFree(codeBase, 0, MEM_RELEASE);
+#else
+        munmap(codeBase, CODE_SIZE);
+#endif
+    }
+#endif
+    codeBase = nullptr;
+}
+
+bool Recompiler::MakeWritable(bool writable)
+{
+#if CHIP8_HAS_RECOMPILER
+#ifdef _WIN32
+    DWORD old;
+    return VirtualProtect(codeBase, CODE_SIZE, writable ? PAGE_READWRITE : PAGE_EXECUTE_READ, &old) != 0;
+#else
+    return mprotect(codeBase, CODE_SIZE, writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC) == 0;
+#endif
+#else
+    (void)writable;
+    return false;
+#endif
+}
+
+void Recompiler::Flush()
+{
+    memset(blocks, 0, sizeof(blocks));
+    memset(heat, 0, sizeof(heat));
+    memset(covered, 0, sizeof(covered));
+    pool.clear();
+    codeUsed = 0;
+    ++stats.flushes;
+}
+
+void Recompiler::Drop(RecompiledBlock* block)
+{
+    block->live = false;
+    blocks[block->start] = nullptr;
+    heat[block->start] = 0;
+    for (uint32_t address = block->start; address < block->end; ++address)
+    {
+        --covered[address & 0x0FFF];
+    }
+    ++stats.blocksInvalidated;
+}
+
+void Recompiler::Invalidate(uint16_t address, uint16_t length)
+{
+    bool hit = false;
+    for (uint32_t i = 0; i < length && !hit; ++i)
+    {
+        hit = covered[(address + i) & 0x0FFF] != 0;
+    }
+    if (!hit)
+    {
+        return;
+    }
+
+    uint32_t first = address & 0x0FFF;
+    uint32_t last = first + length;
+    for (RecompiledBlock& block : pool)
+    {
+        if (!block.live)
+        {
+            continue;
+        }
+        // Written range may wrap around the end of Memory
+        bool overlaps = block.start < last && block.end > first;
+        if (last > 0x1000)
+        {
+            overlaps = overlaps || block.start < last - 0x1000;
+        }
+        if (overlaps)
+        {
+            Drop(&block);
+        }
+    }
+}
+
+void Recompiler::Reject(RecompiledBlock* block)
+{
+    uint16_t start = block->start;
+    Drop(block);
+    blocks[start] = &untranslatable;
+    ++stats.verifyFailures;
+}
+
+RecompiledBlock* Recompiler::Compile(uint16_t pc)
+{
+#if CHIP8_HAS_RECOMPILER
+    if (!codeBase)
+    {
+        return blocks[pc] = &untranslatable;
+    }
+
+    // Translated for the machine's profile; SetQuirks() drops every block
+    QuirkSet const& quirks = QUIRK_SETS[chip8.quirks];
+
+    // Scan the block: straight-line instructions, then at most one transfer
+    uint16_t opcodes[MAX_BLOCK_INSTRUCTIONS];
+    uint32_t count = 0;
+    uint16_t usedMask = 0;
+
+    uint32_t address = pc;
+
+    while (count < MAX_BLOCK_INSTRUCTIONS && address + 1 < 0x1000)
+    {
+        uint16_t opcode = (chip8.Memory[address] << 8u) | chip8.Memory[address + 1];
+        uint8_t kind = Classify(opcode);
+        if (kind == OP_UNSUPPORTED)
+        {
+            break;
+        }
+        // The interpreter runs short backward jumps, so CHIP_8 can skip idle loops
+        if ((opcode >> 12) == 0x1 && CHIP_8::ClosesLoop((uint16_t)address, opcode & 0x0FFF))
+        {
+            break;
+        }
+
+        uint16_t used = usedMask | RegistersUsed(opcode, quirks);
+        int usedAfter = 0;
+        for (uint16_t m = used; m; m &= m - 1)
+        {
+            ++usedAfter;
+        }
+        if (usedAfter > V_POOL_SIZE)
+        {
+            break;
+        }
+        usedMask = used;
+
+        opcodes[count++] = opcode;
+        address += 2;
+        if (kind == OP_END)
+        {
+            break;
+        }
+    }
+
+    if (count == 0 || pool.size() == MAX_BLOCKS)
+    {
+        if (count != 0)
+        {
+            Flush();
+            return nullptr;
+        }
+        return blocks[pc] = &untranslatable;
+    }
+    if (codeUsed + MAX_BLOCK_BYTES > CODE_SIZE)
+    {
+        Flush();
+        return nullptr;
+    }
+    if (!MakeWritable(true))
+    {
+        return blocks[pc] = &untranslatable;
+    }
+
+    // Offsets of the machine state from the CHIP_8 pointer held in RDI
+    const uint8_t* base = (const uint8_t*)&chip8;
+    const int32_t offV = (int32_t)((const uint8_t*)chip8.V0VF_Registers - base);
+    const int32_t offI = (int32_t)((const uint8_t*)&chip8.Index_REG - base);
+    const int32_t offPC = (int32_t)((const uint8_t*)&chip8.PC - base);
+    const int32_t offSP = (int32_t)((const uint8_t*)&chip8.SP - base);
+    const int32_t offStack = (int32_t)((const uint8_t*)chip8.Stack - base);
+    const int32_t offDT = (int32_t)((const uint8_t*)&chip8.Delay_Timer - base);
+
+    // Assign host registers
+    uint8_t host[16];
+    uint8_t saved[V_POOL_SIZE];
+    int savedCount = 0;
+    {
+        int next = 0;
+        for (uint8_t v = 0; v < 16; ++v)
+        {
+            if (usedMask & (1u << v))
+            {
+                host[v] = V_POOL[next++];
+                if (IsCalleeSaved(host[v]))
+                {
+                    saved[savedCount++] = host[v];
+                }
+            }
+        }
+    }
+
+    bool usesI = false;
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        uint8_t n = opcodes[i] >> 12;
+        uint8_t NN = opcodes[i] & 0xFF;
+        if (n == 0xA || (n == 0xF && (NN == 0x1E || NN == 0x29)))
+        {
+            usesI = true;
+        }
+    }
+
+    uint8_t* code = codeBase + codeUsed;
+    Emitter e(code);
+
+    // Prologue
+#ifdef _WIN32
+    e.Push(RDI);
+    e.Push(RSI);
+    e.Mov64(RDI, RCX);
+#endif
+    for (int i = 0; i < savedCount; ++i)
+    {
+        e.Push(saved[i]);
+    }
+    for (uint8_t v = 0; v < 16; ++v)
+    {
+        if (usedMask & (1u << v))
+        {
+            e.LoadByte(host[v], offV + v);
+        }
+    }
+    if (usesI)
+    {
+        e.LoadZeroExtend16(RSI, offI);
+    }
+
+    // Body. PC is tracked here and only materialized on exit.
+    uint16_t guestPC = pc;
+    bool pcInRax = false;
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        uint16_t opcode = opcodes[i];
+        uint8_t X = (opcode >> 8) & 0xF;
+        uint8_t Y = (opcode >> 4) & 0xF;
+        uint8_t NN = opcode & 0xFF;
+        uint16_t NNN = opcode & 0x0FFF;
+        uint16_t next = (uint16_t)(guestPC + 2);
+
+        switch (opcode >> 12)
+        {
+        case 0x0:   // 00EE
+            e.DecByte(offSP);
+            e.LoadZeroExtend8(RAX, offSP);
+            e.AndImm8(RAX, 0x0F);
+            e.LoadStack(RAX, offStack);
+            pcInRax = true;
+            break;
+        case 0x1:
+            next = NNN;
+            break;
+        case 0x2:
+            e.LoadZeroExtend8(RAX, offSP);
+            e.AndImm8(RAX, 0x0F);
+            e.StoreStackImm(offStack, next);
+            e.IncByte(offSP);
+            next = NNN;
+            break;
+        case 0x3: case 0x4: case 0x5: case 0x9:
+            if ((opcode >> 12) == 0x3 || (opcode >> 12) == 0x4)
+            {
+                e.Op8Imm(7, host[X], NN);
+            }
+            else
+            {
+                e.Op8(0x38, host[X], host[Y]);
+            }
+            e.MovImm32(RAX, next);
+            e.MovImm32(RCX, (uint16_t)(next + 2));
+            e.Cmov(((opcode >> 12) == 0x3 || (opcode >> 12) == 0x5) ? CC_E : CC_NE, RAX, RCX);
+            pcInRax = true;
+            break;
+        case 0x6:
+            e.MovImm8(host[X], NN);
+            break;
+        case 0x7:
+            e.Op8Imm(0, host[X], NN);
+            break;
+        case 0x8:
+            switch (opcode & 0xF)
+            {
+            case 0x0: e.Op8(0x88, host[X], host[Y]); break;
+            case 0x1: case 0x2: case 0x3:
+                e.Op8((opcode & 0xF) == 0x1 ? 0x08 : ((opcode & 0xF) == 0x2 ? 0x20 : 0x30), host[X], host[Y]);
+                if (quirks.logicResetsVF)
+                {
+                    e.MovImm8(host[0xF], 0);
+                }
+                break;
+            case 0x4:
+                // sum from the old values, VF first, then Vx
+                e.Op8(0x88, RAX, host[X]);
+                e.Op8(0x00, RAX, host[Y]);
+                e.SetCC(CC_B, RCX);
+                e.Op8(0x88, host[0xF], RCX);
+                e.Op8(0x88, host[X], RAX);
+                break;
+            case 0x5:
+                e.Op8(0x38, host[X], host[Y]);
+                e.SetCC(CC_AE, RAX);
+                e.Op8(0x88, host[0xF], RAX);
+                e.Op8(0x28, host[X], host[Y]);
+                break;
+            case 0x6: case 0xE:
+                // the bit shifted out lands in CF; VF first, then Vx
+                e.Op8(0x88, RCX, host[quirks.shiftReadsVy ? Y : X]);
+                e.Shift8((opcode & 0xF) == 0x6 ? 5 : 4, RCX);
+                e.SetCC(CC_B, RAX);
+                e.Op8(0x88, host[0xF], RAX);
+                e.Op8(0x88, host[X], RCX);
+                break;
+            case 0x7:
+                // difference from the old values, VF first, then Vx
+                e.Op8(0x88, RAX, host[Y]);
+                e.Op8(0x28, RAX, host[X]);
+                e.SetCC(CC_AE, RCX);
+                e.Op8(0x88, host[0xF], RCX);
+                e.Op8(0x88, host[X], RAX);
+                break;
+            }
+            break;
+        case 0xA:
+            e.MovImm32(RSI, NNN);
+            break;
+        case 0xB:
+            e.ZeroExtend8(RAX, host[quirks.jumpUsesVx ? X : 0]);
+            e.AddImm32(RAX, NNN);
+            pcInRax = true;
+            break;
+        case 0xF:
+            switch (NN)
+            {
+            case 0x07:
+                e.LoadByte(host[X], offDT);
+                break;
+            case 0x15:
+                e.StoreByte(offDT, host[X]);
+                break;
+            case 0x1E:
+                e.ZeroExtend8(RAX, host[X]);
+                e.Add32(RSI, RAX);
+                e.ZeroExtend16(RSI);
+                break;
+            case 0x29:
+                e.ZeroExtend8(RAX, host[X]);
+                e.LeaTimes5(RSI, 0x50);
+                break;
+            }
+            break;
+        }
+        guestPC = next;
+    }
+
+    // Epilogue: write back the registers, then the next PC
+    for (uint8_t v = 0; v < 16; ++v)
+    {
+        if (usedMask & (1u << v))
+        {
+            e.StoreByte(offV + v, host[v]);
+        }
+    }
+    if (usesI)
+    {
+        e.StoreWord(offI, RSI);
+    }
+    if (pcInRax)
+    {
+        e.StoreWord(offPC, RAX);
+    }
+    else
+    {
+        e.StoreWordImm(offPC, guestPC);
+    }
+    for (int i = savedCount - 1; i >= 0; --i)
+    {
+        e.Pop(saved[i]);
+    }
+#ifdef _WIN32
+    e.Pop(RSI);
+    e.Pop(RDI);
+#endif
+    e.Ret();
+
+    codeUsed += (e.Size() + 15) & ~(size_t)15;
+    MakeWritable(false);
+
+    pool.push_back(RecompiledBlock{ (void (*)(CHIP_8*))code, pc, (uint16_t)address, count, true, true });
+    RecompiledBlock* block = &pool.back();
+    for (uint32_t a = pc; a < address; ++a)
+    {
+        ++covered[a];
+    }
+    ++stats.blocksCompiled;
+    stats.instructionsTranslated += count;
+    return blocks[pc] = block;
+#else
+    return blocks[pc] = &untranslatable;
+#endif
+}
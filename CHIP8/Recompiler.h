@@ -0,0 +1,112 @@
+#ifndef RECOMPILER_H
+#define RECOMPILER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define CHIP8_HAS_RECOMPILER 1
+#else
+#define CHIP8_HAS_RECOMPILER 0
+#endif
+
+class CHIP_8;
+
+/*
+    A translated basic block. Running it retires exactly count instructions
+    and leaves PC pointing at the next guest instruction.
+*/
+struct RecompiledBlock
+{
+    void (*code)(CHIP_8*);
+    uint16_t start;             // guest address of the first instruction
+    uint16_t end;               // one past the last guest byte
+    uint32_t count;             // instructions retired per execution
+    bool unverified;            // not yet checked against the interpreter
+    bool live;                  // false once invalidated
+};
+
+struct RecompilerStats
+{
+    uint64_t blocksCompiled;
+    uint64_t instructionsTranslated;
+    uint64_t blocksInvalidated;
+    uint64_t flushes;
+    uint64_t verifyFailures;
+};
+
+/*
+    x86-64 dynamic recompiler for hot basic blocks.
+
+    A block runs from its start address up to and including the first
+    control transfer (1NNN, 2NNN, 00EE, BNNN or a skip), or up to but not
+    including the first instruction it cannot translate (DXYN, FX0A, anything
+    that writes Memory, ...), which the interpreter then executes. V registers
+    used by a block live in host registers for its whole run, I is kept in
+    ESI and PC is a constant folded into the exit path.
+*/
+class Recompiler
+{
+public:
+    Recompiler(CHIP_8& chip8);
+    ~Recompiler();
+
+    // False on hosts without an x86-64 backend or executable memory
+    bool Ready() const { return codeBase != nullptr; }
+
+    // Block starting at pc, compiling it once it has become hot. Returns
+    // nullptr while cold or when pc cannot start a block.
+    RecompiledBlock* Lookup(uint16_t pc);
+
+    // Memory in [address, address + length) was written
+    void Invalidate(uint16_t address, uint16_t length);
+
+    // The block disagreed with the interpreter, never translate pc again
+    void Reject(RecompiledBlock* block);
+
+    void Flush();
+
+    const RecompilerStats& Stats() const { return stats; }
+
+private:
+    static const uint8_t HOT_THRESHOLD = 8;
+    static const uint32_t MAX_BLOCK_INSTRUCTIONS = 64;
+    static const size_t CODE_SIZE = 256 * 1024;
+    static const size_t MAX_BLOCKS = 4096;
+
+    RecompiledBlock* Compile(uint16_t pc);
+    void Drop(RecompiledBlock* block);
+    bool MakeWritable(bool writable);
+    void ReleaseCode();
+
+    CHIP_8& chip8;
+
+    RecompiledBlock* blocks[4096];
+    uint8_t heat[4096];
+    uint16_t covered[4096];                 // live blocks containing each byte
+
+    std::vector<RecompiledBlock> pool;      // reserved up front, never reallocates
+    RecompiledBlock untranslatable;
+
+    uint8_t* codeBase;
+    size_t codeUsed;
+
+    RecompilerStats stats;
+};
+
+inline RecompiledBlock* Recompiler::Lookup(uint16_t pc)
+{
+    if (pc >= 0x1000)
+    {
+        return nullptr;
+    }
+    RecompiledBlock* block = blocks[pc];
+    if (block == nullptr && ++heat[pc] >= HOT_THRESHOLD)
+    {
+        block = Compile(pc);
+    }
+    return block;
+}
+
+#endif // RECOMPILER_H
@@ -0,0 +1,266 @@
+#include "Rewind.h"
+#include <cstring>
+#include <utility>
+
+namespace
+{
+    // Every record is assumed to take at least this much of the ring
+    const size_t MIN_AVERAGE_RECORD = 32;
+
+    const size_t STATE_SIZE = sizeof(MachineState);
+
+    inline uint8_t* PutVarint(uint8_t* out, size_t value)
+    {
+        while (value >= 0x80)
+        {
+            *out++ = (uint8_t)(value | 0x80);
+            value >>= 7;
+        }
+        *out++ = (uint8_t)value;
+        return out;
+    }
+
+    inline const uint8_t* GetVarint(const uint8_t* in, size_t& value)
+    {
+        value = 0;
+        for (unsigned int shift = 0; ; shift += 7)
+        {
+            uint8_t b = *in++;
+            value |= (size_t)(b & 0x7F) << shift;
+            if (!(b & 0x80))
+            {
+                return in;
+            }
+        }
+    }
+
+    // Length of the run of equal bytes at the start of a and b
+    inline size_t SameRun(const uint8_t* a, const uint8_t* b, size_t length)
+    {
+        size_t i = 0;
+        while (i + 8 <= length)
+        {
+            uint64_t wa, wb;
+            memcpy(&wa, a + i, 8);
+            memcpy(&wb, b + i, 8);
+            if (wa != wb)
+            {
+                break;
+            }
+            i += 8;
+        }
+        while (i < length && a[i] == b[i])
+        {
+            ++i;
+        }
+        return i;
+    }
+}
+
+RewindBuffer::RewindBuffer(size_t capacityBytes, uint32_t interval)
+    : ring(capacityBytes), ringHead(0), ringUsed(0),
+      records(capacityBytes / MIN_AVERAGE_RECORD + 1), first(0), count(0),
+      keyframeInterval(interval ? interval : 1), sinceKeyframe(0),
+      previous(new Snapshot()), current(new Snapshot()),
+      encoded(2 * STATE_SIZE + 16), zeros(STATE_SIZE), stats()
+{
+}
+
+void RewindBuffer::Clear()
+{
+    ringHead = 0;
+    ringUsed = 0;
+    first = 0;
+    count = 0;
+    sinceKeyframe = 0;
+    stats.bytesUsed = 0;
+}
+
+/*
+    A record is a list of (unchanged run, changed run, changed bytes) with
+    both run lengths as varints. The changed bytes are a ^ b, so decoding
+    XORs them back into whichever side is known.
+*/
+size_t RewindBuffer::Encode(const uint8_t* a, const uint8_t* b, size_t length, uint8_t* out)
+{
+    uint8_t* start = out;
+    size_t i = 0;
+    while (i < length)
+    {
+        size_t same = SameRun(a + i, b + i, length - i);
+        i += same;
+        if (i == length)
+        {
+            break;      // a trailing unchanged run is implied
+        }
+
+        // A single unchanged byte costs less inside a literal than as a new run
+        size_t literal = i;
+        while (literal < length && (a[literal] != b[literal] || (literal + 1 < length && a[literal + 1] != b[literal + 1])))
+        {
+            ++literal;
+        }
+        out = PutVarint(out, same);
+        out = PutVarint(out, literal - i);
+        for (; i < literal; ++i)
+        {
+            *out++ = a[i] ^ b[i];
+        }
+    }
+    return out - start;
+}
+
+void RewindBuffer::Apply(const uint8_t* in, size_t size, uint8_t* state, size_t length)
+{
+    const uint8_t* end = in + size;
+    size_t position = 0;
+    while (in < end)
+    {
+        size_t same, changed;
+        in = GetVarint(in, same);
+        in = GetVarint(in, changed);
+        position += same;
+        for (size_t i = 0; i < changed && position < length; ++i)
+        {
+            state[position++] ^= *in++;
+        }
+    }
+}
+
+void RewindBuffer::Record(CHIP_8 const& chip8)
+{
+    chip8.SaveState(*current);
+    const uint8_t* now = (const uint8_t*)&current->state;
+
+    bool keyframe = count == 0 || sinceKeyframe + 1 >= keyframeInterval;
+    size_t size = Encode(now, keyframe ? zeros.data() : (const uint8_t*)&previous->state, STATE_SIZE, encoded.data());
+    if (!Append(encoded.data(), (uint32_t)size, keyframe))
+    {
+        // Making room dropped the frames this delta is relative to
+        keyframe = true;
+        size = Encode(now, zeros.data(), STATE_SIZE, encoded.data());
+        Append(encoded.data(), (uint32_t)size, keyframe);
+    }
+
+    sinceKeyframe = keyframe ? 0 : sinceKeyframe + 1;
+    std::swap(previous, current);
+
+    ++stats.recorded;
+    if (keyframe)
+    {
+        ++stats.keyframes;
+    }
+}
+
+bool RewindBuffer::Append(const uint8_t* data, uint32_t size, bool keyframe)
+{
+    if (size > ring.size())
+    {
+        Clear();
+        return true;
+    }
+    while (count > 0 && (ringUsed + size > ring.size() || count == records.size()))
+    {
+        EvictOldest();
+    }
+    if (count == 0 && !keyframe)
+    {
+        return false;
+    }
+
+    // Copy into the ring, wrapping at the end
+    size_t tail = ring.size() - ringHead;
+    if (size <= tail)
+    {
+        memcpy(&ring[ringHead], data, size);
+    }
+    else
+    {
+        memcpy(&ring[ringHead], data, tail);
+        memcpy(&ring[0], data + tail, size - tail);
+    }
+
+    Entry& entry = records[(first + count) % records.size()];
+    entry.offset = ringHead;
+    entry.size = size;
+    entry.keyframe = keyframe;
+    ++count;
+
+    ringHead = (ringHead + size) % ring.size();
+    ringUsed += size;
+    stats.bytesUsed = ringUsed;
+    return true;
+}
+
+// Deltas are useless without the keyframe before them, so they go with it
+void RewindBuffer::EvictOldest()
+{
+    do
+    {
+        ringUsed -= At(0).size;
+        first = (first + 1) % records.size();
+        --count;
+        ++stats.evicted;
+    } while (count > 0 && !At(0).keyframe);
+
+    if (count == 0)
+    {
+        Clear();
+    }
+    stats.bytesUsed = ringUsed;
+}
+
+void RewindBuffer::ReadEntry(Entry const& entry, uint8_t* out) const
+{
+    size_t tail = ring.size() - entry.offset;
+    if (entry.size <= tail)
+    {
+        memcpy(out, &ring[entry.offset], entry.size);
+    }
+    else
+    {
+        memcpy(out, &ring[entry.offset], tail);
+        memcpy(out + tail, &ring[0], entry.size - tail);
+    }
+}
+
+bool RewindBuffer::Rewind(CHIP_8& chip8, uint32_t frames)
+{
+    if (frames >= count)
+    {
+        return false;
+    }
+    uint32_t target = count - 1 - frames;
+
+    // Rebuild the target frame forwards from the keyframe at or before it
+    uint32_t key = target;
+    while (!At(key).keyframe)
+    {
+        --key;
+    }
+    uint8_t* state = (uint8_t*)&current->state;
+    memset(state, 0, STATE_SIZE);
+    for (uint32_t age = key; age <= target; ++age)
+    {
+        ReadEntry(At(age), encoded.data());
+        Apply(encoded.data(), At(age).size, state, STATE_SIZE);
+    }
+
+    // Forget the frames after the target, newest first
+    for (uint32_t dropped = 0; dropped < frames; ++dropped)
+    {
+        Entry& newest = At(count - 1);
+        ringHead = newest.offset;
+        ringUsed -= newest.size;
+        --count;
+    }
+    stats.bytesUsed = ringUsed;
+    sinceKeyframe = target - key;
+
+    current->magic = SNAPSHOT_MAGIC;
+    current->version = SNAPSHOT_VERSION;
+    current->size = (uint32_t)STATE_SIZE;
+    current->reserved = 0;
+    std::swap(previous, current);
+    return chip8.LoadState(*previous);
+}
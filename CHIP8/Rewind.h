@@ -0,0 +1,83 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include "CHIP_8.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+struct RewindStats
+{
+    uint64_t recorded;          // frames recorded since construction
+    uint64_t keyframes;
+    uint64_t evicted;           // records dropped to make room
+    size_t bytesUsed;           // encoded bytes currently held
+};
+
+/*
+    Fixed-size history of machine states, one per frame.
+
+    Every keyframeInterval frames a keyframe is stored, every other frame is
+    stored as the XOR of its state with the previous frame's. Both are run
+    length encoded (runs of unchanged bytes cost a byte or two), so a frame in
+    which only a few registers changed costs a handful of bytes instead of a
+    full Snapshot. Records go into a byte ring allocated up front. When it
+    fills up the oldest keyframe is dropped, together with the deltas that
+    depend on it, so Record() never allocates.
+*/
+class RewindBuffer
+{
+public:
+    RewindBuffer(size_t capacityBytes = 4 * 1024 * 1024, uint32_t keyframeInterval = 60);
+
+    // Call once per frame, after the frame has run
+    void Record(CHIP_8 const& chip8);
+
+    // Restores the machine to the state recorded frames frames before the
+    // newest one and forgets everything newer. False if not that far back.
+    bool Rewind(CHIP_8& chip8, uint32_t frames = 1);
+
+    uint32_t Frames() const { return count; }     // frames that can be restored
+    void Clear();
+
+    const RewindStats& Stats() const { return stats; }
+
+private:
+    struct Entry
+    {
+        size_t offset;          // into ring
+        uint32_t size;
+        bool keyframe;
+    };
+
+    // Run-length encoded a ^ b, returns the encoded size
+    static size_t Encode(const uint8_t* a, const uint8_t* b, size_t length, uint8_t* out);
+    // state ^= decoded delta
+    static void Apply(const uint8_t* in, size_t size, uint8_t* state, size_t length);
+
+    bool Append(const uint8_t* data, uint32_t size, bool keyframe);     // false if a delta lost its keyframe
+    void EvictOldest();
+    void ReadEntry(Entry const& entry, uint8_t* out) const;
+    Entry& At(uint32_t age) { return records[(first + age) % records.size()]; }
+
+    std::vector<uint8_t> ring;
+    size_t ringHead;            // next write offset
+    size_t ringUsed;
+
+    std::vector<Entry> records;
+    uint32_t first;             // index of the oldest record
+    uint32_t count;
+    uint32_t keyframeInterval;
+    uint32_t sinceKeyframe;
+
+    // Scratch space, all sized in the constructor
+    std::unique_ptr<Snapshot> previous;     // newest recorded frame
+    std::unique_ptr<Snapshot> current;
+    std::vector<uint8_t> encoded;
+    std::vector<uint8_t> zeros;
+
+    RewindStats stats;
+};
+
+#endif // REWIND_H
@@ -0,0 +1,217 @@
+#include "RomCatalog.h"
+#include <algorithm>
+#include <filesystem>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    const size_t MAX_ROM_SIZE = 4096 - 0x200;
+
+    // Read-only view of a whole file, unmapped when it goes out of scope
+    class MappedFile
+    {
+    public:
+        MappedFile(char const* filename);
+        ~MappedFile();
+
+        bool IsOpen() const { return opened; }
+        uint8_t const* Data() const { return data; }
+        size_t Size() const { return size; }
+
+    private:
+        MappedFile(MappedFile const&) = delete;
+        MappedFile& operator=(MappedFile const&) = delete;
+
+        bool opened;
+        uint8_t const* data;
+        size_t size;
+#ifdef _WIN32
+        HANDLE file;
+        HANDLE mapping;
+#endif
+    };
+
+#ifdef _WIN32
+    MappedFile::MappedFile(char const* filename)
+        : opened(false), data(nullptr), size(0), file(INVALID_HANDLE_VALUE), mapping(nullptr)
+    {
+        file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        LARGE_INTEGER length;
+        if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &length))
+        {
+            return;
+        }
+        size = (size_t)length.QuadPart;
+        opened = true;
+        if (size == 0)
+        {
+            return;     // an empty file cannot be mapped
+        }
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping)
+        {
+            data = (uint8_t const*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        }
+        opened = data != nullptr;
+    }
+
+    MappedFile::~MappedFile()
+    {
+        if (data)
+        {
+            UnmapViewOfFile(data);
+        }
+        if (mapping)
+        {
+            CloseHandle(mapping);
+        }
+        if (file != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(file);
+        }
+    }
+#else
+    MappedFile::MappedFile(char const* filename)
+        : opened(false), data(nullptr), size(0)
+    {
+        int fd = open(filename, O_RDONLY);
+        if (fd < 0)
+        {
+            return;
+        }
+        struct stat info;
+        if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode))
+        {
+            size = (size_t)info.st_size;
+            opened = true;
+            if (size > 0)
+            {
+                void* view = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+                data = view == MAP_FAILED ? nullptr : (uint8_t const*)view;
+                opened = data != nullptr;
+            }
+        }
+        close(fd);      // the mapping stays valid
+    }
+
+    MappedFile::~MappedFile()
+    {
+        if (data)
+        {
+            munmap((void*)data, size);
+        }
+    }
+#endif
+}
+
+uint64_t RomCatalog::Hash(uint8_t const* data, size_t size)
+{
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= data[i];
+        hash *= 0x100000001B3ull;
+    }
+    return hash;
+}
+
+int RomCatalog::Reject(std::string const& name, char const* reason)
+{
+    rejected.emplace_back(name, reason);
+    return INVALID_ROM;
+}
+
+int RomCatalog::Add(char const* filename)
+{
+    int known = Find(filename);
+    if (known != INVALID_ROM)
+    {
+        return known;
+    }
+
+    MappedFile file(filename);
+    if (!file.IsOpen())
+    {
+        return Reject(filename, "cannot read file");
+    }
+    return Add(filename, file.Data(), file.Size());
+}
+
+int RomCatalog::Add(std::string const& name, uint8_t const* data, size_t size)
+{
+    if (size == 0)
+    {
+        return Reject(name, "empty");
+    }
+    if (size > MAX_ROM_SIZE)
+    {
+        return Reject(name, "larger than 3584 bytes");
+    }
+
+    uint64_t hash = Hash(data, size);
+    auto same = byHash.find(hash);
+    if (same != byHash.end() && roms[same->second].size == size &&
+        std::equal(data, data + size, &images[same->second].Memory[0x200]))
+    {
+        byName.emplace(name, same->second);
+        return same->second;
+    }
+
+    int id = (int)roms.size();
+    images.emplace_back();
+    CHIP_8::PowerOnState(images.back(), data, size);
+    roms.push_back(RomInfo{ name, hash, (uint32_t)size });
+    byName.emplace(name, id);
+    byHash.emplace(hash, id);
+    return id;
+}
+
+size_t RomCatalog::AddDirectory(char const* directory)
+{
+    std::error_code error;
+    std::vector<std::string> files;
+    for (auto const& entry : std::filesystem::directory_iterator(directory, error))
+    {
+        if (entry.is_regular_file(error))
+        {
+            files.push_back(entry.path().string());
+        }
+    }
+    if (error && files.empty())
+    {
+        Reject(directory, "cannot read directory");
+        return 0;
+    }
+
+    // Directory order is unspecified, ids should not be
+    std::sort(files.begin(), files.end());
+    size_t added = 0;
+    for (std::string const& file : files)
+    {
+        if (Add(file.c_str()) != INVALID_ROM)
+        {
+            ++added;
+        }
+    }
+    return added;
+}
+
+int RomCatalog::Find(std::string const& name) const
+{
+    auto found = byName.find(name);
+    return found == byName.end() ? INVALID_ROM : found->second;
+}
+
+int RomCatalog::FindHash(uint64_t hash) const
+{
+    auto found = byHash.find(hash);
+    return found == byHash.end() ? INVALID_ROM : found->second;
+}
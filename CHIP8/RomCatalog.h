@@ -0,0 +1,64 @@
+#ifndef ROM_CATALOG_H
+#define ROM_CATALOG_H
+
+#include "CHIP_8.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct RomInfo
+{
+    std::string name;           // path it was loaded from
+    uint64_t hash;              // FNV-1a of the ROM bytes
+    uint32_t size;
+};
+
+/*
+    Set of ROMs ready to run. Each file is memory mapped once, checked
+    (non-empty and no larger than the 3584 bytes above 0x200) and hashed, and
+    turned into a pristine power-on MachineState with the font and the ROM in
+    place. Reset() then restarts any machine on any catalogued ROM with one
+    bulk copy, no file access and no allocation.
+
+    ROMs with identical contents share one id. A catalog is only read once it
+    is built, so one catalog can serve machines on any number of threads.
+*/
+class RomCatalog
+{
+public:
+    static const int INVALID_ROM = -1;
+
+    // Returns the ROM's id, or INVALID_ROM if it could not be read or is invalid
+    int Add(char const* filename);
+    int Add(std::string const& name, uint8_t const* data, size_t size);
+
+    // Adds every regular file in directory, returns how many were accepted
+    size_t AddDirectory(char const* directory);
+
+    int Find(std::string const& name) const;
+    int FindHash(uint64_t hash) const;
+
+    size_t Size() const { return roms.size(); }
+    RomInfo const& Info(int id) const { return roms[id]; }
+    MachineState const& Image(int id) const { return images[id]; }
+
+    // Files that were rejected, with the reason
+    std::vector<std::pair<std::string, std::string>> const& Rejected() const { return rejected; }
+
+    void Reset(CHIP_8& chip8, int id) const { chip8.Reset(images[id]); }
+
+    static uint64_t Hash(uint8_t const* data, size_t size);
+
+private:
+    int Reject(std::string const& name, char const* reason);
+
+    std::vector<RomInfo> roms;
+    std::vector<MachineState> images;
+    std::unordered_map<std::string, int> byName;
+    std::unordered_map<uint64_t, int> byHash;
+    std::vector<std::pair<std::string, std::string>> rejected;
+};
+
+#endif // ROM_CATALOG_H
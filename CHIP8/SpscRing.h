@@ -0,0 +1,61 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <atomic>
+#include <cstddef>
+
+/*
+    Fixed-size lock-free queue for exactly one producer thread and one
+    consumer thread. N must be a power of two. Push() and Pop() never block
+    and never allocate, so either side may be a real-time thread such as an
+    audio callback.
+*/
+template <typename T, size_t N>
+class SpscRing
+{
+    static_assert(N && (N & (N - 1)) == 0, "SpscRing size must be a power of two");
+
+public:
+    SpscRing() : head(0), tail(0) {}
+
+    // Producer side, false if the ring is full
+    bool Push(T const& item)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) == N)
+        {
+            return false;
+        }
+        items[h & (N - 1)] = item;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side, false if the ring is empty
+    bool Pop(T& item)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+        item = items[t & (N - 1)];
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    static constexpr size_t Capacity() { return N; }
+
+    // Items queued. The consumer may see fewer than there are, the producer more
+    size_t Size() const
+    {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+
+private:
+    T items[N];
+    alignas(64) std::atomic<size_t> head;       // next slot to write, producer owned
+    alignas(64) std::atomic<size_t> tail;       // next slot to read, consumer owned
+};
+
+#endif // SPSC_RING_H
@@ -0,0 +1,56 @@
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <atomic>
+#include <cstdint>
+
+/*
+    Lock-free handoff of the newest value from one producer thread to one
+    consumer thread. The producer fills Back() and publishes it; the consumer
+    picks up whatever was published last and reads it through Front(). Each
+    side owns one buffer and they swap through the third with a single atomic
+    exchange, so neither side ever waits for the other. Values the consumer
+    never picked up are overwritten.
+*/
+template <typename T>
+class TripleBuffer
+{
+public:
+    TripleBuffer() : middle(1), back(0), front(2) {}
+
+    // Producer side
+    T& Back() { return buffers[back]; }
+
+    // Makes Back() the newest value. Returns true if that replaced a value
+    // the consumer never saw, which is then what Back() holds.
+    bool Publish()
+    {
+        uint8_t previous = middle.exchange((uint8_t)(back | FRESH), std::memory_order_acq_rel);
+        back = previous & INDEX;
+        return (previous & FRESH) != 0;
+    }
+
+    // Consumer side: false if nothing new was published since the last call
+    bool Acquire()
+    {
+        if (!(middle.load(std::memory_order_relaxed) & FRESH))
+        {
+            return false;
+        }
+        front = middle.exchange(front, std::memory_order_acq_rel) & INDEX;
+        return true;
+    }
+
+    T const& Front() const { return buffers[front]; }
+
+private:
+    static const uint8_t INDEX = 0x03;
+    static const uint8_t FRESH = 0x04;      // middle holds a value not yet acquired
+
+    T buffers[3];
+    std::atomic<uint8_t> middle;            // index | FRESH
+    alignas(64) uint8_t back;               // producer owned
+    alignas(64) uint8_t front;              // consumer owned
+};
+
+#endif // TRIPLE_BUFFER_H
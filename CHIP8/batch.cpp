@@ -0,0 +1,370 @@
+#include "CHIP_8.h"
+#include "Movie.h"
+#include "RomCatalog.h"
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+using std::string;
+
+/*
+    Headless batch runner.
+
+    Usage: chip8_batch [--threads N] [--recompile] [--no-idle-skip] <manifest>
+
+    Each non-empty manifest line that does not start with '#' is one job:
+
+        <ROM> <input script, movie or -> <instruction budget> [seed [quirks]]
+
+    An input script holds "<frame> <key mask>" lines, in frame order. The
+    mask is hex, bit k set means key k is held, and it applies from that 60 Hz
+    frame on. A movie recorded by the frontend replays with its own seed,
+    frame length and quirk profile. Without either, the seed defaults to 1.
+    quirks is one of vip, chip48, schip, modern or classic, classic by default. Every ROM is loaded
+    once into a RomCatalog up front; each worker thread keeps one machine and
+    resets it from the catalog for every job. Jobs run on a work-stealing
+    thread pool, and one JSON object per job is written to stdout in
+    manifest order. Idle loops are skipped unless --no-idle-skip is given;
+    the results are the same either way.
+*/
+
+struct KeyEvent {
+    uint32_t frame;
+    uint16_t keys;
+};
+
+struct Job {
+    string rom;
+    int romId;
+    string script;
+    uint64_t budget;
+    uint32_t seed;
+    QuirkProfile quirks;
+};
+
+struct JobResult {
+    string error;               // empty on success
+    uint64_t retired;
+    uint32_t frames;
+    uint64_t displayHash;
+    uint16_t pc;
+    uint16_t index;
+    uint8_t sp;
+    uint8_t delayTimer;
+    uint8_t soundTimer;
+    uint8_t v[16];
+    double wallMs;
+};
+
+// Hands out job indices. Each worker drains its own queue from the front and,
+// once that is empty, steals from the back of the others.
+class WorkStealingPool {
+public:
+    WorkStealingPool(unsigned int threads) : queues(threads ? threads : 1) {}
+
+    // Calls task(i) for every i in [0, count), returns once all have finished
+    void Run(size_t count, std::function<void(size_t)> const& task) {
+        for (size_t i = 0; i < count; ++i) {
+            queues[i % queues.size()].jobs.push_back(i);
+        }
+        std::vector<std::thread> workers;
+        for (unsigned int w = 0; w < queues.size(); ++w) {
+            workers.emplace_back([this, w, &task]() {
+                size_t job;
+                while (Take(w, job)) {
+                    task(job);
+                }
+            });
+        }
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+    }
+
+private:
+    struct Queue {
+        std::mutex lock;
+        std::deque<size_t> jobs;
+    };
+
+    bool Take(unsigned int self, size_t& job) {
+        {
+            std::lock_guard<std::mutex> guard(queues[self].lock);
+            if (!queues[self].jobs.empty()) {
+                job = queues[self].jobs.front();
+                queues[self].jobs.pop_front();
+                return true;
+            }
+        }
+        // Nothing new is ever queued, so one empty pass means we are done
+        for (size_t n = 1; n < queues.size(); ++n) {
+            Queue& victim = queues[(self + n) % queues.size()];
+            std::lock_guard<std::mutex> guard(victim.lock);
+            if (!victim.jobs.empty()) {
+                job = victim.jobs.back();
+                victim.jobs.pop_back();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::vector<Queue> queues;
+};
+
+static bool ReadScript(string const& filename, std::vector<KeyEvent>& events) {
+    std::ifstream file(filename);
+    if (!file.is_open()) {
+        return false;
+    }
+    string line;
+    while (std::getline(file, line)) {
+        std::istringstream fields(line);
+        KeyEvent event;
+        unsigned int keys;
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        if (!(fields >> event.frame >> std::hex >> keys)) {
+            return false;
+        }
+        event.keys = (uint16_t)keys;
+        events.push_back(event);
+    }
+    return true;
+}
+
+// FNV-1a over the rows of the current resolution, row by row, then over
+// plane 1 if it holds anything, so a classic 64 x 32 screen hashes as it
+// always has
+static uint64_t HashDisplay(DisplayPlanes const& planes, bool hires) {
+    unsigned int rows = hires ? HIRES_HEIGHT : DISPLAY_HEIGHT;
+    unsigned int columns = hires ? DISPLAY_COLUMNS : 1;
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for (unsigned int plane = 0; plane < DISPLAY_PLANES; ++plane) {
+        uint64_t used = 0;
+        for (unsigned int column = 0; column < columns; ++column) {
+            for (unsigned int y = 0; y < rows; ++y) {
+                used |= planes[plane][column][y];
+            }
+        }
+        if (plane > 0 && !used) {
+            continue;
+        }
+        for (unsigned int y = 0; y < rows; ++y) {
+            for (unsigned int column = 0; column < columns; ++column) {
+                for (unsigned int b = 0; b < 8; ++b) {
+                    hash ^= (planes[plane][column][y] >> (56 - 8 * b)) & 0xFF;
+                    hash *= 0x100000001B3ull;
+                }
+            }
+        }
+    }
+    return hash;
+}
+
+static JobResult RunJob(Job const& job, RomCatalog const& catalog, bool recompile, bool idleSkip) {
+    JobResult result = {};
+    auto start = std::chrono::steady_clock::now();
+
+    if (job.romId == RomCatalog::INVALID_ROM) {
+        result.error = "cannot read ROM";
+        return result;
+    }
+    std::vector<KeyEvent> script;
+    Movie movie;
+    bool replaying = job.script != "-" && movie.Load(job.script.c_str());
+    if (job.script != "-" && !replaying && !ReadScript(job.script, script)) {
+        result.error = "cannot read input script";
+        return result;
+    }
+
+    // One machine per worker, restarted from the catalog's pristine image
+    thread_local std::unique_ptr<CHIP_8> machine;
+    if (!machine) {
+        machine.reset(new CHIP_8());
+        machine->EnableRecompiler(recompile);
+        machine->EnableIdleSkip(idleSkip);
+    }
+    CHIP_8* chip8 = machine.get();
+    chip8->SetCyclesPerFrame(DEFAULT_CYCLES_PER_FRAME);
+    chip8->SetQuirks(job.quirks);
+    catalog.Reset(*chip8, job.romId);
+    chip8->SetSeed(job.seed);
+    if (replaying) {
+        movie.StartReplay(*chip8);
+    }
+
+    // Run frame by frame so the script's key changes land on frame boundaries
+    size_t next = 0;
+    while (result.retired < job.budget) {
+        if (replaying) {
+            movie.ReplayFrame(*chip8);
+        }
+        if (next < script.size() && script[next].frame <= result.frames) {
+            while (next < script.size() && script[next].frame <= result.frames) {
+                ++next;
+            }
+            chip8->SetKeys(script[next - 1].keys);
+        }
+        uint64_t left = job.budget - result.retired;
+        RunResult run = chip8->Run(left < UINT32_MAX ? (uint32_t)left : UINT32_MAX, EXIT_FRAME);
+        result.retired += run.retired;
+        if (run.reason & EXIT_FRAME) {
+            ++result.frames;
+        }
+    }
+
+    result.displayHash = HashDisplay(chip8->Display, chip8->HighResolution());
+    result.pc = chip8->GetPC();
+    result.index = chip8->GetIndex();
+    result.sp = chip8->GetSP();
+    result.delayTimer = chip8->GetDelayTimer();
+    result.soundTimer = chip8->Sound_Timer;
+    for (unsigned int x = 0; x < 16; ++x) {
+        result.v[x] = chip8->GetRegister(x);
+    }
+    result.wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+static string JsonString(string const& text) {
+    string out = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        }
+        else if ((unsigned char)c < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out += escaped;
+        }
+        else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+static void PrintResult(size_t id, Job const& job, JobResult const& result) {
+    std::ostringstream out;
+    out << "{\"job\":" << id << ",\"rom\":" << JsonString(job.rom);
+    if (!result.error.empty()) {
+        out << ",\"error\":" << JsonString(result.error) << "}\n";
+        std::cout << out.str();
+        return;
+    }
+    char hash[20];
+    snprintf(hash, sizeof(hash), "%016llx", (unsigned long long)result.displayHash);
+    out << ",\"retired\":" << result.retired
+        << ",\"frames\":" << result.frames
+        << ",\"wall_ms\":" << result.wallMs
+        << ",\"display_hash\":\"" << hash << "\""
+        << ",\"pc\":" << result.pc
+        << ",\"i\":" << result.index
+        << ",\"sp\":" << (unsigned int)result.sp
+        << ",\"dt\":" << (unsigned int)result.delayTimer
+        << ",\"st\":" << (unsigned int)result.soundTimer
+        << ",\"v\":[";
+    for (unsigned int x = 0; x < 16; ++x) {
+        out << (x ? "," : "") << (unsigned int)result.v[x];
+    }
+    out << "]}\n";
+    std::cout << out.str();
+}
+
+int main(int argc, char* argv[]) {
+    unsigned int threads = std::thread::hardware_concurrency();
+    bool recompile = false;
+    bool idleSkip = true;
+    char const* manifestName = nullptr;
+
+    for (int a = 1; a < argc; ++a) {
+        string arg = argv[a];
+        if (arg == "--threads" && a + 1 < argc) {
+            threads = (unsigned int)std::stoul(argv[++a]);
+        }
+        else if (arg == "--recompile") {
+            recompile = true;
+        }
+        else if (arg == "--no-idle-skip") {
+            idleSkip = false;
+        }
+        else if (!manifestName) {
+            manifestName = argv[a];
+        }
+        else {
+            manifestName = nullptr;
+            break;
+        }
+    }
+    if (!manifestName) {
+        std::cerr << "Usage: " << argv[0] << " [--threads N] [--recompile] [--no-idle-skip] <manifest>\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    std::ifstream manifest(manifestName);
+    if (!manifest.is_open()) {
+        std::cerr << "Failed to open manifest: " << manifestName << "\n";
+        std::exit(EXIT_FAILURE);
+    }
+    std::vector<Job> jobs;
+    string line;
+    for (unsigned int lineNumber = 1; std::getline(manifest, line); ++lineNumber) {
+        std::istringstream fields(line);
+        Job job;
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        if (!(fields >> job.rom >> job.script >> job.budget)) {
+            std::cerr << manifestName << ":" << lineNumber << ": expected <ROM> <script|-> <budget> [seed [quirks]]\n";
+            std::exit(EXIT_FAILURE);
+        }
+        string quirks;
+        job.quirks = DEFAULT_QUIRKS;
+        if (!(fields >> job.seed)) {
+            job.seed = 1;
+        }
+        else if (fields >> quirks && !FindQuirkProfile(quirks, job.quirks)) {
+            std::cerr << manifestName << ":" << lineNumber << ": unknown quirk profile " << quirks << "\n";
+            std::exit(EXIT_FAILURE);
+        }
+        jobs.push_back(job);
+    }
+
+    RomCatalog catalog;
+    for (Job& job : jobs) {
+        job.romId = catalog.Add(job.rom.c_str());
+    }
+    for (auto const& rejected : catalog.Rejected()) {
+        std::cerr << rejected.first << ": " << rejected.second << "\n";
+    }
+
+    std::vector<JobResult> results(jobs.size());
+    auto start = std::chrono::steady_clock::now();
+    WorkStealingPool pool(threads);
+    pool.Run(jobs.size(), [&](size_t i) {
+        results[i] = RunJob(jobs[i], catalog, recompile, idleSkip);
+    });
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    uint64_t total = 0;
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        PrintResult(i, jobs[i], results[i]);
+        total += results[i].retired;
+    }
+    std::cerr << jobs.size() << " jobs, " << total << " instructions in " << seconds << " s on "
+              << (threads ? threads : 1) << " threads\n";
+    return 0;
+}
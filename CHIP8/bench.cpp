@@ -0,0 +1,300 @@
+#include "CHIP_8.h"
+#include "Lockstep.h"
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+using std::string;
+
+/*
+    Interpreter benchmarks.
+
+    Usage: chip8_bench [--recompile] [--no-idle-skip] [--cycles-per-frame N] [--min-time S] [--lanes N] [ROM...]
+
+    Runs a fixed set of synthetic ROMs (one per opcode class, plus a few
+    stress programs), then every ROM given on the command line, and writes
+    one JSON document with instructions/s, ns/instruction and frames/s for
+    each. With --recompile every benchmark also runs with the recompiler on.
+    The idle loop benchmarks measure skipping, unless --no-idle-skip makes
+    them run every instruction. A human readable table goes to stderr.
+
+    Last, a game loop whose lanes hold different keys runs on a LockstepEngine
+    with N lanes (64 by default, 0 to skip it) and on N independent CHIP_8s
+    for the same number of instructions; the final states must match.
+*/
+
+struct Benchmark {
+    string name;
+    std::vector<uint8_t> rom;
+};
+
+struct Measurement {
+    uint64_t instructions;
+    uint64_t frames;
+    double seconds;
+};
+
+// Builds "body repeated count times, then jump back to 0x200"
+static std::vector<uint8_t> Loop(std::vector<uint16_t> const& prologue, std::vector<uint16_t> const& body, unsigned int count) {
+    std::vector<uint16_t> words(prologue);
+    uint16_t top = (uint16_t)(0x200 + 2 * prologue.size());
+    for (unsigned int i = 0; i < count; ++i) {
+        words.insert(words.end(), body.begin(), body.end());
+    }
+    words.push_back((uint16_t)(0x1000 | top));
+
+    std::vector<uint8_t> rom;
+    for (uint16_t word : words) {
+        rom.push_back((uint8_t)(word >> 8));
+        rom.push_back((uint8_t)word);
+    }
+    return rom;
+}
+
+static std::vector<Benchmark> SyntheticBenchmarks() {
+    // V0..V3 hold non-trivial values so the ALU results keep changing
+    const std::vector<uint16_t> setup = { 0x6011, 0x6122, 0x6233, 0x6344 };
+    std::vector<Benchmark> list;
+
+    list.push_back({ "alu_8xy0_8xy3", Loop(setup, { 0x8010, 0x8121, 0x8232, 0x8303 }, 32) });
+    list.push_back({ "alu_8xy4_8xy5", Loop(setup, { 0x8014, 0x8125, 0x8234, 0x8305 }, 32) });
+    list.push_back({ "alu_8xy6_8xye", Loop(setup, { 0x8016, 0x811E, 0x8226, 0x830E }, 32) });
+    list.push_back({ "alu_6xnn_7xnn", Loop(setup, { 0x6055, 0x7101, 0x72FF, 0x6399 }, 32) });
+    list.push_back({ "skip_taken", Loop(setup, { 0x3011, 0x0000, 0x4000, 0x0000 }, 32) });
+    list.push_back({ "skip_not_taken", Loop(setup, { 0x3000, 0x4011, 0x5010, 0x9000 }, 32) });
+    list.push_back({ "call_return", Loop({ 0x1206, 0x7001, 0x00EE }, { 0x2202 }, 64) });
+    list.push_back({ "dxyn_height_1", Loop({ 0xA050, 0x6005, 0x6103 }, { 0xD011 }, 64) });
+    list.push_back({ "dxyn_height_5", Loop({ 0xA050, 0x6005, 0x6103 }, { 0xD015 }, 64) });
+    list.push_back({ "dxyn_height_15", Loop({ 0xA050, 0x6005, 0x6103 }, { 0xD01F }, 64) });
+    list.push_back({ "dxyn_clipped", Loop({ 0xA050, 0x603C, 0x611C }, { 0xD01F }, 64) });
+    list.push_back({ "dxy0_hires", Loop({ 0x00FF, 0xA0A0, 0x603A, 0x6103 }, { 0xD010 }, 64) });             // 16 x 16, straddling both words
+    list.push_back({ "dxyn_two_planes", Loop({ 0xF301, 0xA050, 0x6005, 0x6103 }, { 0xD015 }, 64) });
+    list.push_back({ "scroll_hires", Loop({ 0x00FF }, { 0x00C4, 0x00FB, 0x00FC, 0x00D4 }, 16) });
+    list.push_back({ "fx55_16", Loop({ 0xAE00 }, { 0xFF55 }, 64) });
+    list.push_back({ "fx65_16", Loop({ 0xAE00 }, { 0xFF65 }, 64) });
+    list.push_back({ "fx33", Loop({ 0xAE00, 0x60FE }, { 0xF033 }, 64) });
+
+    // Stress programs
+    list.push_back({ "mixed_game_loop", Loop(setup, {
+        0x00E0, 0xA050, 0xD015, 0x7001, 0x8014, 0x3000, 0x7101, 0xF029,
+        0xD125, 0xF015, 0xF007, 0x4000, 0x8126, 0xF21E, 0x9010, 0x7201 }, 8) });
+    list.push_back({ "self_modifying", Loop({}, { 0xA210, 0xF165, 0xF155, 0x7101, 0x7101, 0x7101, 0x7101, 0x7101 }, 1) });   // rewrites its own jump
+    list.push_back({ "tight_jump", Loop({}, {}, 0) });
+
+    // Idle loops
+    list.push_back({ "delay_timer_wait", Loop({}, { 0x6178, 0xF115, 0xF007, 0x3000, 0x1204 }, 1) });      // 2 s, then again
+    list.push_back({ "key_wait", Loop({}, { 0xF00A }, 1) });
+    return list;
+}
+
+static Measurement Measure(std::vector<uint8_t> const& rom, bool recompile, bool idleSkip, uint32_t cyclesPerFrame, double minTime) {
+    std::unique_ptr<CHIP_8> chip8(new CHIP_8());
+    chip8->SetSeed(1);
+    chip8->LoadROM(rom.data(), rom.size());
+    chip8->SetCyclesPerFrame(cyclesPerFrame);
+    chip8->EnableRecompiler(recompile);
+    chip8->EnableIdleSkip(idleSkip);
+
+    // Warm up the instruction cache (and the recompiler) before timing
+    for (unsigned int f = 0; f < 100; ++f) {
+        chip8->Run(UINT32_MAX, EXIT_FRAME);
+    }
+
+    Measurement m = { 0, 0, 0.0 };
+    auto start = std::chrono::steady_clock::now();
+    do {
+        for (unsigned int f = 0; f < 1000; ++f) {
+            m.instructions += chip8->Run(UINT32_MAX, EXIT_FRAME).retired;
+        }
+        m.frames += 1000;
+        m.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    } while (m.seconds < minTime);
+    return m;
+}
+
+struct LockstepMeasurement {
+    Measurement lockstep;
+    Measurement independent;
+    double groupsPerStep;
+    unsigned int mismatches;            // lanes whose final state differs
+};
+
+// Classic instructions only, so LockstepEngine runs all of it. Lanes holding
+// key 5 take the E59E skip, splitting off and rejoining once per pass
+static std::vector<uint8_t> LockstepGameLoop() {
+    return Loop({ 0x6011, 0x6122, 0x6233, 0x6344, 0x6505 }, {
+        0x00E0, 0xA050, 0xD015, 0x7001, 0x8014, 0x3000, 0x7101, 0xF029,
+        0xD125, 0xF015, 0xF007, 0x4000, 0x8126, 0xF21E, 0x9010, 0x7201,
+        0xE59E, 0x7301, 0xAE00, 0xF355 }, 8);
+}
+
+static bool SameState(CHIP_8 const& chip8, LockstepEngine const& engine, unsigned int lane) {
+    bool same = chip8.GetPC() == engine.GetPC(lane) && chip8.GetIndex() == engine.GetIndex(lane)
+        && chip8.GetSP() == engine.GetSP(lane) && chip8.GetDelayTimer() == engine.GetDelayTimer(lane)
+        && memcmp(chip8.Display[0][0], engine.Display(lane), 32 * sizeof(uint64_t)) == 0;
+    for (unsigned int x = 0; x < 16 && same; ++x) {
+        same = chip8.GetRegister(x) == engine.GetRegister(lane, x);
+    }
+    for (unsigned int address = 0x200; address < 0x1000 && same; ++address) {
+        same = chip8.GetMemory((uint16_t)address) == engine.ReadMemory(lane, (uint16_t)address);
+    }
+    return same;
+}
+
+static LockstepMeasurement MeasureLockstep(std::vector<uint8_t> const& rom, unsigned int lanes, uint32_t cyclesPerFrame, double minTime) {
+    LockstepMeasurement m = { { 0, 0, 0.0 }, { 0, 0, 0.0 }, 0.0, 0 };
+    std::unique_ptr<LockstepEngine> engine(new LockstepEngine(lanes));
+    engine->LoadROM(rom.data(), rom.size());
+    engine->SetCyclesPerFrame(cyclesPerFrame);
+    for (unsigned int lane = 0; lane < lanes; ++lane) {
+        engine->SetKeys(lane, (uint16_t)(1u << (lane & 0x0F)));
+    }
+
+    // The lockstep engine sets the step count, every CHIP_8 then runs as many
+    auto start = std::chrono::steady_clock::now();
+    do {
+        engine->Run(1000 * cyclesPerFrame);
+        m.lockstep.frames += 1000;
+        m.lockstep.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    } while (m.lockstep.seconds < minTime);
+    uint64_t steps = engine->Stats().steps;
+    m.lockstep.instructions = steps * lanes;
+    m.groupsPerStep = (double)engine->Stats().groups / steps;
+
+    std::vector<std::unique_ptr<CHIP_8>> machines;
+    for (unsigned int lane = 0; lane < lanes; ++lane) {
+        machines.emplace_back(new CHIP_8());
+        machines.back()->LoadROM(rom.data(), rom.size());
+        machines.back()->SetCyclesPerFrame(cyclesPerFrame);
+        machines.back()->EnableIdleSkip(false);
+        machines.back()->SetKeys((uint16_t)(1u << (lane & 0x0F)));
+    }
+    start = std::chrono::steady_clock::now();
+    for (std::unique_ptr<CHIP_8>& chip8 : machines) {
+        for (uint64_t left = steps; left > 0; ) {
+            uint32_t budget = left < UINT32_MAX ? (uint32_t)left : UINT32_MAX;
+            left -= chip8->Run(budget, EXIT_BUDGET).retired;
+        }
+        m.independent.instructions += steps;
+    }
+    m.independent.frames = m.lockstep.frames;
+    m.independent.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    for (unsigned int lane = 0; lane < lanes; ++lane) {
+        m.mismatches += SameState(*machines[lane], *engine, lane) ? 0 : 1;
+    }
+    return m;
+}
+
+static string JsonString(string const& text) {
+    string out = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+        }
+        out += c;
+    }
+    return out + "\"";
+}
+
+int main(int argc, char* argv[]) {
+    bool recompile = false;
+    bool idleSkip = true;
+    uint32_t cyclesPerFrame = DEFAULT_CYCLES_PER_FRAME;
+    double minTime = 0.25;
+    unsigned int lanes = 64;
+    std::vector<Benchmark> benchmarks = SyntheticBenchmarks();
+
+    for (int a = 1; a < argc; ++a) {
+        string arg = argv[a];
+        if (arg == "--recompile") {
+            recompile = true;
+        }
+        else if (arg == "--no-idle-skip") {
+            idleSkip = false;
+        }
+        else if (arg == "--cycles-per-frame" && a + 1 < argc) {
+            cyclesPerFrame = (uint32_t)std::stoul(argv[++a]);
+        }
+        else if (arg == "--min-time" && a + 1 < argc) {
+            minTime = std::stod(argv[++a]);
+        }
+        else if (arg == "--lanes" && a + 1 < argc) {
+            lanes = (unsigned int)std::stoul(argv[++a]);
+        }
+        else if (arg.size() > 1 && arg[0] == '-') {
+            std::cerr << "Usage: " << argv[0] << " [--recompile] [--no-idle-skip] [--cycles-per-frame N] [--min-time S] [--lanes N] [ROM...]\n";
+            std::exit(EXIT_FAILURE);
+        }
+        else {
+            std::ifstream file(argv[a], std::ios::binary);
+            if (!file.is_open()) {
+                std::cerr << "Failed to open ROM: " << argv[a] << "\n";
+                std::exit(EXIT_FAILURE);
+            }
+            benchmarks.push_back({ "rom:" + arg, std::vector<uint8_t>((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>()) });
+        }
+    }
+
+    std::ostringstream json;
+    json << "{\"cycles_per_frame\":" << cyclesPerFrame << ",\"min_time\":" << minTime << ",\"results\":[";
+    bool first = true;
+    for (int engine = 0; engine <= (recompile ? 1 : 0); ++engine) {
+        char const* engineName = engine ? "recompiler" : "interpreter";
+        for (Benchmark const& benchmark : benchmarks) {
+            Measurement m = Measure(benchmark.rom, engine == 1, idleSkip, cyclesPerFrame, minTime);
+            double ips = m.instructions / m.seconds;
+            double ns = m.seconds * 1e9 / m.instructions;
+            double fps = m.frames / m.seconds;
+
+            json << (first ? "" : ",") << "\n  {\"name\":" << JsonString(benchmark.name)
+                 << ",\"engine\":\"" << engineName << "\""
+                 << ",\"instructions\":" << m.instructions
+                 << ",\"frames\":" << m.frames
+                 << ",\"seconds\":" << m.seconds
+                 << ",\"instructions_per_second\":" << ips
+                 << ",\"ns_per_instruction\":" << ns
+                 << ",\"frames_per_second\":" << fps << "}";
+            first = false;
+
+            char line[160];
+            snprintf(line, sizeof(line), "%-12s %-28s %9.1f M instr/s %7.2f ns/instr %10.0f frames/s\n",
+                     engineName, benchmark.name.c_str(), ips / 1e6, ns, fps);
+            std::cerr << line;
+        }
+    }
+    json << "\n]";
+
+    bool matched = true;
+    if (lanes > 0) {
+        LockstepMeasurement m = MeasureLockstep(LockstepGameLoop(), lanes, cyclesPerFrame, minTime);
+        double lockstepIps = m.lockstep.instructions / m.lockstep.seconds;
+        double independentIps = m.independent.instructions / m.independent.seconds;
+        matched = m.mismatches == 0;
+
+        json << ",\"lockstep\":{\"name\":\"lockstep_game_loop\",\"lanes\":" << lanes
+             << ",\"instructions\":" << m.lockstep.instructions
+             << ",\"lockstep_seconds\":" << m.lockstep.seconds
+             << ",\"independent_seconds\":" << m.independent.seconds
+             << ",\"lockstep_instructions_per_second\":" << lockstepIps
+             << ",\"independent_instructions_per_second\":" << independentIps
+             << ",\"groups_per_step\":" << m.groupsPerStep
+             << ",\"mismatched_lanes\":" << m.mismatches << "}";
+
+        char line[200];
+        snprintf(line, sizeof(line), "%-12s %-28s %9.1f M instr/s, %u CHIP_8s %.1f M instr/s, %.2f groups/step, %u mismatched\n",
+                 "lockstep", "lockstep_game_loop", lockstepIps / 1e6, lanes, independentIps / 1e6, m.groupsPerStep, m.mismatches);
+        std::cerr << line;
+    }
+    json << "}\n";
+    std::cout << json.str();
+    return matched ? 0 : EXIT_FAILURE;
+}
@@ -0,0 +1,292 @@
+#include "CHIP_8.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+using std::string;
+
+/*
+    Headless debugger stub, driven by a line protocol on stdin/stdout.
+
+    Usage: chip8_debug [--quirks P] [--seed N] [--cycles-per-frame N] <ROM>
+
+    Each input line is one command; its reply is zero or more lines followed
+    by "ok" or "error <message>". Numbers are C style (0x prefix for hex),
+    registers are V0-VF, and conditions read "VX <op> value" with op one of
+    == != < <= > >=.
+
+        regs                        PC, I, SP, timers, V0-VF and keys
+        mem <addr> [length]         hex dump, 16 bytes a line
+        stack                       return addresses, innermost last
+        dis [addr] [count]          disassembly, from PC by default
+        step [count]                run instructions, stopping at anything armed
+        continue [budget]           run until a break, a blocked FX0A or the budget
+        until <addr> [budget]       continue until PC reaches addr
+        break <addr> [condition]    stop before addr runs (while condition holds)
+        delete <addr>               remove the breakpoint at addr
+        watch <addr> [length] [r|w|rw]     stop after an instruction reads or writes there
+        unwatch <addr> [length]
+        when <condition>            stop when condition becomes true
+        clear                       remove every breakpoint, watchpoint and condition
+        set <V0-VF|I|PC|DT|ST> <value>
+        poke <addr> <byte>...       write memory
+        keys <mask>                 hold keys, bit k = key k
+        quit
+
+    Every run ends with a "stopped <why> pc=<pc> retired=<count>" line. The
+    stub can be put behind a socket with e.g. socat or an inetd style
+    listener; the protocol never needs more than one line of lookahead.
+*/
+
+const uint32_t DEFAULT_BUDGET = 10000000;
+
+static bool ParseNumber(string const& text, uint32_t& value) {
+    char* end = nullptr;
+    unsigned long parsed = std::strtoul(text.c_str(), &end, 0);
+    if (text.empty() || *end != '\0') {
+        return false;
+    }
+    value = (uint32_t)parsed;
+    return true;
+}
+
+static bool ParseRegister(string const& text, unsigned int& x) {
+    uint32_t value = 0;
+    if (text.size() != 2 || (text[0] != 'V' && text[0] != 'v') || !ParseNumber("0x" + text.substr(1), value)) {
+        return false;
+    }
+    x = value;
+    return true;
+}
+
+static bool ParseCondition(std::vector<string> const& words, size_t at, Debugger::Condition& condition) {
+    static char const* const OPERATORS[] = { "==", "!=", "<", "<=", ">", ">=" };
+    static const Debugger::Compare COMPARES[] = {
+        Debugger::EQUAL, Debugger::NOT_EQUAL, Debugger::LESS, Debugger::LESS_EQUAL, Debugger::GREATER, Debugger::GREATER_EQUAL
+    };
+    unsigned int x = 0;
+    uint32_t value = 0;
+    if (words.size() != at + 3 || !ParseRegister(words[at], x) || !ParseNumber(words[at + 2], value) || value > 0xFF) {
+        return false;
+    }
+    for (size_t o = 0; o < sizeof(COMPARES) / sizeof(COMPARES[0]); ++o) {
+        if (words[at + 1] == OPERATORS[o]) {
+            condition = Debugger::Condition{ (uint8_t)x, COMPARES[o], (uint8_t)value };
+            return true;
+        }
+    }
+    return false;
+}
+
+static string Hex(unsigned int value, int digits) {
+    char text[16];
+    snprintf(text, sizeof(text), "0x%0*X", digits, value);
+    return text;
+}
+
+static void PrintStop(CHIP_8& chip8, Debugger& debugger, RunResult const& run) {
+    std::cout << "stopped ";
+    if (run.reason & EXIT_BREAK) {
+        Debugger::Stop const& stop = debugger.LastStop();
+        switch (stop.reason) {
+        case Debugger::STOP_BREAKPOINT: std::cout << "breakpoint"; break;
+        case Debugger::STOP_RUN_TO: std::cout << "until"; break;
+        case Debugger::STOP_CONDITION: std::cout << "condition " << stop.condition; break;
+        case Debugger::STOP_WATCHPOINT:
+            std::cout << "watchpoint " << Hex(stop.address, 3) << (stop.access == Debugger::WATCH_WRITE ? " write" : " read")
+                      << " by " << Hex(stop.pc, 3);
+            break;
+        default: std::cout << "break"; break;
+        }
+    }
+    else if (run.reason & EXIT_KEY_WAIT) {
+        std::cout << "key_wait";
+    }
+    else {
+        std::cout << "budget";
+    }
+    std::cout << " pc=" << Hex(chip8.GetPC(), 3) << " retired=" << run.retired << "\n";
+}
+
+// Runs one command line, writing its reply without the final status; returns
+// an error message, empty on success
+static string Execute(CHIP_8& chip8, Debugger& debugger, std::vector<string> const& words, bool& quit) {
+    string const& command = words[0];
+    uint32_t a = 0, b = 0;
+    Debugger::Condition condition = { 0, Debugger::ALWAYS, 0 };
+
+    if (command == "regs" && words.size() == 1) {
+        std::cout << "pc=" << Hex(chip8.GetPC(), 3) << " i=" << Hex(chip8.GetIndex(), 3) << " sp=" << (unsigned int)chip8.GetSP()
+                  << " dt=" << (unsigned int)chip8.GetDelayTimer() << " st=" << (unsigned int)debugger.GetSoundTimer()
+                  << " keys=" << Hex(chip8.GetKeys(), 4) << "\n";
+        for (unsigned int x = 0; x < 16; ++x) {
+            char text[16];
+            snprintf(text, sizeof(text), "V%X=%02X%c", x, chip8.GetRegister(x), x == 15 ? '\n' : ' ');
+            std::cout << text;
+        }
+    }
+    else if (command == "mem" && (words.size() == 2 || words.size() == 3) && ParseNumber(words[1], a)
+             && (words.size() == 2 || ParseNumber(words[2], b))) {
+        uint32_t length = words.size() == 3 ? b : 16;
+        for (uint32_t i = 0; i < length && i < 4096; ++i) {
+            char text[8];
+            snprintf(text, sizeof(text), " %02X", chip8.GetMemory((uint16_t)(a + i)));
+            std::cout << (i % 16 == 0 ? Hex((a + i) & 0x0FFF, 3) + ":" : "") << text << ((i % 16 == 15 || i + 1 == length) ? "\n" : "");
+        }
+    }
+    else if (command == "stack" && words.size() == 1) {
+        for (unsigned int level = 0; level < chip8.GetSP() && level < 16; ++level) {
+            std::cout << Hex(debugger.GetStack(level), 3) << "\n";
+        }
+    }
+    else if (command == "dis" && words.size() <= 3 && (words.size() < 2 || ParseNumber(words[1], a))
+             && (words.size() < 3 || ParseNumber(words[2], b))) {
+        uint16_t address = words.size() >= 2 ? (uint16_t)a : chip8.GetPC();
+        uint32_t count = words.size() == 3 ? b : 10;
+        for (uint32_t i = 0; i < count && i < 2048; ++i) {
+            std::cout << debugger.DisassembleAt((uint16_t)(address + 2 * i)) << "\n";
+        }
+    }
+    else if (command == "step" && words.size() <= 2 && (words.size() < 2 || ParseNumber(words[1], a))) {
+        PrintStop(chip8, debugger, debugger.Step(words.size() == 2 ? a : 1));
+    }
+    else if (command == "continue" && words.size() <= 2 && (words.size() < 2 || ParseNumber(words[1], a))) {
+        PrintStop(chip8, debugger, chip8.Run(words.size() == 2 ? a : DEFAULT_BUDGET, EXIT_KEY_WAIT));
+    }
+    else if (command == "until" && (words.size() == 2 || words.size() == 3) && ParseNumber(words[1], a)
+             && (words.size() == 2 || ParseNumber(words[2], b))) {
+        PrintStop(chip8, debugger, debugger.RunTo((uint16_t)a, words.size() == 3 ? b : DEFAULT_BUDGET));
+    }
+    else if (command == "break" && words.size() >= 2 && ParseNumber(words[1], a)
+             && (words.size() == 2 || ParseCondition(words, 2, condition))) {
+        debugger.SetBreakpoint((uint16_t)a, condition);
+    }
+    else if (command == "delete" && words.size() == 2 && ParseNumber(words[1], a)) {
+        if (!debugger.HasBreakpoint((uint16_t)a)) {
+            return "no breakpoint at " + Hex(a & 0x0FFF, 3);
+        }
+        debugger.ClearBreakpoint((uint16_t)a);
+    }
+    else if (command == "watch" && words.size() >= 2 && words.size() <= 4 && ParseNumber(words[1], a)
+             && (words.size() < 3 || ParseNumber(words[2], b))) {
+        string kind = words.size() == 4 ? words[3] : "w";
+        if (kind != "r" && kind != "w" && kind != "rw") {
+            return "watch kind must be r, w or rw";
+        }
+        debugger.SetWatchpoint((uint16_t)a, (uint16_t)(words.size() >= 3 ? b : 1),
+                               kind == "r" ? Debugger::WATCH_READ : kind == "w" ? Debugger::WATCH_WRITE : Debugger::WATCH_ACCESS);
+    }
+    else if (command == "unwatch" && (words.size() == 2 || words.size() == 3) && ParseNumber(words[1], a)
+             && (words.size() == 2 || ParseNumber(words[2], b))) {
+        debugger.ClearWatchpoint((uint16_t)a, (uint16_t)(words.size() == 3 ? b : 1));
+    }
+    else if (command == "when" && ParseCondition(words, 1, condition)) {
+        std::cout << "condition " << debugger.AddCondition(condition) << "\n";
+    }
+    else if (command == "clear" && words.size() == 1) {
+        debugger.ClearAll();
+    }
+    else if (command == "set" && words.size() == 3 && ParseNumber(words[2], a)) {
+        unsigned int x = 0;
+        if (ParseRegister(words[1], x) && a <= 0xFF) {
+            debugger.SetRegister(x, (uint8_t)a);
+        }
+        else if ((words[1] == "I" || words[1] == "i") && a <= 0xFFFF) {
+            debugger.SetIndex((uint16_t)a);
+        }
+        else if ((words[1] == "PC" || words[1] == "pc") && a <= 0x0FFF) {
+            debugger.SetPC((uint16_t)a);
+        }
+        else if ((words[1] == "DT" || words[1] == "dt") && a <= 0xFF) {
+            debugger.SetDelayTimer((uint8_t)a);
+        }
+        else if ((words[1] == "ST" || words[1] == "st") && a <= 0xFF) {
+            debugger.SetSoundTimer((uint8_t)a);
+        }
+        else {
+            return "bad register or value";
+        }
+    }
+    else if (command == "poke" && words.size() >= 3 && ParseNumber(words[1], a)) {
+        for (size_t w = 2; w < words.size(); ++w) {
+            if (!ParseNumber(words[w], b) || b > 0xFF) {
+                return "bad byte " + words[w];
+            }
+        }
+        for (size_t w = 2; w < words.size(); ++w) {
+            ParseNumber(words[w], b);
+            debugger.SetMemory((uint16_t)(a + w - 2), (uint8_t)b);
+        }
+    }
+    else if (command == "keys" && words.size() == 2 && ParseNumber(words[1], a) && a <= 0xFFFF) {
+        chip8.SetKeys((uint16_t)a);
+    }
+    else if (command == "quit" && words.size() == 1) {
+        quit = true;
+    }
+    else {
+        return "bad command: " + command;
+    }
+    return "";
+}
+
+int main(int argc, char* argv[]) {
+    QuirkProfile quirks = DEFAULT_QUIRKS;
+    uint32_t seed = 1;
+    uint32_t cyclesPerFrame = DEFAULT_CYCLES_PER_FRAME;
+    char const* romName = nullptr;
+    bool usage = false;
+
+    for (int a = 1; a < argc && !usage; ++a) {
+        string arg = argv[a];
+        if (arg == "--quirks" && a + 1 < argc) {
+            usage = !FindQuirkProfile(argv[++a], quirks);
+        }
+        else if (arg == "--seed" && a + 1 < argc) {
+            seed = (uint32_t)std::stoul(argv[++a]);
+        }
+        else if (arg == "--cycles-per-frame" && a + 1 < argc) {
+            cyclesPerFrame = (uint32_t)std::stoul(argv[++a]);
+        }
+        else if (!romName) {
+            romName = argv[a];
+        }
+        else {
+            usage = true;
+        }
+    }
+    if (usage || !romName) {
+        std::cerr << "Usage: " << argv[0] << " [--quirks vip|chip48|schip|modern|classic] [--seed N] [--cycles-per-frame N] <ROM>\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    std::unique_ptr<CHIP_8> chip8(new CHIP_8());
+    if (!chip8->LoadROM(romName)) {
+        std::cerr << "Failed to load ROM: " << romName << "\n";
+        std::exit(EXIT_FAILURE);
+    }
+    chip8->SetQuirks(quirks);
+    chip8->SetSeed(seed);
+    chip8->SetCyclesPerFrame(cyclesPerFrame);
+    Debugger* debugger = chip8->EnableDebugger(true);
+
+    bool quit = false;
+    string line;
+    while (!quit && std::getline(std::cin, line)) {
+        std::istringstream stream(line);
+        std::vector<string> words;
+        for (string word; stream >> word; ) {
+            words.push_back(word);
+        }
+        if (words.empty()) {
+            continue;
+        }
+        string error = Execute(*chip8, *debugger, words, quit);
+        std::cout << (error.empty() ? "ok" : "error " + error) << std::endl;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include "CHIP_8.h"
+#include "keypad.h"
+#include "SpscRing.h"
+#include "TripleBuffer.h"
+#include <algorithm>
+#include <cstring>
+
+// One finished frame on its way to the screen
+struct Frame {
+    DisplayPlanes planes;
+    uint64_t sequence;          // counts published frames
+    uint64_t rowChanged[HIRES_HEIGHT];      // sequence of the last frame that changed each row
+    uint64_t modeChanged;       // sequence of the last frame that switched resolution
+    bool hires;
+};
+
+/*
+    VideoSink for an emulation thread: every changed Display is published
+    into a triple buffer and the render thread shows the newest one. Key
+    events a frame answers are queued with its sequence number, so when the
+    renderer skips frames they are timed at the first later frame it shows.
+    Each frame also carries when every row last changed, so the renderer
+    redraws the rows changed since the frame it showed last, however many
+    frames it skipped in between.
+*/
+class FrameHandoff : public VideoSink {
+public:
+    FrameHandoff(Keypad& keypad) : keypad(keypad) {}
+
+    // Emulation thread
+    void Update(DisplayPlanes const& planes, bool hires, unsigned int top, unsigned int bottom) override {
+        Frame& frame = frames.Back();
+        memcpy(frame.planes, planes, sizeof(frame.planes));
+        frame.hires = hires;
+        frame.sequence = ++published;
+        if (hires != lastHires) {
+            modeChanged = published;
+            lastHires = hires;
+        }
+        for (unsigned int row = top; row < bottom && row < HIRES_HEIGHT; ++row) {
+            rowChanged[row] = published;
+        }
+        memcpy(frame.rowChanged, rowChanged, sizeof(rowChanged));
+        frame.modeChanged = modeChanged;
+
+        Keypad::Clock::time_point stamps[16];
+        size_t count = keypad.Answer(stamps, 16);
+        for (size_t i = 0; i < count; ++i) {
+            answered.Push(Answer{ frame.sequence, stamps[i] });     // dropped only if the renderer has stalled
+        }
+        frames.Publish();
+    }
+
+    // Render thread: the newest frame, or nullptr if nothing new was published.
+    // [top, bottom) covers every row changed since the last frame returned
+    Frame const* Newest(unsigned int& top, unsigned int& bottom) {
+        if (!frames.Acquire()) {
+            return nullptr;
+        }
+        Frame const& frame = frames.Front();
+        unsigned int rows = frame.hires ? HIRES_HEIGHT : DISPLAY_HEIGHT;
+        top = rows;
+        bottom = 0;
+        if (shownSequence == 0 || frame.modeChanged > shownSequence) {
+            top = 0;
+            bottom = rows;
+        }
+        for (unsigned int row = 0; row < rows; ++row) {
+            if (frame.rowChanged[row] > shownSequence) {
+                top = std::min(top, row);
+                bottom = std::max(bottom, row + 1);
+            }
+        }
+        if (top >= bottom) {
+            top = bottom = 0;
+        }
+        shownSequence = frame.sequence;
+        return &frame;
+    }
+
+    // Render thread, once frame is on screen
+    void Presented(Frame const& frame) {
+        while (holding || answered.Pop(next)) {
+            holding = next.sequence > frame.sequence;
+            if (holding) {
+                break;      // answered by a frame not shown yet
+            }
+            keypad.Presented(&next.stamp, 1);
+        }
+    }
+
+private:
+    struct Answer {
+        uint64_t sequence;
+        Keypad::Clock::time_point stamp;
+    };
+
+    Keypad& keypad;
+    TripleBuffer<Frame> frames;
+    SpscRing<Answer, 64> answered;
+    // Emulation thread
+    uint64_t published{};
+    uint64_t rowChanged[HIRES_HEIGHT]{};
+    uint64_t modeChanged{};
+    bool lastHires{};
+
+    // Render thread
+    Answer next{};
+    bool holding{};
+    uint64_t shownSequence{};
+};
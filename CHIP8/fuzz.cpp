@@ -0,0 +1,696 @@
+#include "CHIP_8.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+using std::string;
+namespace fs = std::filesystem;
+
+/*
+    Coverage-guided ROM fuzzer for the core.
+
+    Usage: chip8_fuzz [--seconds S] [--jobs N] [--budget N] [--seed N] [--out DIR] [seed ROM...]
+           chip8_fuzz --replay <ROM>... [--budget N]
+           chip8_fuzz --minimize <ROM> [--budget N]
+
+    Workers mutate ROMs from the corpus in DIR/corpus and run each one on a
+    machine reset from PowerOnState() for up to budget instructions, in one
+    of three ways: one instruction at a time through the interpreter, or a
+    frame at a time through Run()'s normal paths, with the recompiler either
+    off or on in verify mode. The opcode class and the edge cases about to
+    be hit (I running past the end of Memory, stack overflow, keys above F,
+    clipped sprites, ...) are recorded before every instruction when
+    stepping, and before every frame otherwise. An input that reaches a new
+    class, a new pair of consecutive classes or a new class/edge pair joins
+    the corpus. A recompiled block that disagrees with the interpreter
+    counts as a crash.
+
+    The way it runs, the quirk profile, CXNN seed and the keys held each
+    frame come from a hash of the ROM, so a ROM always runs the same way. Build with
+    CHIP8_SANITIZE=ON: when a worker dies, its input is written to
+    DIR/crashes, minimized by replaying smaller versions in child processes,
+    saved next to it as .min.ch8, and the worker is restarted. A coverage
+    report over the whole corpus goes to stderr and DIR/coverage.txt at the end.
+*/
+
+enum Edge : uint8_t {
+    EDGE_MEMORY_WRAP,       // an I relative access runs past 0xFFF
+    EDGE_CODE_WRITE,        // FX33/FX55 writes over the ROM
+    EDGE_STACK_OVERFLOW,    // 2NNN with all 16 entries in use
+    EDGE_STACK_UNDERFLOW,   // 00EE on an empty stack
+    EDGE_KEY_RANGE,         // EX9E/EXA1 on a VX above F
+    EDGE_FONT_RANGE,        // FX29/FX30 on a VX above F
+    EDGE_SPRITE_CLIP,       // DXYN reaching past the right or bottom edge
+    EDGE_ODD_PC,            // instruction at an odd address
+    EDGE_PC_WRAP,           // instruction straddling 0xFFF
+    EDGE_HIRES,             // running in 128 x 64
+    EDGES
+};
+
+static char const* const EDGE_NAMES[EDGES] = {
+    "memory_wrap", "code_write", "stack_overflow", "stack_underflow", "key_range",
+    "font_range", "sprite_clip", "odd_pc", "pc_wrap", "hires"
+};
+
+const unsigned int CLASSES = Profiler::OPCODE_CLASSES;
+const unsigned int PAIR_FEATURES = CLASSES * CLASSES;
+const unsigned int FEATURES = PAIR_FEATURES + CLASSES * EDGES;
+const size_t MAX_ROM_SIZE = 0x1000 - 0x200;
+
+enum RunMode : uint8_t {
+    RUN_STEPPED,            // Run(1) per instruction
+    RUN_FRAMES,             // Run() per frame, interpreted
+    RUN_RECOMPILED,         // Run() per frame, recompiler in verify mode
+    RUN_MODES
+};
+
+static char const* const RUN_MODE_NAMES[RUN_MODES] = { "stepped", "frames", "recompiled" };
+
+typedef std::vector<uint8_t> Rom;
+
+struct Options {
+    double seconds = 60.0;
+    unsigned int jobs = 1;
+    uint32_t budget = 4000;
+    uint32_t seed = 1;
+    string out = "fuzz-out";
+    std::vector<string> roms;
+};
+
+struct Coverage {
+    uint8_t seen[FEATURES];
+    uint64_t classHits[CLASSES];
+    uint64_t edgeHits[EDGES];
+};
+
+static uint64_t HashRom(Rom const& rom) {
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for (uint8_t byte : rom) {
+        hash ^= byte;
+        hash *= 0x100000001B3ull;
+    }
+    return hash;
+}
+
+static RunMode ModeOf(uint64_t hash) {
+    return (RunMode)((hash >> 56) % RUN_MODES);
+}
+
+static uint32_t XorShift(uint32_t& state) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+static string HexName(char const* prefix, uint64_t hash, char const* suffix) {
+    char name[64];
+    snprintf(name, sizeof(name), "%s%016llx%s", prefix, (unsigned long long)hash, suffix);
+    return name;
+}
+
+static bool ReadRom(string const& filename, Rom& rom) {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+    rom.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return true;
+}
+
+static bool WriteRom(string const& filename, Rom const& rom) {
+    std::ofstream file(filename, std::ios::binary);
+    file.write((char const*)rom.data(), rom.size());
+    return file.good();
+}
+
+//////////////////////////////////// Running ////////////////////////////////////
+
+// Bit mask of the edges the instruction at PC is about to hit
+static unsigned int Edges(CHIP_8 const& chip8, uint16_t opcode, unsigned int opcodeClass, size_t romSize) {
+    uint16_t pc = chip8.GetPC() & 0x0FFF;
+    uint16_t index = chip8.GetIndex();
+    uint8_t vx = chip8.GetRegister((opcode >> 8) & 0x0F);
+    uint8_t vy = chip8.GetRegister((opcode >> 4) & 0x0F);
+    unsigned int edges = 0;
+    unsigned int accessed = 0;
+    bool writes = false;
+
+    switch (opcodeClass) {
+    case Profiler::CLASS_FX33: accessed = 3; writes = true; break;
+    case Profiler::CLASS_FX55: accessed = ((opcode >> 8) & 0x0F) + 1; writes = true; break;
+    case Profiler::CLASS_FX65: accessed = ((opcode >> 8) & 0x0F) + 1; break;
+    case Profiler::CLASS_DXYN: accessed = (opcode & 0x0F) ? (opcode & 0x0F) : 32; break;
+    case Profiler::CLASS_2NNN: if (chip8.GetSP() >= 16) edges |= 1u << EDGE_STACK_OVERFLOW; break;
+    case Profiler::CLASS_00EE: if (chip8.GetSP() == 0) edges |= 1u << EDGE_STACK_UNDERFLOW; break;
+    case Profiler::CLASS_EX9E:
+    case Profiler::CLASS_EXA1: if (vx > 0x0F) edges |= 1u << EDGE_KEY_RANGE; break;
+    case Profiler::CLASS_FX29:
+    case Profiler::CLASS_FX30: if (vx > 0x0F) edges |= 1u << EDGE_FONT_RANGE; break;
+    }
+    if (accessed && index + accessed > 0x1000) {
+        edges |= 1u << EDGE_MEMORY_WRAP;
+    }
+    if (writes && index < 0x200 + romSize && index + accessed > 0x200) {
+        edges |= 1u << EDGE_CODE_WRITE;
+    }
+    if (opcodeClass == Profiler::CLASS_DXYN) {
+        unsigned int width = chip8.HighResolution() ? HIRES_WIDTH : DISPLAY_WIDTH;
+        unsigned int lines = chip8.HighResolution() ? HIRES_HEIGHT : DISPLAY_HEIGHT;
+        unsigned int size = (opcode & 0x0F) ? 8 : 16;
+        unsigned int height = (opcode & 0x0F) ? (opcode & 0x0F) : 16;
+        if (vx % width + size > width || vy % lines + height > lines) {
+            edges |= 1u << EDGE_SPRITE_CLIP;
+        }
+    }
+    if (pc & 1) {
+        edges |= 1u << EDGE_ODD_PC;
+    }
+    if (pc == 0x0FFF) {
+        edges |= 1u << EDGE_PC_WRAP;
+    }
+    if (chip8.HighResolution()) {
+        edges |= 1u << EDGE_HIRES;
+    }
+    return edges;
+}
+
+// Marks the class and edges of the instruction at PC, and the pair it makes
+// with the one recorded before it
+static void Record(CHIP_8 const& chip8, size_t romSize, unsigned int& previous, Coverage& coverage) {
+    uint16_t pc = chip8.GetPC();
+    uint16_t opcode = (uint16_t)(chip8.GetMemory(pc) << 8 | chip8.GetMemory(pc + 1));
+    unsigned int opcodeClass = Profiler::Classify(opcode);
+    coverage.seen[previous * CLASSES + opcodeClass] = 1;
+    ++coverage.classHits[opcodeClass];
+    for (unsigned int edges = Edges(chip8, opcode, opcodeClass, romSize); edges; edges &= edges - 1) {
+        unsigned int edge = 0;
+        while (!((edges >> edge) & 1)) {
+            ++edge;
+        }
+        coverage.seen[PAIR_FEATURES + opcodeClass * EDGES + edge] = 1;
+        ++coverage.edgeHits[edge];
+    }
+    previous = opcodeClass;
+}
+
+// The input being run, for the crash handlers
+static Rom const* volatile current = nullptr;
+static char crashDirectory[1024];
+
+// Runs rom once and marks every feature it reaches in seen. False if the
+// core refused the ROM
+static bool RunRom(CHIP_8& chip8, Rom const& rom, uint32_t budget, Coverage& coverage) {
+    static MachineState state;
+    if (!CHIP_8::PowerOnState(state, rom.data(), rom.size())) {
+        return false;
+    }
+    uint64_t hash = HashRom(rom);
+    RunMode mode = ModeOf(hash);
+    current = &rom;
+    chip8.Reset(state);
+    chip8.SetQuirks((QuirkProfile)(hash % QUIRK_PROFILES));
+    chip8.SetSeed((uint32_t)(hash >> 8));
+    uint32_t keys = (uint32_t)(hash >> 32) | 1;
+    chip8.SetKeys(0);
+
+    // A fresh recompiler every run, so replaying an input translates the same blocks
+    bool recompiled = chip8.EnableRecompiler(mode == RUN_RECOMPILED, true);
+    uint32_t step = mode == RUN_STEPPED ? 1 : UINT32_MAX;
+
+    unsigned int previous = Profiler::CLASS_NULL;
+    for (uint32_t retired = 0; retired < budget; ) {
+        Record(chip8, rom.size(), previous, coverage);
+        RunResult result = chip8.Run(std::min(step, budget - retired), EXIT_FRAME);
+        retired += result.retired ? result.retired : 1;
+
+        // A few keys change every frame or so
+        if (result.reason & EXIT_FRAME) {
+            if ((XorShift(keys) & 3) == 0) {
+                chip8.SetKeys((uint16_t)XorShift(keys));
+            }
+        }
+    }
+
+    if (recompiled && chip8.GetRecompiler()->Stats().verifyFailures) {
+        fprintf(stderr, "chip8_fuzz: a recompiled block disagreed with the interpreter\n");
+        std::abort();
+    }
+    current = nullptr;
+    return true;
+}
+
+//////////////////////////////////// Crashes ////////////////////////////////////
+
+// Writes the input being run to the crash directory; called while dying, so
+// it sticks to plain C I/O
+static void SaveCurrent() {
+    Rom const* rom = current;
+    if (!rom) {
+        return;
+    }
+    char path[1200];
+    snprintf(path, sizeof(path), "%s/crash-%016llx.ch8", crashDirectory, (unsigned long long)HashRom(*rom));
+    if (FILE* file = fopen(path, "wb")) {
+        fwrite(rom->data(), 1, rom->size(), file);
+        fclose(file);
+        fprintf(stderr, "chip8_fuzz: crashing input saved to %s\n", path);
+    }
+}
+
+static void OnSignal(int signal) {
+    SaveCurrent();
+    std::signal(signal, SIG_DFL);
+    std::raise(signal);
+}
+
+// Sanitizer reports end in abort(), so OnSignal() sees them too; unused
+// without CHIP8_SANITIZE
+extern "C" char const* __asan_default_options() { return "abort_on_error=1"; }
+extern "C" char const* __ubsan_default_options() { return "abort_on_error=1:print_stacktrace=1"; }
+
+static void InstallCrashHandlers(string const& directory) {
+    snprintf(crashDirectory, sizeof(crashDirectory), "%s", directory.c_str());
+    for (int signal : { SIGSEGV, SIGILL, SIGFPE, SIGABRT }) {
+        std::signal(signal, OnSignal);
+    }
+}
+
+////////////////////////////////// Mutation /////////////////////////////////////
+
+// Opcodes that reach the edge cases; X, Y and N are filled in at random
+static const uint16_t OPCODE_TEMPLATES[] = {
+    0x00E0, 0x00EE, 0x00C0, 0x00D0, 0x00FB, 0x00FC, 0x00FD, 0x00FE, 0x00FF,
+    0x1000, 0x2000, 0x3000, 0x4000, 0x5000, 0x6000, 0x7000,
+    0x8000, 0x8001, 0x8002, 0x8003, 0x8004, 0x8005, 0x8006, 0x8007, 0x800E,
+    0x9000, 0xA000, 0xAF00, 0xB000, 0xC000, 0xD000, 0xE09E, 0xE0A1,
+    0xF001, 0xF007, 0xF00A, 0xF015, 0xF018, 0xF01E, 0xF029, 0xF030, 0xF033,
+    0xF055, 0xF065, 0xF075, 0xF085
+};
+
+static uint16_t RandomOpcode(uint32_t& rng) {
+    uint16_t opcode = OPCODE_TEMPLATES[XorShift(rng) % (sizeof(OPCODE_TEMPLATES) / sizeof(OPCODE_TEMPLATES[0]))];
+    switch (opcode >> 12) {
+    case 0x0: return (opcode & 0xFFF0) == 0x00C0 || (opcode & 0xFFF0) == 0x00D0 ? (uint16_t)(opcode | (XorShift(rng) & 0x0F)) : opcode;
+    case 0x1: case 0x2: case 0xB: return (uint16_t)(opcode | (0x200 + (XorShift(rng) & 0x1FF)));
+    case 0x3: case 0x4: case 0x6: case 0x7: case 0xC: return (uint16_t)(opcode | (XorShift(rng) & 0x0FFF));
+    case 0xA: return (uint16_t)(opcode | (XorShift(rng) & 0x0FFF & ((opcode & 0x0F00) ? 0x00FF : 0x0FFF)));
+    case 0x5: case 0x8: case 0x9: case 0xD: return (uint16_t)(opcode | (XorShift(rng) & 0x0FF0) | ((opcode >> 12) == 0xD ? (XorShift(rng) & 0x0F) : 0));
+    }
+    return (uint16_t)(opcode | (XorShift(rng) & 0x0F00));
+}
+
+static void Mutate(Rom& rom, std::vector<Rom> const& corpus, uint32_t& rng) {
+    unsigned int count = 1 + XorShift(rng) % 4;
+    for (unsigned int m = 0; m < count; ++m) {
+        size_t words = rom.size() / 2;
+        size_t at = words ? 2 * (XorShift(rng) % words) : 0;
+        switch (XorShift(rng) % 8) {
+        case 0:     // flip a bit
+            if (!rom.empty()) rom[XorShift(rng) % rom.size()] ^= (uint8_t)(1u << (XorShift(rng) & 7));
+            break;
+        case 1:     // random byte
+            if (!rom.empty()) rom[XorShift(rng) % rom.size()] = (uint8_t)XorShift(rng);
+            break;
+        case 2:     // overwrite an instruction
+        case 3:
+            if (words) {
+                uint16_t opcode = RandomOpcode(rng);
+                rom[at] = (uint8_t)(opcode >> 8);
+                rom[at + 1] = (uint8_t)opcode;
+            }
+            break;
+        case 4:     // insert an instruction
+            if (rom.size() + 2 <= MAX_ROM_SIZE) {
+                uint16_t opcode = RandomOpcode(rng);
+                rom.insert(rom.begin() + at, { (uint8_t)(opcode >> 8), (uint8_t)opcode });
+            }
+            break;
+        case 5:     // delete an instruction
+            if (words > 1) rom.erase(rom.begin() + at, rom.begin() + at + 2);
+            break;
+        case 6:     // repeat a run of instructions
+            if (words) {
+                size_t length = 2 * (1 + XorShift(rng) % 8);
+                length = std::min(length, rom.size() - at);
+                if (rom.size() + length <= MAX_ROM_SIZE) {
+                    Rom run(rom.begin() + at, rom.begin() + at + length);
+                    rom.insert(rom.begin() + at, run.begin(), run.end());
+                }
+            }
+            break;
+        case 7:     // splice in the tail of another input
+            if (!corpus.empty()) {
+                Rom const& other = corpus[XorShift(rng) % corpus.size()];
+                size_t from = other.empty() ? 0 : 2 * (XorShift(rng) % ((other.size() + 1) / 2));
+                rom.resize(at);
+                rom.insert(rom.end(), other.begin() + std::min(from, other.size()), other.end());
+                if (rom.size() > MAX_ROM_SIZE) rom.resize(MAX_ROM_SIZE);
+            }
+            break;
+        }
+    }
+}
+
+//////////////////////////////////// Worker /////////////////////////////////////
+
+static std::vector<Rom> LoadCorpus(string const& directory) {
+    std::vector<Rom> corpus;
+    std::error_code error;
+    for (auto const& entry : fs::directory_iterator(directory, error)) {
+        Rom rom;
+        if (entry.path().extension() == ".ch8" && ReadRom(entry.path().string(), rom)) {
+            corpus.push_back(rom);
+        }
+    }
+    if (corpus.empty()) {
+        // Draw a digit, wait for a key, go again
+        corpus.push_back({ 0x00, 0xE0, 0xA0, 0x50, 0xD0, 0x15, 0xF0, 0x0A, 0x12, 0x00 });
+    }
+    return corpus;
+}
+
+// Adds the features of one run to the total; true if any was new
+static bool Merge(Coverage& total, Coverage const& run) {
+    bool found = false;
+    for (unsigned int f = 0; f < FEATURES; ++f) {
+        if (run.seen[f] && !total.seen[f]) {
+            total.seen[f] = 1;
+            found = true;
+        }
+    }
+    for (unsigned int c = 0; c < CLASSES; ++c) {
+        total.classHits[c] += run.classHits[c];
+    }
+    for (unsigned int e = 0; e < EDGES; ++e) {
+        total.edgeHits[e] += run.edgeHits[e];
+    }
+    return found;
+}
+
+static unsigned int CountFeatures(Coverage const& coverage) {
+    unsigned int count = 0;
+    for (unsigned int f = 0; f < FEATURES; ++f) {
+        count += coverage.seen[f];
+    }
+    return count;
+}
+
+static int Work(Options const& options) {
+    string corpusDirectory = options.out + "/corpus";
+    std::error_code error;
+    fs::create_directories(corpusDirectory, error);
+    fs::create_directories(options.out + "/crashes", error);
+    InstallCrashHandlers(options.out + "/crashes");
+
+    std::vector<Rom> corpus = LoadCorpus(corpusDirectory);
+    std::unique_ptr<CHIP_8> chip8(new CHIP_8());
+    std::unique_ptr<Coverage> total(new Coverage());
+    std::unique_ptr<Coverage> run(new Coverage());
+    memset(total.get(), 0, sizeof(Coverage));
+    for (Rom const& rom : corpus) {
+        memset(run.get(), 0, sizeof(Coverage));
+        RunRom(*chip8, rom, options.budget, *run);
+        Merge(*total, *run);
+    }
+
+    uint32_t rng = options.seed ? options.seed : 1;
+    uint64_t executions = 0;
+    auto start = std::chrono::steady_clock::now();
+    auto lastReport = start;
+    for (;;) {
+        auto now = std::chrono::steady_clock::now();
+        double elapsed = std::chrono::duration<double>(now - start).count();
+        if (elapsed >= options.seconds) {
+            break;
+        }
+        if (now - lastReport >= std::chrono::seconds(5)) {
+            fprintf(stderr, "#%llu  %.0f exec/s  corpus %zu  features %u/%u\n", (unsigned long long)executions,
+                    executions / elapsed, corpus.size(), CountFeatures(*total), FEATURES);
+            lastReport = now;
+        }
+
+        Rom rom = corpus[XorShift(rng) % corpus.size()];
+        Mutate(rom, corpus, rng);
+        memset(run.get(), 0, sizeof(Coverage));
+        if (!RunRom(*chip8, rom, options.budget, *run)) {
+            continue;
+        }
+        ++executions;
+        if (Merge(*total, *run)) {
+            corpus.push_back(rom);
+            WriteRom(corpusDirectory + "/" + HexName("", HashRom(rom), ".ch8"), rom);
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+///////////////////////////////// Supervisor ////////////////////////////////////
+
+static string Quote(string const& text) {
+    return "\"" + text + "\"";
+}
+
+#ifdef _WIN32
+static const char* const QUIET = " >NUL 2>&1";
+#else
+static const char* const QUIET = " >/dev/null 2>&1";
+#endif
+
+// True if rom still kills a child process replaying it
+static bool Crashes(string const& self, Options const& options, Rom const& rom, string const& scratch) {
+    WriteRom(scratch, rom);
+    string command = Quote(self) + " --replay " + Quote(scratch) + " --budget " + std::to_string(options.budget) + QUIET;
+    return std::system(command.c_str()) != 0;
+}
+
+// Drops runs of instructions, then blanks single ones, while the crash persists
+static Rom Minimize(string const& self, Options const& options, Rom rom, string const& scratch) {
+    const unsigned int MAX_ATTEMPTS = 2000;
+    unsigned int attempts = 0;
+    for (size_t chunk = (rom.size() / 4) * 2; chunk >= 2 && attempts < MAX_ATTEMPTS; chunk = chunk > 2 ? (chunk / 4) * 2 : 0) {
+        for (size_t at = 0; at < rom.size() && attempts < MAX_ATTEMPTS; ) {
+            Rom smaller(rom);
+            smaller.erase(smaller.begin() + at, smaller.begin() + std::min(at + chunk, smaller.size()));
+            ++attempts;
+            if (!smaller.empty() && Crashes(self, options, smaller, scratch)) {
+                rom = smaller;
+            }
+            else {
+                at += chunk;
+            }
+        }
+    }
+    for (size_t at = 0; at + 1 < rom.size() && attempts < MAX_ATTEMPTS; at += 2) {
+        if (rom[at] == 0 && rom[at + 1] == 0) {
+            continue;
+        }
+        Rom blanked(rom);
+        blanked[at] = blanked[at + 1] = 0;
+        ++attempts;
+        if (Crashes(self, options, blanked, scratch)) {
+            rom = blanked;
+        }
+    }
+    std::error_code error;
+    fs::remove(scratch, error);
+    return rom;
+}
+
+static void MinimizeNewCrashes(string const& self, Options const& options, std::mutex& lock) {
+    std::lock_guard<std::mutex> guard(lock);
+    string directory = options.out + "/crashes";
+    std::error_code error;
+    for (auto const& entry : fs::directory_iterator(directory, error)) {
+        string path = entry.path().string();
+        string minimized = path.substr(0, path.size() - 4) + ".min.ch8";
+        Rom rom;
+        if (entry.path().extension() != ".ch8" || path.find(".min.") != string::npos || fs::exists(minimized) || !ReadRom(path, rom)) {
+            continue;
+        }
+        rom = Minimize(self, options, rom, directory + "/.candidate");
+        WriteRom(minimized, rom);
+        std::cerr << "chip8_fuzz: minimized " << path << " to " << rom.size() << " bytes: " << minimized << "\n";
+    }
+}
+
+static void ReportCoverage(Options const& options) {
+    std::vector<Rom> corpus = LoadCorpus(options.out + "/corpus");
+    std::unique_ptr<CHIP_8> chip8(new CHIP_8());
+    std::unique_ptr<Coverage> total(new Coverage());
+    std::unique_ptr<Coverage> run(new Coverage());
+    memset(total.get(), 0, sizeof(Coverage));
+    for (Rom const& rom : corpus) {
+        memset(run.get(), 0, sizeof(Coverage));
+        RunRom(*chip8, rom, options.budget, *run);
+        Merge(*total, *run);
+    }
+
+    std::ostringstream out;
+    out << "Corpus: " << corpus.size() << " ROMs, " << CountFeatures(*total) << "/" << FEATURES << " features\n";
+    out << "Opcode classes (instructions run by the corpus):\n";
+    for (unsigned int c = 0; c < CLASSES; ++c) {
+        char line[80];
+        snprintf(line, sizeof(line), "  %-6s %14llu%s\n", Profiler::ClassName(c), (unsigned long long)total->classHits[c],
+                 total->classHits[c] ? "" : "  never reached");
+        out << line;
+    }
+    out << "Edge cases (instructions that hit them):\n";
+    for (unsigned int e = 0; e < EDGES; ++e) {
+        char line[80];
+        snprintf(line, sizeof(line), "  %-16s %14llu%s\n", EDGE_NAMES[e], (unsigned long long)total->edgeHits[e],
+                 total->edgeHits[e] ? "" : "  never reached");
+        out << line;
+    }
+    std::cerr << out.str();
+    std::ofstream(options.out + "/coverage.txt") << out.str();
+}
+
+static int Supervise(string const& self, Options const& options) {
+    std::error_code error;
+    fs::create_directories(options.out + "/corpus", error);
+    fs::create_directories(options.out + "/crashes", error);
+    for (string const& filename : options.roms) {
+        Rom rom;
+        if (!ReadRom(filename, rom)) {
+            std::cerr << "Failed to open ROM: " << filename << "\n";
+            return EXIT_FAILURE;
+        }
+        WriteRom(options.out + "/corpus/" + HexName("", HashRom(rom), ".ch8"), rom);
+    }
+
+    // Each job restarts its worker until time is up; a worker only stops early when it dies
+    auto end = std::chrono::steady_clock::now() + std::chrono::duration<double>(options.seconds);
+    std::atomic<unsigned int> crashes{ 0 };
+    std::mutex minimizing;
+    std::vector<std::thread> jobs;
+    for (unsigned int j = 0; j < options.jobs; ++j) {
+        jobs.emplace_back([&, j]() {
+            for (uint32_t restart = 0; ; ++restart) {
+                double left = std::chrono::duration<double>(end - std::chrono::steady_clock::now()).count();
+                if (left <= 0.5) {
+                    break;
+                }
+                std::ostringstream command;
+                command << Quote(self) << " --worker --seconds " << left << " --budget " << options.budget
+                        << " --seed " << (options.seed + j * 7919u + restart * 104729u) << " --out " << Quote(options.out);
+                if (std::system(command.str().c_str()) == 0) {
+                    break;
+                }
+                ++crashes;
+                MinimizeNewCrashes(self, options, minimizing);
+            }
+        });
+    }
+    for (std::thread& job : jobs) {
+        job.join();
+    }
+
+    ReportCoverage(options);
+    std::cerr << crashes << " worker crashes, inputs in " << options.out << "/crashes\n";
+    return crashes ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// Runs each ROM once, the way a worker would; dies if the ROM crashes the core
+static int Replay(Options const& options) {
+    std::unique_ptr<CHIP_8> chip8(new CHIP_8());
+    std::unique_ptr<Coverage> run(new Coverage());
+    for (string const& filename : options.roms) {
+        Rom rom;
+        if (!ReadRom(filename, rom)) {
+            std::cerr << "Failed to open ROM: " << filename << "\n";
+            return EXIT_FAILURE;
+        }
+        memset(run.get(), 0, sizeof(Coverage));
+        uint64_t hash = HashRom(rom);
+        bool loaded = RunRom(*chip8, rom, options.budget, *run);
+        std::cerr << filename << ": " << (loaded ? "ok" : "rejected") << ", " << RUN_MODE_NAMES[ModeOf(hash)]
+                  << ", quirks " << QuirkProfileName((QuirkProfile)(hash % QUIRK_PROFILES))
+                  << ", seed " << (uint32_t)(hash >> 8) << ", " << CountFeatures(*run) << " features\n";
+    }
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    enum { SUPERVISE, WORK, REPLAY, MINIMIZE } mode = SUPERVISE;
+    bool usage = false;
+    for (int a = 1; a < argc && !usage; ++a) {
+        string arg = argv[a];
+        if (arg == "--seconds" && a + 1 < argc) {
+            options.seconds = std::stod(argv[++a]);
+        }
+        else if (arg == "--jobs" && a + 1 < argc) {
+            options.jobs = (unsigned int)std::stoul(argv[++a]);
+        }
+        else if (arg == "--budget" && a + 1 < argc) {
+            options.budget = (uint32_t)std::stoul(argv[++a]);
+        }
+        else if (arg == "--seed" && a + 1 < argc) {
+            options.seed = (uint32_t)std::stoul(argv[++a]);
+        }
+        else if (arg == "--out" && a + 1 < argc) {
+            options.out = argv[++a];
+        }
+        else if (arg == "--worker") {
+            mode = WORK;
+        }
+        else if (arg == "--replay") {
+            mode = REPLAY;
+        }
+        else if (arg == "--minimize") {
+            mode = MINIMIZE;
+        }
+        else if (arg.size() > 1 && arg[0] == '-') {
+            usage = true;
+        }
+        else {
+            options.roms.push_back(arg);
+        }
+    }
+    if (usage || ((mode == REPLAY || mode == MINIMIZE) && options.roms.empty()) || (mode == MINIMIZE && options.roms.size() > 1)) {
+        std::cerr << "Usage: " << argv[0] << " [--seconds S] [--jobs N] [--budget N] [--seed N] [--out DIR] [seed ROM...]\n"
+                  << "       " << argv[0] << " --replay <ROM>... [--budget N]\n"
+                  << "       " << argv[0] << " --minimize <ROM> [--budget N]\n";
+        std::exit(EXIT_FAILURE);
+    }
+
+    switch (mode) {
+    case WORK:
+        return Work(options);
+    case REPLAY:
+        return Replay(options);
+    case MINIMIZE: {
+        Rom rom;
+        if (!ReadRom(options.roms[0], rom)) {
+            std::cerr << "Failed to open ROM: " << options.roms[0] << "\n";
+            return EXIT_FAILURE;
+        }
+        if (!Crashes(argv[0], options, rom, options.roms[0] + ".candidate")) {
+            std::cerr << options.roms[0] << " does not crash\n";
+            return EXIT_FAILURE;
+        }
+        string minimized = options.roms[0].substr(0, options.roms[0].rfind('.')) + ".min.ch8";
+        rom = Minimize(argv[0], options, rom, options.roms[0] + ".candidate");
+        WriteRom(minimized, rom);
+        std::cerr << "Minimized to " << rom.size() << " bytes: " << minimized << "\n";
+        return EXIT_SUCCESS;
+    }
+    default:
+        return Supervise(argv[0], options);
+    }
+}
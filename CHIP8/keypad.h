@@ -0,0 +1,186 @@
+#pragma once
+
+#include "SpscRing.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/*
+    Host keyboard to CHIP-8 keypad.
+
+    Key state is a single atomic 16-bit mask, written by whichever thread
+    handles host events and latched into the machine by the emulation thread
+    once per frame. Host keys go through a lookup table, so an event costs
+    one load and one atomic update.
+
+    Every press and release is also timestamped, to measure input-to-photon
+    latency: from the host event to the presentation of the first frame that
+    ran with the event latched and changed the Display. Events whose frames
+    change nothing for MAX_PENDING_FRAMES frames are counted as unanswered.
+*/
+class Keypad {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr char const* DEFAULT_KEYMAP = "x123qweasdzc4rfv";
+    static constexpr unsigned int MAX_PENDING_FRAMES = 30;
+    static constexpr size_t MAX_SAMPLES = 1 << 16;
+
+    Keypad() {
+        SetKeymap(DEFAULT_KEYMAP);
+        pending.reserve(events.Capacity());
+        samples.reserve(1024);
+    }
+
+    // keymap[k] is the host key for CHIP-8 key k: 16 distinct letters,
+    // digits or punctuation. Returns false (and keeps the old map) otherwise.
+    bool SetKeymap(std::string const& keymap) {
+        if (keymap.size() != 16) {
+            return false;
+        }
+        int8_t table[LOOKUP_SIZE];
+        std::fill(table, table + LOOKUP_SIZE, (int8_t)-1);
+        for (unsigned int k = 0; k < 16; ++k) {
+            int slot = Slot((unsigned char)keymap[k]);
+            if (slot < 0 || table[slot] >= 0) {
+                return false;
+            }
+            table[slot] = (int8_t)k;
+        }
+        std::copy(table, table + LOOKUP_SIZE, lookup);
+        return true;
+    }
+
+    // CHIP-8 key for a host key code, -1 if unmapped. Codes below 256 are
+    // characters; codes with bit 30 set are SDL scancode keys (arrows, ...).
+    int Map(int32_t hostKey) const {
+        int slot = Slot(hostKey);
+        return slot < 0 ? -1 : lookup[slot];
+    }
+
+    // Event thread. False if hostKey is not a keypad key
+    bool Press(int32_t hostKey) { return Change(hostKey, true); }
+    bool Release(int32_t hostKey) { return Change(hostKey, false); }
+
+    uint16_t Mask() const { return mask.load(std::memory_order_acquire); }
+
+    // Emulation thread, once per frame: the mask to run the frame with
+    uint16_t Latch() {
+        Clock::time_point stamp;
+        while (events.Pop(stamp)) {
+            if (pending.size() < events.Capacity()) {
+                pending.push_back(Pending{ stamp, 0 });
+            }
+        }
+        return Mask();
+    }
+
+    // Emulation thread, after a latched frame changed the Display: moves the
+    // stamps of the events it answers (at most max) to stamps
+    size_t Answer(Clock::time_point* stamps, size_t max) {
+        size_t count = std::min(pending.size(), max);
+        for (size_t i = 0; i < count; ++i) {
+            stamps[i] = pending[i].stamp;
+        }
+        unanswered += pending.size() - count;
+        pending.clear();
+        return count;
+    }
+
+    // Emulation thread, after a latched frame left the Display unchanged
+    void Unchanged() {
+        size_t kept = 0;
+        for (Pending& event : pending) {
+            if (++event.frames < MAX_PENDING_FRAMES) {
+                pending[kept++] = event;
+            }
+            else {
+                ++unanswered;
+            }
+        }
+        pending.resize(kept);
+    }
+
+    // Render thread, once a frame that answered events is on screen
+    void Presented(Clock::time_point const* stamps, size_t count) {
+        Clock::time_point now = Clock::now();
+        for (size_t i = 0; i < count && samples.size() < MAX_SAMPLES; ++i) {
+            samples.push_back(std::chrono::duration<double, std::milli>(now - stamps[i]).count());
+        }
+    }
+
+    // Input-to-photon latencies measured so far, in milliseconds. Read them
+    // once both threads have stopped
+    std::vector<double> const& Latencies() const { return samples; }
+    uint64_t Unanswered() const { return unanswered; }
+
+    void Report(std::ostream& out) const {
+        char line[160];
+        if (samples.empty()) {
+            snprintf(line, sizeof(line), "Input latency: no answered events, %llu unanswered\n", (unsigned long long)unanswered);
+            out << line;
+            return;
+        }
+        std::vector<double> sorted(samples);
+        std::sort(sorted.begin(), sorted.end());
+        double total = 0;
+        for (double ms : sorted) {
+            total += ms;
+        }
+        snprintf(line, sizeof(line), "Input latency: %zu events, mean %.2f ms, median %.2f ms, p95 %.2f ms, max %.2f ms, %llu unanswered\n",
+                 sorted.size(), total / sorted.size(), sorted[sorted.size() / 2], sorted[sorted.size() * 95 / 100], sorted.back(),
+                 (unsigned long long)unanswered);
+        out << line;
+    }
+
+private:
+    static constexpr int LOOKUP_SIZE = 512;
+    static constexpr int32_t SCANCODE_KEY = 1 << 30;      // SDLK_SCANCODE_MASK
+
+    static int Slot(int32_t hostKey) {
+        if (hostKey >= 0 && hostKey < 256) {
+            return hostKey >= 'A' && hostKey <= 'Z' ? hostKey - 'A' + 'a' : hostKey;
+        }
+        if ((hostKey & SCANCODE_KEY) && (hostKey & ~SCANCODE_KEY) < 256) {
+            return 256 + (hostKey & 0xFF);
+        }
+        return -1;
+    }
+
+    bool Change(int32_t hostKey, bool down) {
+        int key = Map(hostKey);
+        if (key < 0) {
+            return false;
+        }
+        uint16_t bit = (uint16_t)(1u << key);
+        if (down) {
+            mask.fetch_or(bit, std::memory_order_release);
+        }
+        else {
+            mask.fetch_and((uint16_t)~bit, std::memory_order_release);
+        }
+        events.Push(Clock::now());          // dropped if the emulation thread has stalled
+        return true;
+    }
+
+    struct Pending {
+        Clock::time_point stamp;
+        unsigned int frames;        // unchanged frames run since it was latched
+    };
+
+    int8_t lookup[LOOKUP_SIZE];
+    std::atomic<uint16_t> mask{ 0 };
+    SpscRing<Clock::time_point, 64> events;
+
+    // Emulation thread only
+    std::vector<Pending> pending;
+    uint64_t unanswered{};
+
+    // Render thread only
+    std::vector<double> samples;
+};
@@ -1,33 +1,68 @@
 ﻿#include "CHIP_8.h"
+#include "frame.h"
+#include "Movie.h"
 #include "platform.h"
+#include "Rewind.h"
+#include "scheduler.h"
+#include <atomic>
 #include <chrono>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
+#include <memory>
 #include <SDL.h>
 #include <string>
-#include <chrono>
-#include <cstdint>
-#include <cstring>
-#include <fstream>
-#include <random>
-#include <cstdint>
-#include <random>
+#include <thread>
 using std::cout;
-using std::istringstream;
 using std::string;
 
-const unsigned int DISPLAY_HEIGHT = 32;
-const unsigned int DISPLAY_WIDTH = 64;
-
 int main(int argc, char* argv[]) {
-    if (argc != 4) {
-        cout << argc << "\n";
-        cout << argv[0] << " " << argv[1] << " " << argv[2] << " " << argv[3] << "\n";
-        std::cerr << "Usage: " << argv[0] << " <Scale> <Delay> <ROM>\n";
+    bool recording = false;
+    bool replaying = false;
+    bool profiling = false;
+    bool measureLatency = false;
+    char const* movieFilename = nullptr;
+    string keymap = Keypad::DEFAULT_KEYMAP;
+    string palette = "000000,FFFFFF";
+    double phosphor = 0.0;
+    QuirkProfile quirks = DEFAULT_QUIRKS;
+    bool usage = argc < 4;
+    for (int a = 4; a < argc && !usage; ++a) {
+        string arg = argv[a];
+        if ((arg == "--record" || arg == "--replay") && a + 1 < argc && !movieFilename) {
+            recording = arg == "--record";
+            replaying = !recording;
+            movieFilename = argv[++a];
+        }
+        else if (arg == "--keymap" && a + 1 < argc) {
+            keymap = argv[++a];
+        }
+        else if (arg == "--palette" && a + 1 < argc) {
+            palette = argv[++a];
+        }
+        else if (arg == "--phosphor" && a + 1 < argc) {
+            phosphor = std::stod(argv[++a]);
+        }
+        else if (arg == "--quirks" && a + 1 < argc) {
+            usage = !FindQuirkProfile(argv[++a], quirks);
+        }
+        else if (arg == "--profile") {
+            profiling = true;
+        }
+        else if (arg == "--latency") {
+            measureLatency = true;
+        }
+        else {
+            usage = true;
+        }
+    }
+    if (usage) {
+        std::cerr << "Usage: " << argv[0] << " <Scale> <Delay> <ROM> [--record <Movie> | --replay <Movie>] [--keymap <16 keys>] [--palette <RRGGBB,RRGGBB[,RRGGBB,RRGGBB]>] [--phosphor <0-1>] [--quirks vip|chip48|schip|modern|classic] [--profile] [--latency]\n";
         std::exit(EXIT_FAILURE);
     }
     cout << argv[0] << " " << argv[1] << " " << argv[2] << " " << argv[3] << "\n";
     int videoScale = std::stoi(argv[1]);
-    int cycleDelay = std::stoi(argv[2]);
+    double cycleDelay = std::stod(argv[2]);     // milliseconds per instruction, may be fractional
     char const* romFilename = argv[3];
 
     // Initialize SDL
@@ -36,44 +71,161 @@ int main(int argc, char* argv[]) {
         return -1;
     }
 
-    // Set up audio
-    SDL_AudioSpec wavSpec;
-    Uint32 wavLength;
-    Uint8* wavBuffer;
-
-    if (SDL_LoadWAV("beep.wav", &wavSpec, &wavBuffer, &wavLength) == NULL) {
-        std::cerr << "Failed to load WAV: " << SDL_GetError() << std::endl;
+    Platform platform("CHIP-8 Emulator", DISPLAY_WIDTH * videoScale, DISPLAY_HEIGHT * videoScale, DISPLAY_WIDTH * videoScale, DISPLAY_HEIGHT * videoScale);
+    if (!platform.GetKeypad().SetKeymap(keymap)) {
+        std::cerr << "Invalid keymap, expected 16 distinct keys for 0-F: " << keymap << std::endl;
         return -1;
     }
-
-    SDL_AudioDeviceID deviceId = SDL_OpenAudioDevice(NULL, 0, &wavSpec, NULL, 0);
-    if (deviceId == 0) {
-        std::cerr << "Failed to open audio device: " << SDL_GetError() << std::endl;
+    // 2 colors (off, on) or 4 (off, plane 0, plane 1, both planes), in hex
+    uint32_t colors[4];
+    size_t count = 0;
+    for (size_t begin = 0; count < 4 && begin <= palette.size(); ++count) {
+        size_t end = palette.find(',', begin);
+        colors[count] = (uint32_t)std::stoul(palette.substr(begin, end - begin), nullptr, 16);
+        begin = end == string::npos ? palette.size() + 1 : end + 1;
+    }
+    if (count != 2 && count != 4) {
+        std::cerr << "Invalid palette, expected <off>,<on> or <off>,<plane 0>,<plane 1>,<both> colors in hex: " << palette << std::endl;
         return -1;
     }
+    Presenter& presenter = platform.GetPresenter();
+    if (count == 2) {
+        presenter.SetPalette(colors[0], colors[1]);
+    }
+    else {
+        presenter.SetPalette(colors[0], colors[1], colors[2], colors[3]);
+    }
+    presenter.SetPersistence(phosphor);
 
-    Platform platform("CHIP-8 Emulator", DISPLAY_WIDTH * videoScale, DISPLAY_HEIGHT * videoScale, DISPLAY_WIDTH, DISPLAY_HEIGHT);
+    Keypad& keypad = platform.GetKeypad();
+    SquareWave buzzer;
+    FrameHandoff handoff(keypad);
     CHIP_8 chip8;
-    chip8.LoadROM(romFilename);
-    int videoPitch = sizeof(chip8.Display[0][0]) * DISPLAY_WIDTH;
-    auto lastCycleTime = std::chrono::high_resolution_clock::now();
-    bool quit = false;
+    chip8.Attach(&buzzer, &handoff, nullptr);
+    chip8.SetQuirks(quirks);
+    if (!chip8.LoadROM(romFilename)) {
+        std::cerr << "Failed to load ROM: " << romFilename << std::endl;
+        return -1;
+    }
+
+    // Timers tick at 60 Hz, so the instruction rate is run as whole frames
+    double instructionsPerSecond = cycleDelay > 0 ? 1000.0 / cycleDelay : DEFAULT_CYCLES_PER_FRAME * 60.0;
+    FrameScheduler scheduler(instructionsPerSecond);
+    chip8.SetCyclesPerFrame(scheduler.CyclesPerFrame());
 
-    while (!quit) {
-        quit = platform.ProcessInput(chip8.keypad);
-        auto currentTime = std::chrono::high_resolution_clock::now();
-        float dt = std::chrono::duration<float, std::chrono::milliseconds::period>(currentTime - lastCycleTime).count();
-        if (dt > cycleDelay) {
-            lastCycleTime = currentTime;
-            chip8.Cycle();
-            platform.Update(chip8.Display, videoPitch);
+    if (profiling) {
+        chip8.EnableProfiler(true);
+    }
+
+    Movie movie;
+    if (recording) {
+        movie.StartRecording(chip8, (uint32_t)std::chrono::system_clock::now().time_since_epoch().count());
+    }
+    if (replaying) {
+        if (!movie.Load(movieFilename)) {
+            std::cerr << "Failed to load movie: " << movieFilename << std::endl;
+            return -1;
         }
+        movie.StartReplay(chip8);
     }
 
-    // Clean up audio
-    SDL_CloseAudioDevice(deviceId);
-    SDL_FreeWAV(wavBuffer);
-    SDL_Quit();
+    RewindBuffer rewind;
+    std::atomic<bool> quit{ false };
+
+    // Posted by the emulation thread for every published frame, and when it
+    // stops, so the render thread can sleep until there is something to do
+    Uint32 wakeEvent = SDL_RegisterEvents(1);
+    auto wakeRenderer = [wakeEvent]() {
+        SDL_Event event{};
+        event.type = wakeEvent;
+        SDL_PushEvent(&event);
+    };
+
+    // Emulation runs on its own thread at the scheduler's pace. Finished
+    // frames go to the render thread through the handoff and keys come back
+    // through the keypad's atomic mask, so neither thread waits on the other.
+    std::thread emulation([&]() {
+        while (!quit.load(std::memory_order_relaxed)) {
+            if (platform.RewindHeld() && !recording && !replaying) {
+                // Step back one recorded frame per frame instead of running
+                rewind.Rewind(chip8, 1);
+                if (chip8.Present()) {
+                    wakeRenderer();
+                }
+                scheduler.FrameDone();
+                continue;
+            }
+
+            // The keypad only changes between frames, which keeps runs repeatable.
+            // While a movie replays, the host keyboard only drives the window.
+            uint16_t held = keypad.Latch();
+            if (!replaying) {
+                chip8.SetKeys(held);
+            }
+            if (recording) {
+                movie.RecordFrame(chip8);
+            }
+            if (replaying && !movie.ReplayFrame(chip8)) {
+                quit = true;
+                wakeRenderer();
+                break;
+            }
+            chip8.Run(UINT32_MAX, EXIT_FRAME);
+            if (chip8.Present()) {
+                wakeRenderer();
+            }
+            else {
+                keypad.Unchanged();
+            }
+            rewind.Record(chip8);
+
+            scheduler.FrameDone();
+        }
+    });
 
+    // This thread owns SDL: it handles window and key events and shows the
+    // newest finished frame. It sleeps until an event or a published frame
+    // wakes it, or until the next fade step while pixels fade out.
+    uint16_t hostKeys = 0;
+    std::unique_ptr<Frame> shown(new Frame());
+    const auto fadeStep = std::chrono::microseconds(1000000 / FrameScheduler::FRAMES_PER_SECOND);
+    auto lastShown = std::chrono::steady_clock::now();
+    while (!quit.load(std::memory_order_relaxed)) {
+        int timeoutMs = -1;
+        if (presenter.Fading()) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(lastShown + fadeStep - std::chrono::steady_clock::now()).count();
+            timeoutMs = left > 0 ? (int)left + 1 : 0;
+        }
+        if (platform.WaitInput(hostKeys, timeoutMs)) {
+            quit = true;
+        }
+        auto now = std::chrono::steady_clock::now();
+        unsigned int top, bottom;
+        if (Frame const* frame = handoff.Newest(top, bottom)) {
+            *shown = *frame;
+            if (top < bottom || presenter.Persistent()) {
+                platform.Update(shown->planes, shown->hires, top, bottom);
+            }
+            handoff.Presented(*frame);
+            lastShown = now;
+        }
+        else if (presenter.Fading() && now - lastShown >= fadeStep) {
+            // Keep fading out pixels that went dark, at 60 Hz, while the game draws nothing
+            platform.Update(shown->planes, shown->hires, 0, shown->hires ? HIRES_HEIGHT : DISPLAY_HEIGHT);
+            lastShown = now;
+        }
+    }
+    emulation.join();
+
+    if (measureLatency) {
+        keypad.Report(std::cerr);
+    }
+    if (profiling) {
+        chip8.GetProfiler()->Dump(std::cerr);
+    }
+    if (recording && !movie.Save(movieFilename)) {
+        std::cerr << "Failed to save movie: " << movieFilename << std::endl;
+        return -1;
+    }
     return 0;
-}
\ No newline at end of file
+}
@@ -1,16 +1,24 @@
 #pragma once
 
+#include "CHIP_8.h"
+#include "keypad.h"
+#include "Presenter.h"
+#include "SpscRing.h"
 #include <SDL.h>
+#include <algorithm>
+#include <atomic>
 #include <cmath>
 #include <iostream>
 
-class Platform {
+class Platform : public VideoSink, public InputSource {
 public:
+    // The texture is pre-scaled by textureWidth / HIRES_WIDTH, so the window shows it 1:1
     Platform(char const* title, int windowWidth, int windowHeight, int textureWidth, int textureHeight) {
         SDL_Init(SDL_INIT_VIDEO);
         window = SDL_CreateWindow(title, 0, 0, windowWidth, windowHeight, SDL_WINDOW_SHOWN);
         renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
-        texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, textureWidth, textureHeight);
+        presenter.SetScale(std::min(textureWidth / (int)HIRES_WIDTH, textureHeight / (int)HIRES_HEIGHT));
+        texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, presenter.Width(), presenter.Height());
     }
     ~Platform() {
         SDL_DestroyTexture(texture);
@@ -18,134 +26,168 @@ public:
         SDL_DestroyWindow(window);
         SDL_Quit();
     }
-    void Update(void const* buffer, int pitch) {
-        SDL_UpdateTexture(texture, nullptr, buffer, pitch);
+    void Update(DisplayPlanes const& planes, bool hires, unsigned int top, unsigned int bottom) override {
+        // Expand only the changed rows (all of them while pixels fade), straight into the texture memory
+        if (presenter.Persistent()) {
+            top = 0;
+            bottom = hires ? HIRES_HEIGHT : DISPLAY_HEIGHT;
+        }
+        unsigned int rowHeight = presenter.RowHeight(hires);
+        SDL_Rect area = { 0, (int)(top * rowHeight), (int)presenter.Width(), (int)((bottom - top) * rowHeight) };
+        void* pixels;
+        int pitch;
+        if (SDL_LockTexture(texture, &area, &pixels, &pitch) == 0) {
+            presenter.Render(planes, hires, top, bottom, pixels, pitch);
+            SDL_UnlockTexture(texture);
+        }
         SDL_RenderClear(renderer);
         SDL_RenderCopy(renderer, texture, nullptr, nullptr);
         SDL_RenderPresent(renderer);
     }
-    bool ProcessInput(uint8_t* keys) {
+    // Palette, persistence and scale of the image
+    Presenter& GetPresenter() { return presenter; }
+    bool ProcessInput(uint16_t& keys) override {
         bool quit = false;
         SDL_Event event;
         while (SDL_PollEvent(&event)) {
-            switch (event.type) {
-            case SDL_QUIT:
+            quit |= HandleEvent(event);
+        }
+        keys = keypad.Mask();
+        return quit;
+    }
+    // Sleeps until an event arrives or timeoutMs passes (forever if negative), then drains the queue
+    bool WaitInput(uint16_t& keys, int timeoutMs) {
+        SDL_Event event;
+        if (!(timeoutMs < 0 ? SDL_WaitEvent(&event) : SDL_WaitEventTimeout(&event, timeoutMs))) {
+            return false;
+        }
+        return HandleEvent(event) | ProcessInput(keys);
+    }
+    // Backspace runs the game backwards while held
+    bool RewindHeld() const { return rewindHeld.load(std::memory_order_relaxed); }
+    Keypad& GetKeypad() { return keypad; }
+private:
+    bool HandleEvent(SDL_Event const& event) {
+        bool quit = false;
+        switch (event.type) {
+        case SDL_QUIT:
+            quit = true;
+            break;
+        case SDL_KEYDOWN:
+            if (event.key.keysym.sym == SDLK_ESCAPE) {
                 quit = true;
-                break;
-            case SDL_KEYDOWN:
-                switch (event.key.keysym.sym) {
-                case SDLK_ESCAPE:
-                    quit = true;
-                    break;
-                    // Handle other keys for CHIP-8 keypad
-                case SDLK_x:
-                    keys[0] = 1;
-                    break;
-                case SDLK_1:
-                    keys[1] = 1;
-                    break;
-                case SDLK_2:
-                    keys[2] = 1;
-                    break;
-                case SDLK_3:
-                    keys[3] = 1;
-                    break;
-                case SDLK_q:
-                    keys[4] = 1;
-                    break;
-                case SDLK_w:
-                    keys[5] = 1;
-                    break;
-                case SDLK_e:
-                    keys[6] = 1;
-                    break;
-                case SDLK_a:
-                    keys[7] = 1;
-                    break;
-                case SDLK_s:
-                    keys[8] = 1;
-                    break;
-                case SDLK_d:
-                    keys[9] = 1;
-                    break;
-                case SDLK_z:
-                    keys[0xA] = 1;
-                    break;
-                case SDLK_c:
-                    keys[0xB] = 1;
-                    break;
-                case SDLK_4:
-                    keys[0xC] = 1;
-                    break;
-                case SDLK_r:
-                    keys[0xD] = 1;
-                    break;
-                case SDLK_f:
-                    keys[0xE] = 1;
-                    break;
-                case SDLK_v:
-                    keys[0xF] = 1;
-                    break;
-                }
-                break;
-            case SDL_KEYUP:
-                switch (event.key.keysym.sym) {
-                case SDLK_x:
-                    keys[0] = 0;
-                    break;
-                case SDLK_1:
-                    keys[1] = 0;
-                    break;
-                case SDLK_2:
-                    keys[2] = 0;
-                    break;
-                case SDLK_3:
-                    keys[3] = 0;
-                    break;
-                case SDLK_q:
-                    keys[4] = 0;
-                    break;
-                case SDLK_w:
-                    keys[5] = 0;
-                    break;
-                case SDLK_e:
-                    keys[6] = 0;
-                    break;
-                case SDLK_a:
-                    keys[7] = 0;
-                    break;
-                case SDLK_s:
-                    keys[8] = 0;
-                    break;
-                case SDLK_d:
-                    keys[9] = 0;
-                    break;
-                case SDLK_z:
-                    keys[0xA] = 0;
-                    break;
-                case SDLK_c:
-                    keys[0xB] = 0;
-                    break;
-                case SDLK_4:
-                    keys[0xC] = 0;
-                    break;
-                case SDLK_r:
-                    keys[0xD] = 0;
-                    break;
-                case SDLK_f:
-                    keys[0xE] = 0;
-                    break;
-                case SDLK_v:
-                    keys[0xF] = 0;
-                    break;
-                }
-                break;
             }
+            else if (event.key.keysym.sym == SDLK_BACKSPACE) {
+                rewindHeld = true;
+            }
+            else if (!event.key.repeat) {
+                keypad.Press(event.key.keysym.sym);
+            }
+            break;
+        case SDL_KEYUP:
+            if (event.key.keysym.sym == SDLK_BACKSPACE) {
+                rewindHeld = false;
+            }
+            else {
+                keypad.Release(event.key.keysym.sym);
+            }
+            break;
         }
         return quit;
     }
-private:
     SDL_Window* window{};
     SDL_Renderer* renderer{};
     SDL_Texture* texture{};
+    Presenter presenter;
+    std::atomic<bool> rewindHeld{ false };     // read by the emulation thread
+    Keypad keypad;
+};
+
+/*
+    Square-wave buzzer. The emulation thread publishes the sound timer state
+    once per 60 Hz tick into a lock-free ring and never calls SDL; the audio
+    callback pulls one tick per 1/60 s of samples. Ticks queued beyond one
+    audio buffer are dropped, so the tone is never more than a buffer behind
+    emulated time, and the queue cannot grow.
+*/
+class SquareWave : public AudioSink {
+public:
+    static constexpr int SAMPLE_RATE = 48000;
+    static constexpr int BUFFER_SAMPLES = 512;
+    static constexpr double FREQUENCY = 440.0;
+    static constexpr int16_t AMPLITUDE = 3000;
+    static constexpr int MAX_HELD_TICKS = 2;     // how long an underrun keeps the last state
+
+    SquareWave() {
+        if (SDL_InitSubSystem(SDL_INIT_AUDIO) < 0) {
+            std::cerr << "Failed to initialize audio: " << SDL_GetError() << std::endl;
+            return;
+        }
+        SDL_AudioSpec want{};
+        want.freq = SAMPLE_RATE;
+        want.format = AUDIO_S16SYS;
+        want.channels = 1;
+        want.samples = BUFFER_SAMPLES;
+        want.callback = &SquareWave::Callback;
+        want.userdata = this;
+        SDL_AudioSpec have{};
+        deviceId = SDL_OpenAudioDevice(NULL, 0, &want, &have, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE | SDL_AUDIO_ALLOW_SAMPLES_CHANGE);
+        if (deviceId == 0) {
+            std::cerr << "Failed to open audio device: " << SDL_GetError() << std::endl;
+            return;
+        }
+        samplesPerTick = have.freq / 60.0;
+        phaseStep = FREQUENCY / have.freq;
+        maxQueuedTicks = (size_t)(have.samples / samplesPerTick) + 1;
+        SDL_PauseAudioDevice(deviceId, 0);
+    }
+    ~SquareWave() {
+        if (deviceId != 0) {
+            SDL_CloseAudioDevice(deviceId);
+        }
+    }
+    void Tick(bool soundOn) override {
+        ticks.Push(soundOn ? 1 : 0);        // full only if the device has stopped pulling
+    }
+private:
+    static void SDLCALL Callback(void* userdata, Uint8* stream, int length) {
+        static_cast<SquareWave*>(userdata)->Fill((int16_t*)stream, length / (int)sizeof(int16_t));
+    }
+    // Runs on the audio thread
+    void Fill(int16_t* out, int count) {
+        uint8_t tick;
+        while (ticks.Size() > maxQueuedTicks && ticks.Pop(tick)) {
+        }
+        for (int i = 0; i < count; ++i) {
+            if (samplesLeft <= 0.0) {
+                samplesLeft += samplesPerTick;
+                if (ticks.Pop(tick)) {
+                    soundOn = tick != 0;
+                    held = 0;
+                }
+                else if (++held > MAX_HELD_TICKS) {
+                    soundOn = false;        // the emulator is paused or stalled
+                }
+            }
+            samplesLeft -= 1.0;
+
+            phase += phaseStep;
+            if (phase >= 1.0) {
+                phase -= 1.0;
+            }
+            out[i] = soundOn ? (phase < 0.5 ? AMPLITUDE : (int16_t)-AMPLITUDE) : 0;
+        }
+    }
+
+    SDL_AudioDeviceID deviceId{};
+    SpscRing<uint8_t, 64> ticks;
+    size_t maxQueuedTicks{ 1 };
+
+    // Audio thread only
+    double samplesPerTick{ SAMPLE_RATE / 60.0 };
+    double samplesLeft{};
+    double phase{};
+    double phaseStep{ FREQUENCY / SAMPLE_RATE };
+    bool soundOn{};
+    int held{};
 };
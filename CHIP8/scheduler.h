@@ -0,0 +1,49 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+/*
+    Paces emulation at 60 frames per second against steady_clock deadlines.
+    Each frame is a fixed number of instructions, so the instruction rate is
+    the requested rate rounded to a multiple of 60. Between frames the host
+    sleeps instead of spinning.
+*/
+class FrameScheduler {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    static constexpr int FRAMES_PER_SECOND = 60;
+    static constexpr int MAX_FRAMES_BEHIND = 5;
+
+    FrameScheduler(double instructionsPerSecond)
+        : frameLength(std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / FRAMES_PER_SECOND))),
+          nextFrame(Clock::now() + frameLength) {
+        double perFrame = instructionsPerSecond / FRAMES_PER_SECOND + 0.5;
+        cyclesPerFrame = perFrame < 1.0 ? 1 : (uint32_t)perFrame;
+    }
+
+    uint32_t CyclesPerFrame() const { return cyclesPerFrame; }
+
+    // Sleeps off whatever is left of the current frame, then starts the next
+    void FrameDone() {
+        Clock::time_point now = Clock::now();
+        if (now < nextFrame) {
+            std::this_thread::sleep_until(nextFrame);
+            nextFrame += frameLength;
+        }
+        else if (now - nextFrame > MAX_FRAMES_BEHIND * frameLength) {
+            // Too far behind (stalled window, debugger, ...): drop frames
+            nextFrame = now + frameLength;
+        }
+        else {
+            nextFrame += frameLength;
+        }
+    }
+
+private:
+    Clock::duration frameLength;
+    Clock::time_point nextFrame;
+    uint32_t cyclesPerFrame;
+};
@@ -0,0 +1,659 @@
+#include "CHIP_8.h"
+#include "Lockstep.h"
+#include "Movie.h"
+#include "Profiler.h"
+#include "Rewind.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+using std::string;
+
+/*
+    Regression tests for the core.
+
+    Usage: chip8_tests [TEST...]
+
+    Runs the named tests, or all of them, and prints a line for each. Failed
+    checks are printed too and make the exit status nonzero. CMake registers
+    each test with ctest.
+*/
+
+static unsigned int failures = 0;
+
+#define CHECK(condition) Check((condition), #condition, __FILE__, __LINE__)
+
+static bool Check(bool passed, char const* text, char const* file, int line) {
+    if (!passed) {
+        fprintf(stderr, "%s:%d: check failed: %s\n", file, line, text);
+        ++failures;
+    }
+    return passed;
+}
+
+typedef std::vector<uint8_t> Rom;
+
+static Rom Assemble(std::vector<uint16_t> const& words) {
+    Rom rom;
+    for (uint16_t word : words) {
+        rom.push_back((uint8_t)(word >> 8));
+        rom.push_back((uint8_t)word);
+    }
+    return rom;
+}
+
+static MachineState State(CHIP_8 const& chip8) {
+    std::unique_ptr<Snapshot> snapshot(new Snapshot);
+    chip8.SaveState(*snapshot);
+    return snapshot->state;
+}
+
+static bool SameState(CHIP_8 const& a, CHIP_8 const& b) {
+    std::unique_ptr<Snapshot> x(new Snapshot), y(new Snapshot);
+    a.SaveState(*x);
+    b.SaveState(*y);
+    return memcmp(&x->state, &y->state, sizeof(MachineState)) == 0;
+}
+
+static uint16_t OpcodeAt(CHIP_8 const& chip8) {
+    uint16_t pc = chip8.GetPC();
+    return (uint16_t)(chip8.GetMemory(pc) << 8 | chip8.GetMemory(pc + 1));
+}
+
+// A random program of ALU, skip, jump, call, timer, memory and draw
+// instructions with targets inside it
+static Rom RandomRom(std::mt19937& rng) {
+    size_t length = 64 + 2 * (rng() % 100);
+    Rom rom(length);
+    for (size_t i = 0; i < length; i += 2) {
+        uint16_t x = rng() & 0x0F, y = rng() & 0x0F, nn = rng() & 0xFF;
+        uint16_t target = (uint16_t)(0x200 + 2 * (rng() % (length / 2)));
+        unsigned int r = rng() % 100;
+        uint16_t opcode;
+        if (r < 10) opcode = 0x6000 | x << 8 | nn;
+        else if (r < 20) opcode = 0x7000 | x << 8 | nn;
+        else if (r < 45) {
+            static const uint16_t ALU[] = { 0x0, 0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7, 0xE };
+            opcode = 0x8000 | x << 8 | y << 4 | ALU[rng() % 9];
+        }
+        else if (r < 50) opcode = 0x3000 | x << 8 | nn;
+        else if (r < 55) opcode = 0x4000 | x << 8 | nn;
+        else if (r < 58) opcode = 0x5000 | x << 8 | y << 4;
+        else if (r < 61) opcode = 0x9000 | x << 8 | y << 4;
+        else if (r < 66) opcode = 0x1000 | target;
+        else if (r < 70) opcode = 0x2000 | target;
+        else if (r < 73) opcode = 0x00EE;
+        else if (r < 75) opcode = (uint16_t)(0xB000 | (target - rng() % 4));
+        else if (r < 78) opcode = 0xA000 | (rng() & 0x3FF);
+        else if (r < 81) opcode = 0xF01E | x << 8;
+        else if (r < 83) opcode = 0xF029 | x << 8;
+        else if (r < 86) opcode = 0xF007 | x << 8;
+        else if (r < 88) opcode = 0xF015 | x << 8;
+        else if (r < 90) opcode = 0xF018 | x << 8;
+        else if (r < 92) opcode = 0xC000 | x << 8 | nn;
+        else if (r < 94) opcode = 0xF055 | x << 8;
+        else if (r < 96) opcode = 0xF065 | x << 8;
+        else if (r < 98) opcode = 0xF033 | x << 8;
+        else opcode = (uint16_t)(0xD000 | x << 8 | y << 4 | (rng() % 16));
+        rom[i] = (uint8_t)(opcode >> 8);
+        rom[i + 1] = (uint8_t)opcode;
+    }
+    return rom;
+}
+
+// Where RandomRom() programs leave well defined behavior: running off the
+// end of Memory, odd PCs, keys above F and sprites past the edges
+static bool OffTheRails(CHIP_8 const& chip8) {
+    uint16_t opcode = OpcodeAt(chip8);
+    uint8_t vx = chip8.GetRegister((opcode >> 8) & 0x0F);
+    uint8_t vy = chip8.GetRegister((opcode >> 4) & 0x0F);
+    if (chip8.GetPC() >= 0xF00 || chip8.GetIndex() >= 0xF00 || (chip8.GetPC() & 1)) {
+        return true;
+    }
+    if ((opcode >> 12) == 0xD && (vy % 32 + (opcode & 0x0F) > 32 || vx % 64 > 56)) {
+        return true;
+    }
+    return (opcode >> 12) == 0xE && vx > 0x0F;
+}
+
+//////////////////////////////////// Tests //////////////////////////////////////
+
+// Recompiled runs of random programs end in the same state as the
+// interpreter, under every quirk profile
+static void TestRecompiler() {
+    for (unsigned int verify = 0; verify < 2; ++verify) {
+        for (unsigned int seed = 0; seed < 200; ++seed) {
+            std::mt19937 rng(seed);
+            Rom rom = RandomRom(rng);
+            std::unique_ptr<CHIP_8> recompiled(new CHIP_8()), interpreted(new CHIP_8());
+            QuirkProfile quirks = (QuirkProfile)(seed % QUIRK_PROFILES);
+            for (CHIP_8* chip8 : { recompiled.get(), interpreted.get() }) {
+                chip8->LoadROM(rom.data(), rom.size());
+                chip8->SetSeed(seed + 1);
+                chip8->SetQuirks(quirks);
+            }
+            if (!recompiled->EnableRecompiler(true, verify != 0)) {
+                return;     // not an x86-64 host
+            }
+
+            for (uint32_t retired = 0; retired < 5000; ) {
+                uint32_t count = 0;
+                for (uint32_t chunk = 1 + rng() % 40; count < chunk && !OffTheRails(*interpreted); ++count) {
+                    interpreted->Cycle();
+                }
+                if (count == 0) {
+                    break;
+                }
+                RunResult result = recompiled->Run(count, EXIT_BUDGET);
+                retired += count;
+                if (!CHECK(result.retired == count) || !CHECK(SameState(*recompiled, *interpreted))) {
+                    fprintf(stderr, "  seed %u, %s, after %u instructions\n", seed, QuirkProfileName(quirks), retired);
+                    break;
+                }
+            }
+            CHECK(recompiled->GetRecompiler()->Stats().verifyFailures == 0);
+        }
+    }
+}
+
+struct CountingAudio : AudioSink {
+    uint64_t ticks = 0;
+    uint64_t sounding = 0;
+    void Tick(bool sound) override {
+        ++ticks;
+        sounding += sound;
+    }
+};
+
+// Skipping idle loops retires, stops and ticks exactly like running them
+static void TestIdleSkip() {
+    for (unsigned int seed = 0; seed < 300; ++seed) {
+        std::mt19937 rng(seed);
+        size_t length = 16 + 2 * (rng() % 40);
+        Rom rom(length);
+        for (size_t i = 0; i < length; i += 2) {
+            uint16_t here = (uint16_t)(0x200 + i);
+            uint16_t x = rng() & 3, y = rng() & 3, nn = rng() & 7;
+            uint16_t target = (uint16_t)(0x200 + 2 * (rng() % (length / 2)));
+            if (rng() % 6 == 0 && i + 6 <= length) {
+                // A delay timer wait
+                std::vector<uint16_t> wait = { (uint16_t)(0xF007 | x << 8), (uint16_t)((rng() & 1 ? 0x3000 : 0x4000) | x << 8 | rng() % 3), (uint16_t)(0x1000 | here) };
+                Rom words = Assemble(wait);
+                std::copy(words.begin(), words.end(), rom.begin() + i);
+                i += 4;
+                continue;
+            }
+            unsigned int r = rng() % 100;
+            uint16_t opcode;
+            if (r < 10) opcode = 0x6000 | x << 8 | nn;
+            else if (r < 15) opcode = 0x7001 | x << 8;
+            else if (r < 20) opcode = 0x3000 | x << 8 | nn;
+            else if (r < 25) opcode = 0x4000 | x << 8 | nn;
+            else if (r < 32) opcode = 0x1000 | target;
+            else if (r < 40) opcode = (uint16_t)(0x1000 | (here - 2 * (rng() % 3)));
+            else if (r < 48) opcode = 0xF007 | x << 8;
+            else if (r < 54) opcode = 0xF015 | x << 8;
+            else if (r < 58) opcode = 0xF018 | x << 8;
+            else if (r < 64) opcode = 0xE09E | x << 8;
+            else if (r < 70) opcode = 0xE0A1 | x << 8;
+            else if (r < 76) opcode = 0xF00A | x << 8;
+            else if (r < 80) opcode = 0xA050;
+            else if (r < 84) opcode = 0xD015 | x << 8 | y << 4;
+            else if (r < 88) opcode = 0x00E0;
+            else opcode = (uint16_t)(0x8000 | x << 8 | y << 4 | (rng() % 8));
+            rom[i] = (uint8_t)(opcode >> 8);
+            rom[i + 1] = (uint8_t)opcode;
+        }
+
+        std::unique_ptr<CHIP_8> skipping(new CHIP_8()), stepping(new CHIP_8());
+        CountingAudio skippingAudio, steppingAudio;
+        skipping->Attach(&skippingAudio, nullptr, nullptr);
+        stepping->Attach(&steppingAudio, nullptr, nullptr);
+        uint32_t cyclesPerFrame = 1 + rng() % 20;
+        for (CHIP_8* chip8 : { skipping.get(), stepping.get() }) {
+            chip8->LoadROM(rom.data(), rom.size());
+            chip8->SetSeed(seed + 1);
+            chip8->SetCyclesPerFrame(cyclesPerFrame);
+        }
+        stepping->EnableIdleSkip(false);
+
+        for (unsigned int run = 0; run < 400; ++run) {
+            if (rng() % 8 == 0) {
+                uint16_t keys = rng() % 3 == 0 ? 0 : (uint16_t)(1u << (rng() % 4));
+                skipping->SetKeys(keys);
+                stepping->SetKeys(keys);
+            }
+            uint32_t budget = rng() % 4 == 0 ? 10000 : 1 + rng() % 200;
+            uint8_t stopOn = (uint8_t)(rng() % 16);
+            RunResult a = skipping->Run(budget, stopOn), b = stepping->Run(budget, stopOn);
+            bool same = CHECK(a.reason == b.reason) && CHECK(a.retired == b.retired) && CHECK(SameState(*skipping, *stepping))
+                && CHECK(skippingAudio.ticks == steppingAudio.ticks) && CHECK(skippingAudio.sounding == steppingAudio.sounding);
+            if (!same) {
+                fprintf(stderr, "  seed %u, run %u: reason %x/%x, retired %u/%u\n", seed, run, a.reason, b.reason, a.retired, b.retired);
+                break;
+            }
+        }
+    }
+}
+
+// A random classic program for LockstepEngine: I points anywhere in the
+// first 1 KB, fonts included, and memory writes give lanes private pages
+static Rom RandomClassicRom(std::mt19937& rng) {
+    size_t length = 64 + 2 * (rng() % 100);
+    Rom rom(length);
+    for (size_t i = 0; i < length; i += 2) {
+        uint16_t x = rng() & 0x0F, y = rng() & 0x0F, nn = rng() & 0xFF;
+        uint16_t target = (uint16_t)(0x200 + 2 * (rng() % (length / 2)));
+        unsigned int r = rng() % 100;
+        uint16_t opcode;
+        if (r < 8) opcode = 0x6000 | x << 8 | nn;
+        else if (r < 16) opcode = 0x7000 | x << 8 | nn;
+        else if (r < 36) {
+            static const uint16_t ALU[] = { 0x0, 0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7, 0xE };
+            opcode = 0x8000 | x << 8 | y << 4 | ALU[rng() % 9];
+        }
+        else if (r < 40) opcode = 0x3000 | x << 8 | nn;
+        else if (r < 44) opcode = 0x4000 | x << 8 | nn;
+        else if (r < 46) opcode = 0x5000 | x << 8 | y << 4;
+        else if (r < 48) opcode = 0x9000 | x << 8 | y << 4;
+        else if (r < 52) opcode = 0x1000 | target;
+        else if (r < 55) opcode = 0x2000 | target;
+        else if (r < 57) opcode = 0x00EE;
+        else if (r < 58) opcode = (uint16_t)(0xB000 | (target - rng() % 4));
+        else if (r < 63) opcode = 0xA000 | (rng() & 0x3FF);
+        else if (r < 65) opcode = 0xF01E | x << 8;
+        else if (r < 67) opcode = 0xF029 | x << 8;
+        else if (r < 69) opcode = 0xF007 | x << 8;
+        else if (r < 71) opcode = 0xF015 | x << 8;
+        else if (r < 73) opcode = 0xF018 | x << 8;
+        else if (r < 76) opcode = 0xC000 | x << 8 | nn;
+        else if (r < 79) opcode = 0xF033 | x << 8;
+        else if (r < 83) opcode = 0xF055 | x << 8;
+        else if (r < 86) opcode = 0xF065 | x << 8;
+        else if (r < 89) opcode = 0xE09E | x << 8;
+        else if (r < 91) opcode = 0xE0A1 | x << 8;
+        else if (r < 92) opcode = 0xF00A | x << 8;
+        else if (r < 93) opcode = 0x00E0;
+        else opcode = (uint16_t)(0xD000 | x << 8 | y << 4 | (1 + rng() % 15));
+        rom[i] = (uint8_t)(opcode >> 8);
+        rom[i + 1] = (uint8_t)opcode;
+    }
+    return rom;
+}
+
+// Where LockstepEngine leaves CHIP_8's behavior: SUPER-CHIP and XO-CHIP
+// instructions (FX55 can write them over the program), running off the end
+// of Memory, keys above F, DXY0 and the stack's ends
+static bool BeyondLockstep(CHIP_8 const& chip8) {
+    uint16_t opcode = OpcodeAt(chip8);
+    unsigned int opcodeClass = Profiler::Classify(opcode);
+    if (opcodeClass >= Profiler::CLASS_00CN && opcodeClass != Profiler::CLASS_NULL) {
+        return true;
+    }
+    if (chip8.GetPC() >= 0xF00 || chip8.GetIndex() >= 0xF00) {
+        return true;
+    }
+    if ((opcode >> 12) == 0xE && chip8.GetRegister((opcode >> 8) & 0x0F) > 0x0F) {
+        return true;
+    }
+    if ((opcode >> 12) == 0xD && (opcode & 0x0F) == 0) {
+        return true;
+    }
+    return ((opcode >> 12) == 0x2 && chip8.GetSP() >= 16) || (opcode == 0x00EE && chip8.GetSP() == 0);
+}
+
+// Registers only, or with full set, timers, Display and Memory too
+static bool SameLane(CHIP_8 const& chip8, LockstepEngine const& engine, unsigned int lane, bool full) {
+    bool same = chip8.GetPC() == engine.GetPC(lane) && chip8.GetIndex() == engine.GetIndex(lane) && chip8.GetSP() == engine.GetSP(lane);
+    for (unsigned int x = 0; x < 16 && same; ++x) {
+        same = chip8.GetRegister(x) == engine.GetRegister(lane, x);
+    }
+    if (!same || !full) {
+        return same;
+    }
+
+    MachineState state = State(chip8);
+    same = state.Delay_Timer == engine.GetDelayTimer(lane) && state.Sound_Timer == engine.GetSoundTimer(lane)
+        && memcmp(state.Display[0][0], engine.Display(lane), DISPLAY_HEIGHT * sizeof(uint64_t)) == 0;
+    for (unsigned int address = 0; address < sizeof(state.Memory) && same; ++address) {
+        same = state.Memory[address] == engine.ReadMemory(lane, (uint16_t)address);
+    }
+    return same;
+}
+
+// Every lane of a LockstepEngine matches a CHIP_8 with the same seed and
+// keys, instruction by instruction, while the lanes split and rejoin
+static void TestLockstep() {
+    const unsigned int LANES = 40;      // one full block of lanes and part of another
+    uint64_t groups = 0, steps = 0, privatePages = 0;
+    for (unsigned int seed = 0; seed < 300; ++seed) {
+        std::mt19937 rng(seed);
+        Rom rom = RandomClassicRom(rng);
+        std::unique_ptr<LockstepEngine> engine(new LockstepEngine(LANES));
+        engine->LoadROM(rom.data(), rom.size());
+        engine->SetCyclesPerFrame(7);
+        std::vector<std::unique_ptr<CHIP_8>> machines;
+        for (unsigned int lane = 0; lane < LANES; ++lane) {
+            uint16_t keys = lane % 3 == 0 ? 0 : (uint16_t)rng();
+            uint32_t laneSeed = seed * LANES + lane + 1;
+            machines.emplace_back(new CHIP_8());
+            machines.back()->LoadROM(rom.data(), rom.size());
+            machines.back()->SetCyclesPerFrame(7);
+            machines.back()->SetSeed(laneSeed);
+            machines.back()->SetKeys(keys);
+            engine->SetSeed(lane, laneSeed);
+            engine->SetKeys(lane, keys);
+        }
+
+        const unsigned int STEPS = 2000;
+        for (unsigned int step = 0; step < STEPS; ++step) {
+            bool beyond = false;
+            for (std::unique_ptr<CHIP_8> const& chip8 : machines) {
+                beyond = beyond || BeyondLockstep(*chip8);
+            }
+            bool full = beyond || step % 100 == 99 || step == STEPS - 1;
+            if (!beyond) {
+                for (std::unique_ptr<CHIP_8>& chip8 : machines) {
+                    chip8->Run(1, EXIT_BUDGET);
+                }
+                engine->Run(1);
+            }
+
+            bool same = true;
+            for (unsigned int lane = 0; lane < LANES && same; ++lane) {
+                if (!CHECK(same = SameLane(*machines[lane], *engine, lane, full))) {
+                    fprintf(stderr, "  seed %u, step %u, lane %u\n", seed, step, lane);
+                }
+            }
+            if (!same || beyond) {
+                break;
+            }
+        }
+        groups += engine->Stats().groups;
+        steps += engine->Stats().steps;
+        privatePages += engine->Stats().privatePages;
+    }
+
+    // The programs did split lanes and copy pages
+    CHECK(groups > steps && privatePages > 0);
+}
+
+// Draws a digit at a random place, counts while a random key is held and
+// loops: the state changes every frame
+static Rom RandomGameRom() {
+    return Assemble({ 0xC0FF, 0xC13F, 0xC21F, 0xA050, 0xD125, 0x630F, 0x8302, 0xE39E, 0x1200, 0x7401, 0x1200 });
+}
+
+// Restoring a snapshot, in memory or from a file, resumes the same run
+static void TestSnapshots() {
+    Rom rom = RandomGameRom();
+    for (unsigned int recompile = 0; recompile < 2; ++recompile) {
+        std::unique_ptr<CHIP_8> chip8(new CHIP_8());
+        chip8->LoadROM(rom.data(), rom.size());
+        chip8->SetKeys(0x0008);
+        chip8->EnableRecompiler(recompile != 0);
+        chip8->Run(12345, EXIT_BUDGET);
+
+        std::unique_ptr<Snapshot> saved(new Snapshot), first(new Snapshot), second(new Snapshot);
+        chip8->SaveState(*saved);
+        chip8->Run(50000, EXIT_BUDGET);
+        chip8->SaveState(*first);
+        CHECK(chip8->LoadState(*saved));
+        chip8->Run(50000, EXIT_BUDGET);
+        chip8->SaveState(*second);
+        CHECK(memcmp(first.get(), second.get(), sizeof(Snapshot)) == 0);
+
+        CHECK(chip8->SaveState("chip8_tests.state"));
+        std::unique_ptr<CHIP_8> loaded(new CHIP_8());
+        CHECK(loaded->LoadState("chip8_tests.state"));
+        loaded->Run(1000, EXIT_BUDGET);
+        chip8->Run(1000, EXIT_BUDGET);
+        CHECK(SameState(*chip8, *loaded));
+        std::remove("chip8_tests.state");
+
+        // Another version is refused and leaves the machine alone
+        saved->version = SNAPSHOT_VERSION + 1;
+        MachineState before = State(*chip8);
+        CHECK(!chip8->LoadState(*saved));
+        MachineState after = State(*chip8);
+        CHECK(memcmp(&before, &after, sizeof(MachineState)) == 0);
+    }
+}
+
+// Rewinding restores exactly the state recorded that many frames back
+static void TestRewind() {
+    Rom rom = RandomGameRom();
+    const unsigned int FRAMES = 600;
+    std::unique_ptr<CHIP_8> chip8(new CHIP_8());
+    chip8->LoadROM(rom.data(), rom.size());
+    chip8->SetKeys(0x0008);
+    RewindBuffer rewind(1 << 20, 60);
+    std::vector<MachineState> history(FRAMES);
+    for (unsigned int frame = 0; frame < FRAMES; ++frame) {
+        chip8->Run(UINT32_MAX, EXIT_FRAME);
+        history[frame] = State(*chip8);
+        rewind.Record(*chip8);
+    }
+    CHECK(rewind.Frames() > 300);
+
+    unsigned int frame = FRAMES - 1;
+    for (uint32_t back : { 1u, 5u, 59u, 60u, 61u, 100u, 1u, 1u, 30u }) {
+        if (!CHECK(rewind.Rewind(*chip8, back))) {
+            break;
+        }
+        frame -= back;
+        MachineState state = State(*chip8);
+        if (!CHECK(memcmp(&state, &history[frame], sizeof(MachineState)) == 0)) {
+            fprintf(stderr, "  rewound to frame %u\n", frame);
+        }
+    }
+
+    // Recording carries on from the rewound state
+    for (unsigned int f = 0; f < 100; ++f) {
+        chip8->Run(UINT32_MAX, EXIT_FRAME);
+        rewind.Record(*chip8);
+    }
+    MachineState recorded = State(*chip8);
+    chip8->Run(UINT32_MAX, EXIT_FRAME);
+    rewind.Record(*chip8);
+    CHECK(rewind.Rewind(*chip8, 1));
+    MachineState rewound = State(*chip8);
+    CHECK(memcmp(&recorded, &rewound, sizeof(MachineState)) == 0);
+}
+
+// A replayed movie ends in the state the recording did
+static void TestMovie() {
+    Rom rom = RandomGameRom();
+    std::unique_ptr<CHIP_8> recorded(new CHIP_8()), replayed(new CHIP_8());
+    recorded->LoadROM(rom.data(), rom.size());
+    recorded->SetCyclesPerFrame(20);
+    recorded->SetQuirks(QUIRKS_SCHIP);
+    Movie recording;
+    recording.StartRecording(*recorded, 12345);
+    std::mt19937 rng(3);
+    for (unsigned int frame = 0; frame < 500; ++frame) {
+        if (rng() % 10 == 0) {
+            recorded->SetKeys(rng() % 3 == 0 ? 0 : (uint16_t)(1u << (rng() % 16)));
+        }
+        recording.RecordFrame(*recorded);
+        recorded->Run(UINT32_MAX, EXIT_FRAME);
+    }
+    CHECK(recording.Save("chip8_tests.c8m"));
+
+    Movie replay;
+    CHECK(replay.Load("chip8_tests.c8m"));
+    std::remove("chip8_tests.c8m");
+    CHECK(replay.Frames() == 500);
+    replayed->LoadROM(rom.data(), rom.size());
+    replay.StartReplay(*replayed);
+    CHECK(replayed->GetCyclesPerFrame() == 20 && replayed->GetQuirks() == QUIRKS_SCHIP);
+    while (replay.ReplayFrame(*replayed)) {
+        replayed->Run(UINT32_MAX, EXIT_FRAME);
+    }
+    CHECK(SameState(*recorded, *replayed));
+}
+
+// Breakpoints stop before their instruction, watchpoints and conditions
+// after the one that triggered them; an armed debugger that never stops
+// changes nothing
+static void TestDebugger() {
+    // 0x200: V0 = 3, I = 0x300, loop: store V0, V0 += 1, jump loop
+    Rom rom = Assemble({ 0x6003, 0xA300, 0xF055, 0x7001, 0x1204 });
+    std::unique_ptr<CHIP_8> chip8(new CHIP_8());
+    chip8->LoadROM(rom.data(), rom.size());
+    Debugger* debugger = chip8->EnableDebugger(true);
+
+    debugger->SetBreakpoint(0x206);
+    RunResult result = chip8->Run(1000, EXIT_BUDGET);
+    CHECK((result.reason & EXIT_BREAK) && result.retired == 3);
+    CHECK(debugger->LastStop().reason == Debugger::STOP_BREAKPOINT && chip8->GetPC() == 0x206);
+    result = chip8->Run(1000, EXIT_BUDGET);     // resuming runs the instruction first
+    CHECK((result.reason & EXIT_BREAK) && result.retired == 3 && chip8->GetRegister(0) == 4);
+
+    // A breakpoint's condition is checked when it is reached
+    debugger->ClearAll();
+    debugger->SetBreakpoint(0x206, Debugger::Condition{ 0, Debugger::EQUAL, 0x10 });
+    chip8->Run(1000, EXIT_BUDGET);
+    CHECK(chip8->GetPC() == 0x206 && chip8->GetRegister(0) == 0x10);
+
+    debugger->ClearAll();
+    debugger->SetWatchpoint(0x300, 1, Debugger::WATCH_WRITE);
+    result = chip8->Run(1000, EXIT_BUDGET);
+    CHECK((result.reason & EXIT_BREAK) && debugger->LastStop().reason == Debugger::STOP_WATCHPOINT);
+    CHECK(debugger->LastStop().pc == 0x204 && debugger->LastStop().address == 0x300 && debugger->LastStop().access == Debugger::WATCH_WRITE);
+    CHECK(chip8->GetPC() == 0x206 && chip8->GetMemory(0x300) == chip8->GetRegister(0));
+
+    debugger->ClearAll();
+    debugger->AddCondition(Debugger::Condition{ 0, Debugger::EQUAL, 0x40 });
+    chip8->Run(100000, EXIT_BUDGET);
+    CHECK(debugger->LastStop().reason == Debugger::STOP_CONDITION && debugger->LastStop().pc == 0x206);
+    CHECK(chip8->GetRegister(0) == 0x40 && chip8->GetPC() == 0x208);
+
+    debugger->ClearAll();
+    result = debugger->RunTo(0x204, 1000);
+    CHECK(debugger->LastStop().reason == Debugger::STOP_RUN_TO && chip8->GetPC() == 0x204);
+
+    // Armed with stops that never hit, the instrumented loop matches the normal one
+    Rom game = RandomGameRom();
+    std::unique_ptr<CHIP_8> plain(new CHIP_8()), armed(new CHIP_8());
+    for (CHIP_8* machine : { plain.get(), armed.get() }) {
+        machine->LoadROM(game.data(), game.size());
+        machine->SetSeed(7);
+    }
+    debugger = armed->EnableDebugger(true);
+    debugger->SetBreakpoint(0xFFE);
+    debugger->SetWatchpoint(0xFF0, 1, Debugger::WATCH_ACCESS);
+    debugger->AddCondition(Debugger::Condition{ 5, Debugger::EQUAL, 0xEE });
+    for (unsigned int frame = 0; frame < 3000; ++frame) {
+        uint16_t keys = frame % 97 < 3 ? (uint16_t)(1u << (frame % 16)) : 0;
+        plain->SetKeys(keys);
+        armed->SetKeys(keys);
+        RunResult a = plain->Run(10, EXIT_ALL), b = armed->Run(10, EXIT_ALL);
+        if (!CHECK(a.retired == b.retired && a.reason == b.reason)) {
+            break;
+        }
+    }
+    CHECK(SameState(*plain, *armed));
+}
+
+// Each profile's quirks, on the instructions they change
+static void TestQuirks() {
+    std::unique_ptr<CHIP_8> chip8(new CHIP_8());
+    std::unique_ptr<MachineState> state(new MachineState);
+    for (unsigned int p = 0; p < QUIRK_PROFILES; ++p) {
+        QuirkProfile profile = (QuirkProfile)p;
+        QuirkSet const& quirks = QUIRK_SETS[profile];
+        auto run = [&](std::vector<uint16_t> const& words, uint32_t count) {
+            Rom rom = Assemble(words);
+            CHIP_8::PowerOnState(*state, rom.data(), rom.size());
+            chip8->Reset(*state);
+            chip8->SetQuirks(profile);
+            chip8->Run(count, EXIT_BUDGET);
+        };
+        unsigned int failed = failures;
+
+        // V1 = 0x81, V2 = 0x03, shift
+        run({ 0x6181, 0x6203, 0x8126 }, 3);
+        CHECK(chip8->GetRegister(1) == (quirks.shiftReadsVy ? 0x01 : 0x40) && chip8->GetRegister(0xF) == 1);
+        run({ 0x6181, 0x6203, 0x812E }, 3);
+        CHECK(chip8->GetRegister(1) == (quirks.shiftReadsVy ? 0x06 : 0x02) && chip8->GetRegister(0xF) == (quirks.shiftReadsVy ? 0 : 1));
+
+        // 8XY7 writes Vx and keeps Vy
+        run({ 0x6105, 0x6207, 0x8127 }, 3);
+        CHECK(chip8->GetRegister(1) == 2 && chip8->GetRegister(2) == 7 && chip8->GetRegister(0xF) == 1);
+
+        run({ 0x6F05, 0x6101, 0x8121 }, 3);
+        CHECK(chip8->GetRegister(0xF) == (quirks.logicResetsVF ? 0 : 5));
+
+        // B210 with V0 = 4, V2 = 8
+        run({ 0x6004, 0x6208, 0xB210 }, 3);
+        CHECK(chip8->GetPC() == (quirks.jumpUsesVx ? 0x218 : 0x214));
+
+        unsigned int advance = quirks.loadStoreIndex == INDEX_KEPT ? 0 : quirks.loadStoreIndex == INDEX_PLUS_X ? 2 : 3;
+        run({ 0xA300, 0xF255 }, 2);
+        CHECK(chip8->GetIndex() == 0x300 + advance);
+        run({ 0xA300, 0xF265 }, 2);
+        CHECK(chip8->GetIndex() == 0x300 + advance);
+
+        // An 8 x 2 sprite of FF at the bottom right corner, low then high resolution
+        run({ 0x603C, 0x611F, 0xA208, 0xD012, 0xFFFF }, 4);
+        uint64_t row = 0xFull | (quirks.wrapSprites ? 0xFull << 60 : 0);
+        CHECK(chip8->Display[0][0][31] == row && chip8->Display[0][0][0] == (quirks.wrapSprites ? row : 0));
+        run({ 0x00FF, 0x607C, 0x613F, 0xA20A, 0xD012, 0xFFFF }, 5);
+        CHECK(chip8->Display[0][1][63] == 0xFull && chip8->Display[0][0][63] == (quirks.wrapSprites ? 0xFull << 60 : 0));
+        CHECK(chip8->Display[0][1][0] == (quirks.wrapSprites ? 0xFull : 0) && chip8->Display[0][0][0] == (quirks.wrapSprites ? 0xFull << 60 : 0));
+
+        if (failures != failed) {
+            fprintf(stderr, "  profile %s\n", QuirkProfileName(profile));
+        }
+    }
+}
+
+struct Test {
+    char const* name;
+    void (*run)();
+};
+
+static const Test TESTS[] = {
+    { "recompiler", TestRecompiler },
+    { "idle_skip", TestIdleSkip },
+    { "snapshots", TestSnapshots },
+    { "rewind", TestRewind },
+    { "movie", TestMovie },
+    { "debugger", TestDebugger },
+    { "quirks", TestQuirks },
+    { "lockstep", TestLockstep }
+};
+
+int main(int argc, char* argv[]) {
+    std::vector<Test> selected;
+    for (int a = 1; a < argc; ++a) {
+        bool found = false;
+        for (Test const& test : TESTS) {
+            if (argv[a] == string(test.name)) {
+                selected.push_back(test);
+                found = true;
+            }
+        }
+        if (!found) {
+            fprintf(stderr, "Unknown test: %s\n", argv[a]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (selected.empty()) {
+        selected.assign(std::begin(TESTS), std::end(TESTS));
+    }
+
+    for (Test const& test : selected) {
+        unsigned int before = failures;
+        test.run();
+        fprintf(stderr, "%-12s %s\n", test.name, failures == before ? "ok" : "FAILED");
+    }
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}